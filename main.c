@@ -2,6 +2,100 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ppp.h"
+
+// Compiler and interpreter state is per thread, so every --serve worker
+// compiles and runs its requests on its own copy
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// Compile errors go through fatal(): the message is printed and the process
+// exits, unless the thread set an error_trap (a --serve request), which then
+// gets the message and control back
+typedef struct {
+    jmp_buf jump;
+    char message[256];
+} ErrorTrap;
+
+static THREAD_LOCAL ErrorTrap* error_trap = NULL;
+
+#ifdef __GNUC__
+__attribute__((noreturn, format(printf, 1, 2)))
+#endif
+static void fatal(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (error_trap) {
+        vsnprintf(error_trap->message, sizeof(error_trap->message), format, args);
+        va_end(args);
+        longjmp(error_trap->jump, 1);
+    }
+    vprintf(format, args);
+    va_end(args);
+    exit(1);
+}
+
+// Allocation counters for --stats: every allocation of the lexer, parser,
+// optimizer and engines goes through these wrappers. The counters are per
+// thread; worker threads hand theirs to the thread that joins them.
+static THREAD_LOCAL unsigned long long alloc_count = 0;
+static THREAD_LOCAL unsigned long long alloc_bytes = 0;
+
+static void* countedMalloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return malloc(size);
+}
+
+static void* countedCalloc(size_t count, size_t size) {
+    alloc_count++;
+    alloc_bytes += count * size;
+    return calloc(count, size);
+}
+
+static void* countedRealloc(void* block, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return realloc(block, size);
+}
+
+#define malloc(size) countedMalloc(size)
+#define calloc(count, size) countedCalloc(count, size)
+#define realloc(block, size) countedRealloc(block, size)
 
 // Token types
 typedef enum {
@@ -16,13 +110,45 @@ typedef enum {
     TOKEN_EOF
 } TokenType;
 
-// Token structure
+// Token structure (16 bytes)
+// offset/length locate the lexeme in the source buffer, the token text is
+// the interned atom. Tokens from the legacy lexer have no source position.
+// Sources are limited to 4 GB and a source to ATOM_LIMIT distinct atoms so
+// both fit; the lexer stops with an error past either.
+#define ATOM_LIMIT (1u << 28)
 typedef struct {
-    TokenType type;
-    char value[256];
-    int line_number;
+    uint32_t offset;
+    uint32_t length;
+    int32_t line_number;
+    uint32_t type : 4;   // TokenType
+    uint32_t atom : 28;
 } Token;
 
+// Interned string. text is null-terminated and lives in the string pool.
+typedef struct {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+} Atom;
+
+// Atoms interned up front, in keywords[] and separators[] order, so the
+// parser can compare ids instead of strings
+enum {
+    ATOM_EMPTY,
+    ATOM_NUMBER,
+    ATOM_REPEAT,
+    ATOM_TIMES,
+    ATOM_WRITE,
+    ATOM_AND,
+    ATOM_NEWLINE,
+    ATOM_ASSIGN,
+    ATOM_MINUS_ASSIGN,
+    ATOM_PLUS_ASSIGN,
+    ATOM_SEMICOLON,
+    ATOM_OPEN_BLOCK,
+    ATOM_CLOSE_BLOCK
+};
+
 // Parse tree node types
 typedef enum {
     NODE_PROGRAM,
@@ -39,59 +165,311 @@ typedef enum {
     NODE_NEWLINE
 } NodeType;
 
-// Parse tree node structure
+// Parse tree node structure (32 bytes)
+// Nodes live in one flat array, ast.nodes. A node's children are the
+// child_count entries of ast.children starting at first_child. Names and
+// literals are atoms. slot (NODE_VARIABLE) and number (NODE_NUMBER) are
+// filled in by resolveSymbols(); number is BIG_TAG for a literal that does
+// not fit a long long, whose value is then read from the atom
 typedef struct TreeNode {
     NodeType type;
-    char* value;
-    struct TreeNode* children[10];
+    uint32_t atom;
+    union {
+        int slot;
+        long long number;
+    };
+    uint32_t first_child;
     int child_count;
     int line_number;
+    uint32_t loop;   // NODE_LOOP only: index into ast.loops
 } TreeNode;
 
+// Run-time state of a repeat loop: iterations run by the interpreter,
+// compiled code (--jit), closed form (set by the closed-form pass) and
+// the VM unrolling picked by --profile-use
+typedef struct {
+    int hits;
+    struct JitCode* jit;
+    struct ClosedForm* closed;
+    int unroll;   // body copies per VM iteration, 0 = not unrolled
+} LoopInfo;
+
+// Arena holding the whole parse tree, emptied at once by astReset()
+typedef struct {
+    TreeNode* nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t* children;       // child node indices, one range per node
+    uint32_t child_count;
+    uint32_t child_capacity;
+    uint32_t* pending;        // children of the nodes still being parsed
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    LoopInfo* loops;
+    uint32_t loop_count;
+    uint32_t loop_capacity;
+} Ast;
+
+// Brace index entry: a '{' token and its matching '}', by token index
+typedef struct {
+    uint32_t open;
+    uint32_t close;   // NO_BRACE while still open
+    uint32_t outer;   // enclosing pair, NO_BRACE at top level
+} BracePair;
+
+// Closed form of an accumulator loop: the slots its body writes end up as
+// polynomials of the given degree in the trip count
+typedef struct ClosedForm {
+    int degree;
+    int count;
+    int slots[];
+} ClosedForm;
+
+// Symbol table entry: variable name (atom) -> dense slot index
+typedef struct {
+    uint32_t atom;
+    int slot;
+} Symbol;
+
+// Source file, memory-mapped when the platform allows it
+typedef struct {
+    const char* data;
+    size_t size;
+    int mapped;
+} SourceFile;
+
+// Where program output goes and when it is flushed (--flush)
+typedef enum {
+    FLUSH_LINE,    // after every newline, for interactive use
+    FLUSH_BLOCK,   // when the buffer is full
+    FLUSH_EXIT,    // once at the end, the buffer grows as needed
+    FLUSH_REGION   // when the buffer is full, to the --exec-threads committer
+} FlushPolicy;
+
+typedef struct {
+    int fd;
+    FlushPolicy policy;
+    char* data;
+    size_t used;
+    size_t capacity;
+    int copy_fd;        // also gets everything sent, -1 for none (--cache-output)
+    size_t copy_room;   // bytes copy_fd may still take, past that copying stops
+    unsigned long long sent;   // bytes delivered so far
+    double first_sent;         // nowSeconds() of the first delivery (--watch)
+    int framed;         // every delivery goes out as a "D <length>" frame (--serve)
+} OutputSink;
+
+// Per-run resource limits, see governorTick()
+typedef struct {
+    long long fuel;                 // steps left before the next check
+    long long granted;              // fuel at the start of this slice
+    long long slice;                // steps between checks, LLONG_MAX when off
+    unsigned long long steps;       // steps of the slices before this one
+    unsigned long long max_steps;   // 0 = no limit, as for max_output
+    unsigned long long max_output;
+    double max_seconds;
+    double deadline;                // nowSeconds() past which the run stops
+    int preempt;                    // slices end in ppp_resume()
+} Governor;
+
 // Global variables
-const char* separators[] = {":=","-=", "+=",";","*","\""}; 
-const int sep_count = 6;
-const char* keywords[]={"number","repeat","times","write","and","newline"};  // Keywords dizisi tanımı 
+#ifndef PPP_LIBRARY
+static const char* separators[] = {":=","-=", "+=",";","*","\""}; 
+static const int sep_count = 6;
+#endif
+static const char* keywords[]={"number","repeat","times","write","and","newline"};  // Keywords dizisi tanımı 
+static const int keywordLengths[] = {6, 6, 5, 5, 3, 7};
+
+static THREAD_LOCAL Token* tokens = NULL;
+static THREAD_LOCAL size_t token_count = 0;
+static THREAD_LOCAL size_t token_capacity = 0;
+static THREAD_LOCAL size_t current_token_index = 0;
+
+static THREAD_LOCAL Atom* atoms = NULL;
+static THREAD_LOCAL uint32_t atom_count = 0;
+static THREAD_LOCAL uint32_t atom_capacity = 0;
+static THREAD_LOCAL uint32_t* atomTable = NULL;   // open addressing, atom ids (0 = empty slot)
+static THREAD_LOCAL uint32_t atomTableMask = 0;
+
+// Parse tree arena
+#define NO_NODE UINT32_MAX
+static THREAD_LOCAL Ast ast;
+
+static THREAD_LOCAL int blockCount = 0;
+static THREAD_LOCAL int blockLine = 0;   // where the outermost open block starts
+
+// Brace index built by the lexer, in the order the braces open, so the
+// parser can find statement boundaries without parsing
+#define NO_BRACE UINT32_MAX
+static THREAD_LOCAL BracePair* braces = NULL;
+static THREAD_LOCAL uint32_t brace_count = 0;
+static THREAD_LOCAL uint32_t brace_capacity = 0;
+static THREAD_LOCAL uint32_t brace_open = NO_BRACE;   // innermost pair not closed yet
+
+// Symbol table, shared by the lexer (declaration checks) and the interpreter
+static THREAD_LOCAL Symbol* symbols = NULL;       // open addressing, atom 0 marks an empty entry
+static THREAD_LOCAL uint32_t symbolMask = 0;
+static THREAD_LOCAL int symbol_count = 0;
+
+// Variable values for interpreter, indexed by slot. Values in
+// [-SMALL_LIMIT, SMALL_LIMIT) are stored as they are, any other one as
+// BIG_TAG with the number itself in bigs[slot].
+#define BIG_TAG LLONG_MIN
+#define SMALL_LIMIT (1LL << 62)
+static THREAD_LOCAL long long* slots = NULL;
+
+// Sign and magnitude, 64-bit limbs least significant first. Never 0 and
+// never small enough for a long long when it is the value of a slot.
+typedef struct {
+    uint64_t* limbs;
+    uint32_t count;
+    uint32_t capacity;
+    int negative;
+} BigNum;
+
+static THREAD_LOCAL BigNum* bigs = NULL;
+static THREAD_LOCAL uint32_t big_capacity = 0;
+
+static inline int isSmall(long long value) {
+    return (unsigned long long)value + (unsigned long long)SMALL_LIMIT < 2 * (unsigned long long)SMALL_LIMIT;
+}
 
-Token tokens[1000];
-int token_count = 0;
-int current_token_index = 0;
+// a + b or a - b for a small or BIG_TAG and b small. Fails unless both are
+// small and so is the result: with the margin of one bit, a sum can neither
+// wrap around nor get from BIG_TAG back into the small range.
+static inline int smallAdd(long long a, long long b, int subtract, long long* result) {
+    unsigned long long sum = subtract ? (unsigned long long)a - (unsigned long long)b :
+                                        (unsigned long long)a + (unsigned long long)b;
+    *result = (long long)sum;
+    return isSmall(*result);
+}
+
+// Where write statements print to (all engines)
+static THREAD_LOCAL OutputSink programOutput = {1, FLUSH_BLOCK, NULL, 0, 0, -1, 0, 0, 0, 0};
+
+// Limits of the running program (--max-steps, --max-time, --max-output)
+#define GOVERNOR_SLICE 65536
+static THREAD_LOCAL Governor governor = {LLONG_MAX, LLONG_MAX, LLONG_MAX, 0, 0, 0, 0, 0, 0};
+
+// Loops are JIT-compiled after this many interpreted iterations, 0 = off
+#define JIT_DEFAULT_THRESHOLD 1000
+static THREAD_LOCAL int jitThreshold = 0;
 
-int blockCount = 0;
-int blockLines[100];
-int blockLineIndex = 0;
+// Bytecode for the VM engine
+typedef enum {
+    OP_LOAD_CONST,     // acc = b
+    OP_LOAD_SLOT,      // acc = slots[b], clamped like loopCount()
+    OP_STORE,          // slots[a] = acc
+    OP_ADD_TO_SLOT,    // slots[a] += acc
+    OP_SUB_FROM_SLOT,  // slots[a] -= acc
+    OP_WRITE_INT,      // print slots[a]
+    OP_WRITE_STR,      // print atom b
+    OP_NEWLINE,
+    OP_CLOSED_FORM,    // acc = iterations left after the closed form of loop b
+    OP_LOOP_BEGIN,     // counters[a] = acc, jump to b when it is <= 0
+    OP_LOOP_END,       // jump to b while --counters[a] > 0
+    // Superinstructions, a load fused with the instruction that consumes it
+    OP_SET_CONST,      // slots[a] = b
+    OP_SET_SLOT,       // slots[a] = slots[b]
+    OP_ADD_CONST,      // slots[a] += b
+    OP_ADD_SLOT,       // slots[a] += slots[b]
+    OP_SUB_CONST,      // slots[a] -= b
+    OP_SUB_SLOT,       // slots[a] -= slots[b]
+    OP_TREE,           // run statement b with the tree walker
+    OP_HALT
+} OpCode;
+
+typedef struct {
+    uint32_t op;
+    int32_t a;
+    long long b;
+} Instr;
 
-#define MAX_VARS 200 
-char declaredVariables[MAX_VARS][64];
-int varCount = 0;
+typedef struct {
+    Instr* code;
+    int count;
+    int capacity;
+    int counter_count;  // loop counter registers, one per nesting level
+} Chunk;
 
-// Variable for interpreter
+// VM registers, kept between the slices of a run that ppp_resume() drives
 typedef struct {
-    char name[64];
-    long long value;
-} Variable;
+    const Instr* ip;
+    long long acc;
+    long long* counters;
+    long long executed;
+} VmState;
 
-Variable variables[MAX_VARS];
-int var_count = 0;
+// String pool: backing store for token text that does not exist verbatim in
+// the source (legacy lexer copies, string literals with collapsed spacing)
+typedef struct PoolChunk {
+    struct PoolChunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+} PoolChunk;
+
+static THREAD_LOCAL PoolChunk* stringPool = NULL;
 
 // Function prototypes
-void addToken(TokenType type, const char* value, int line);
-TreeNode* parseProgram();
-TreeNode* parseStatement();
-TreeNode* parseDeclaration();
-TreeNode* parseAssignment();
-TreeNode* parseWrite();
-TreeNode* parseLoop();
-TreeNode* createNode(NodeType type, char* value, int line);
-void addChild(TreeNode* parent, TreeNode* child);
-void printParseTree(TreeNode* node, int depth);
-void executeProgram(TreeNode* node);
-Token getCurrentToken();
-Token peekNextToken();
-void consumeToken();
+static void addToken(TokenType type, uint32_t atom, const char* lexeme, int length, int line);
+static TreeNode* parseProgram();
+static uint32_t parseStatement();
+static uint32_t parseDeclaration();
+static uint32_t parseAssignment();
+static uint32_t parseWrite();
+static void parseLoop();
+static void parseStatements(int inBlock);
+static uint32_t createNode(NodeType type, uint32_t atom, int line);
+static void addChild(uint32_t child);
+static void printParseTree(TreeNode* node, int depth);
+static void executeProgram(TreeNode* node);
+static void executeStatement(TreeNode* node);
+static double nowSeconds();
+static int jitEnter(TreeNode* loop, long long remaining);
+static long long runClosedForm(TreeNode* loop, long long count);
+static void bigCopy(BigNum* to, const BigNum* from);
+static void closedFormBig(const ClosedForm* form, long long count, const long long* table, BigNum* bigTable);
+static const Token* getCurrentToken();
+static const Token* peekNextToken();
+static void consumeToken();
+
+// String pool fonksiyonları
+static char* poolAlloc(size_t size) {
+    if (!stringPool || stringPool->size - stringPool->used < size) {
+        size_t chunkSize = size > 65536 ? size : 65536;
+        PoolChunk* chunk = (PoolChunk*)malloc(sizeof(PoolChunk) + chunkSize);
+        if (!chunk) {
+            fatal("Error: Out of memory\n");
+        }
+        chunk->next = stringPool;
+        chunk->used = 0;
+        chunk->size = chunkSize;
+        stringPool = chunk;
+    }
+    char* p = stringPool->data + stringPool->used;
+    stringPool->used += size;
+    return p;
+}
+
+static const char* poolCopy(const char* str, int length) {
+    char* p = poolAlloc((size_t)length + 1);
+    memcpy(p, str, (size_t)length);
+    p[length] = '\0';
+    return p;
+}
+
+static void poolReset() {
+    while (stringPool) {
+        PoolChunk* next = stringPool->next;
+        free(stringPool);
+        stringPool = next;
+    }
+}
 
 // Lexer fonksiyonları
-void replaceSeperator(char *line) {
+#ifndef PPP_LIBRARY
+static void replaceSeperator(char *line) {
     for (int i = 0; i < sep_count; i++) {
         char *pos = line;
         size_t sep_len = strlen(separators[i]);
@@ -104,8 +482,9 @@ void replaceSeperator(char *line) {
         }
     }
 }
+#endif
 
-int isNumber(const char *str) {
+static int isNumber(const char *str) {
     char *endptr;
     if (str == NULL || *str == '\0')
         return 0;
@@ -113,515 +492,288 @@ int isNumber(const char *str) {
     return (*endptr == '\0');
 }
 
-// Variable management fonksiyonları
-void addVariable(const char* var) {
-    if (varCount < MAX_VARS) {
-        strcpy(declaredVariables[varCount++], var);
-    }
+// isNumber() for a lexeme that is not null-terminated. Plain digit runs are
+// decided here, anything that might be a strtod() form goes through isNumber.
+static int isNumberN(const char* str, int length) {
+    int i = 0;
+    while (i < length && str[i] >= '0' && str[i] <= '9') i++;
+    if (i == length) return length > 0;
+
+    unsigned char c = (unsigned char)str[0];
+    if (!isdigit(c) && !isspace(c) && !strchr("+-.iInN", c)) return 0;
+
+    char small[64];
+    char* buf = length < (int)sizeof(small) ? small : (char*)malloc((size_t)length + 1);
+    memcpy(buf, str, (size_t)length);
+    buf[length] = '\0';
+    int result = isNumber(buf);
+    if (buf != small) free(buf);
+    return result;
 }
 
-int isDeclared(const char* var) {
-    for (int i = 0; i < varCount; i++) {
-        if (strcmp(var, declaredVariables[i]) == 0) return 1;
+// Atom table fonksiyonları
+static uint32_t hashText(const char* text, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
     }
-    return 0;
+    return hash;
 }
 
-void addToken(TokenType type, const char* value, int line) {
-    if (token_count < 1000) {
-        tokens[token_count].type = type;
-        strcpy(tokens[token_count].value, value);
-        tokens[token_count].line_number = line;
-        token_count++;
+// Puts every atom into atomTable
+static void fillAtomTable() {
+    memset(atomTable, 0, sizeof(uint32_t) * (atomTableMask + 1));
+    for (uint32_t id = 1; id < atom_count; id++) {
+        uint32_t slot = atoms[id].hash & atomTableMask;
+        while (atomTable[slot]) slot = (slot + 1) & atomTableMask;
+        atomTable[slot] = id;
     }
 }
 
-// Blok kontrolleri ve identifier olarak işaretleme
-void keywordType(char *type, int lineNumber) {
-    if (strcmp(type, "number") == 0) { 
-        addToken(TOKEN_KEYWORD, type, lineNumber);
+static void growAtomTable() {
+    uint32_t size = atomTableMask ? (atomTableMask + 1) * 2 : 1024;
+    free(atomTable);
+    atomTable = (uint32_t*)malloc(sizeof(uint32_t) * size);
+    atomTableMask = size - 1;
+    fillAtomTable();
+}
 
-        char* next = strtok(NULL, " \t\n");
-        if (next && isalpha(next[0])) {
-            addToken(TOKEN_IDENTIFIER, next, lineNumber);  // Fixed: Use 'next' instead of 'type'
-            addVariable(next);
-        } else {
-            printf("Error on line %d: Invalid variable declaration after 'number'\n", lineNumber);
-            exit(1);
-        }
-        return;
-    }
+// internAtom() for a text whose hash is known. A new atom keeps text itself
+// unless copy is set.
+static uint32_t internHashed(const char* text, int length, uint32_t hash, int copy) {
+    if ((atom_count + 1) * 2 > atomTableMask) growAtomTable();
 
-    for (int i = 1; i < 6; i++) {
-        if (strcmp(type, keywords[i]) == 0) {
-            addToken(TOKEN_KEYWORD, type, lineNumber);
-            return;
+    uint32_t slot = hash & atomTableMask;
+    while (atomTable[slot]) {
+        Atom* atom = &atoms[atomTable[slot]];
+        if (atom->hash == hash && atom->length == (uint32_t)length &&
+            memcmp(atom->text, text, (size_t)length) == 0) {
+            return atomTable[slot];
         }
+        slot = (slot + 1) & atomTableMask;
     }
 
-    if(type[0]=='{'){ 
-        addToken(TOKEN_OPEN_BLOCK, "{", lineNumber);
-        blockLines[blockLineIndex++] = lineNumber;
-        blockCount++;
-    } else if(type[0]=='}'){
-        if (blockCount == 0) {
-            printf("Error on line %d: Closing block without opening block!\n", lineNumber);
-            exit(1);
-        } else {
-            blockCount--;
-            blockLineIndex--;
-            addToken(TOKEN_CLOSE_BLOCK, "}", lineNumber);
-        }
-    } else {
-        if (!isDeclared(type)) {
-            printf("Error on line %d: Undefine variable '%s'\n", lineNumber, type);
-            exit(1);
-        } else
-        // Lexer aşamasında sadece identifier olarak işaretle
-        // Semantic kontrolü parser aşamasında yap
-        addToken(TOKEN_IDENTIFIER, type, lineNumber);
+    if (atom_count == ATOM_LIMIT) fatal("Error: More than %u distinct names and literals\n", ATOM_LIMIT - 1);
+    if (atom_count == atom_capacity) {
+        atom_capacity = atom_capacity ? atom_capacity * 2 : 1024;
+        atoms = (Atom*)realloc(atoms, sizeof(Atom) * atom_capacity);
     }
+    atoms[atom_count].text = copy ? poolCopy(text, length) : text;
+    atoms[atom_count].length = (uint32_t)length;
+    atoms[atom_count].hash = hash;
+    atomTable[slot] = atom_count;
+    return atom_count++;
 }
 
-// Parser helper functions
-Token getCurrentToken() {
-    if (current_token_index < token_count) {
-        return tokens[current_token_index];
-    }
-    Token eof_token = {TOKEN_EOF, "", -1};
-    return eof_token;
+// Returns the id of the atom with this text, adding it on first sight
+static uint32_t internAtom(const char* text, int length) {
+    if (length == 0) return ATOM_EMPTY;
+    return internHashed(text, length, hashText(text, length), 1);
 }
 
-Token peekNextToken() {
-    if (current_token_index + 1 < token_count) {
-        return tokens[current_token_index + 1];
-    }
-    Token eof_token = {TOKEN_EOF, "", -1};
-    return eof_token;
+static inline const char* atomText(uint32_t atom) {
+    return atoms[atom].text;
 }
 
-void consumeToken() {
-    if (current_token_index < token_count) {
-        current_token_index++;
-    }
+static inline uint32_t atomLength(uint32_t atom) {
+    return atoms[atom].length;
 }
 
-// Parse tree functions
-TreeNode* createNode(NodeType type, char* value, int line) {
-    TreeNode* node = (TreeNode*)malloc(sizeof(TreeNode));
-    node->type = type;
-    node->value = value ? strdup(value) : NULL;
-    node->child_count = 0;
-    node->line_number = line;
-    
-    for(int i = 0; i < 10; i++) {
-        node->children[i] = NULL;
+// Interns the keywords and punctuation so their ids match the ATOM_ enum
+static void initAtoms() {
+    const char* fixed[] = {":=", "-=", "+=", ";", "{", "}"};
+    atom_count = 1;
+    if (!atom_capacity) {
+        atom_capacity = 1024;
+        atoms = (Atom*)malloc(sizeof(Atom) * atom_capacity);
     }
-    
-    return node;
+    atoms[ATOM_EMPTY].text = "";
+    atoms[ATOM_EMPTY].length = 0;
+    atoms[ATOM_EMPTY].hash = 0;
+    if (atomTable) memset(atomTable, 0, sizeof(uint32_t) * (atomTableMask + 1));
+    for (int i = 0; i < 6; i++) internAtom(keywords[i], keywordLengths[i]);
+    for (int i = 0; i < 6; i++) internAtom(fixed[i], (int)strlen(fixed[i]));
 }
 
-void addChild(TreeNode* parent, TreeNode* child) {
-    if(parent->child_count < 10) {
-        parent->children[parent->child_count] = child;
-        parent->child_count++;
+// Symbol table fonksiyonları
+static Symbol* findSymbolEntry(uint32_t atom) {
+    uint32_t index = (atom * 2654435761u) & symbolMask;
+    while (symbols[index].atom && symbols[index].atom != atom) {
+        index = (index + 1) & symbolMask;
     }
+    return &symbols[index];
 }
 
-char* nodeTypeToString(NodeType type) {
-    switch(type) {
-        case NODE_PROGRAM: return "PROGRAM";
-        case NODE_DECLARATION: return "DECLARATION";
-        case NODE_ASSIGNMENT: return "ASSIGNMENT";
-        case NODE_INCREMENT: return "INCREMENT";
-        case NODE_DECREMENT: return "DECREMENT";
-        case NODE_WRITE: return "WRITE";
-        case NODE_LOOP: return "LOOP";
-        case NODE_BLOCK: return "BLOCK";
-        case NODE_VARIABLE: return "VARIABLE";
-        case NODE_NUMBER: return "NUMBER";
-        case NODE_STRING: return "STRING";
-        case NODE_NEWLINE: return "NEWLINE";
-        default: return "UNKNOWN";
-    }
+// Returns the slot of a variable, -1 if it was never declared
+static int lookupSymbol(uint32_t atom) {
+    if (!symbols) return -1;
+    Symbol* entry = findSymbolEntry(atom);
+    return entry->atom ? entry->slot : -1;
 }
 
-void printParseTree(TreeNode* node, int depth) {
-    if(!node) return;
-    
-    for(int i = 0; i < depth; i++) {
-        printf("  ");
-    }
-    
-    printf("%s", nodeTypeToString(node->type));
-    if(node->value) {
-        printf("(%s)", node->value);
+// Returns the slot of a variable, giving it the next free slot on first use
+static int declareSymbol(uint32_t atom) {
+    if ((uint32_t)(symbol_count + 1) * 2 > symbolMask) {
+        Symbol* old = symbols;
+        uint32_t oldSize = symbols ? symbolMask + 1 : 0;
+        uint32_t size = oldSize ? oldSize * 2 : 256;
+        symbols = (Symbol*)calloc(size, sizeof(Symbol));
+        symbolMask = size - 1;
+        for (uint32_t i = 0; i < oldSize; i++) {
+            if (old[i].atom) *findSymbolEntry(old[i].atom) = old[i];
+        }
+        free(old);
     }
-    printf("\n");
-    
-    for(int i = 0; i < node->child_count; i++) {
-        printParseTree(node->children[i], depth + 1);
+    Symbol* entry = findSymbolEntry(atom);
+    if (!entry->atom) {
+        entry->atom = atom;
+        entry->slot = symbol_count++;
     }
+    return entry->slot;
 }
 
-// Parser functions
-TreeNode* parseProgram() {
-    TreeNode* program = createNode(NODE_PROGRAM, NULL, 1);
-    
-    while (getCurrentToken().type != TOKEN_EOF) {
-        TreeNode* statement = parseStatement();
-        if (statement) {
-            addChild(program, statement);
-        }
-    }
-    
-    return program;
+static void resetSymbols() {
+    free(symbols);
+    symbols = NULL;
+    symbolMask = 0;
+    symbol_count = 0;
 }
 
-TreeNode* parseStatement() {
-    Token current = getCurrentToken();
-    
-    if (current.type == TOKEN_KEYWORD) {
-        if (strcmp(current.value, "number") == 0) {
-            return parseDeclaration();
-        } else if (strcmp(current.value, "write") == 0) {
-            return parseWrite();
-        } else if (strcmp(current.value, "repeat") == 0) {
-            return parseLoop();
-        }
-    } else if (current.type == TOKEN_IDENTIFIER) {
-        Token next = peekNextToken();
-        if (next.type == TOKEN_OPERATOR) {
-            if (strcmp(next.value, ":=") == 0) {
-                return parseAssignment();
-            }else if (strcmp(next.value, "+=") == 0) {
-                TreeNode* increment = createNode(NODE_INCREMENT, NULL, current.line_number);
-                TreeNode* var = createNode(NODE_VARIABLE, current.value, current.line_number);
-                addChild(increment, var);
-                consumeToken(); // variable
-                consumeToken(); // +=
-
-                Token value_token = getCurrentToken();
-                TreeNode* value;
-                if (value_token.type == TOKEN_NUMBER) {
-                    value = createNode(NODE_NUMBER, value_token.value, value_token.line_number);
-                } else if (value_token.type == TOKEN_IDENTIFIER) {
-                    value = createNode(NODE_VARIABLE, value_token.value, value_token.line_number);
-                } else {
-                    printf("Error on line %d: Expected number or variable after '+='\n", value_token.line_number);
-                    exit(1);
-                }
-                addChild(increment, value);
-                consumeToken(); // value
-                consumeToken(); // ;
-
-                return increment;
-            }else if (strcmp(next.value, "-=") == 0) {
-                TreeNode* decrement = createNode(NODE_DECREMENT, NULL, current.line_number);
-                TreeNode* var = createNode(NODE_VARIABLE, current.value, current.line_number);
-                addChild(decrement, var);
-                consumeToken(); // variable
-                consumeToken(); // -=
-
-                Token value_token = getCurrentToken();
-                TreeNode* value;
-                if (value_token.type == TOKEN_NUMBER) {
-                    value = createNode(NODE_NUMBER, value_token.value, value_token.line_number);
-                } else if (value_token.type == TOKEN_IDENTIFIER) {
-                    value = createNode(NODE_VARIABLE, value_token.value, value_token.line_number);
-                } else {
-                    printf("Error on line %d: Expected number or variable after '-='\n", value_token.line_number);
-                    exit(1);
-                }
-                addChild(decrement, value);
-                consumeToken(); // value
-                consumeToken(); // ;
+// Source buffer of the running lexer, used to turn lexemes into offsets
+static THREAD_LOCAL const char* lexSource = NULL;
 
-                return decrement;
-            }
+// Chunk being lexed by a --lex-threads worker. Declarations and braces
+// depend on everything before them, so a worker only records where they
+// are and lexParallel() handles them in source order.
+struct LexChunk;
+static THREAD_LOCAL struct LexChunk* lex_chunk = NULL;
+static void lexDefer(uint32_t index);
+
+static void addToken(TokenType type, uint32_t atom, const char* lexeme, int length, int line) {
+    if (token_count == token_capacity) {
+        token_capacity = token_capacity ? token_capacity * 2 : 4096;
+        tokens = (Token*)realloc(tokens, sizeof(Token) * token_capacity);
+        if (!tokens) {
+            fatal("Error: Out of memory\n");
         }
     }
-    
-    // Skip unknown tokens
-    consumeToken();
-    return NULL;
+    Token* token = &tokens[token_count++];
+    token->offset = lexSource ? (uint32_t)(lexeme - lexSource) : 0;
+    token->length = lexSource ? (uint32_t)length : 0;
+    token->line_number = line;
+    token->type = type;
+    token->atom = atom;
 }
 
-TreeNode* parseDeclaration() {
-    TreeNode* decl = createNode(NODE_DECLARATION, NULL, getCurrentToken().line_number);
-    
-    consumeToken(); // "number"
-    Token var_token = getCurrentToken();
-    TreeNode* var = createNode(NODE_VARIABLE, var_token.value, var_token.line_number);
-    addChild(decl, var);
-    
-    // REMOVED: Don't add variable again - it's already added in keywordType()
-    // addVariable(var_token.value);
-    
-    consumeToken(); // variable name
-    consumeToken(); // ;
-    
-    return decl;
+static void braceOpen(uint32_t index) {
+    if (brace_count == brace_capacity) {
+        brace_capacity = brace_capacity ? brace_capacity * 2 : 1024;
+        braces = (BracePair*)realloc(braces, sizeof(BracePair) * brace_capacity);
+        if (!braces) fatal("Error: Out of memory\n");
+    }
+    braces[brace_count].open = index;
+    braces[brace_count].close = NO_BRACE;
+    braces[brace_count].outer = brace_open;
+    brace_open = brace_count++;
 }
 
-TreeNode* parseAssignment() {
-    TreeNode* assign = createNode(NODE_ASSIGNMENT, NULL, getCurrentToken().line_number);
-    
-    Token var_token = getCurrentToken();
-    TreeNode* var = createNode(NODE_VARIABLE, var_token.value, var_token.line_number);
-    addChild(assign, var);
-    
-    consumeToken(); // variable
-    consumeToken(); // :=
-    
-    Token value_token = getCurrentToken();
-    TreeNode* value;
-    if (value_token.type == TOKEN_NUMBER) {
-        value = createNode(NODE_NUMBER, value_token.value, value_token.line_number);
-    } else {
-        value = createNode(NODE_VARIABLE, value_token.value, value_token.line_number);
-    }
-    addChild(assign, value);
-    
-    consumeToken(); // value
-    consumeToken(); // ;
-    
-    return assign;
+static void braceClose(uint32_t index) {
+    braces[brace_open].close = index;
+    brace_open = braces[brace_open].outer;
 }
 
-TreeNode* parseWrite() {
-    TreeNode* write_node = createNode(NODE_WRITE, NULL, getCurrentToken().line_number);
-    
-    consumeToken(); // "write"
-    
-    while (getCurrentToken().type != TOKEN_SEMICOLON && getCurrentToken().type != TOKEN_EOF) {
-        Token current = getCurrentToken();
-        
-        if (current.type == TOKEN_STRING) {
-            TreeNode* str = createNode(NODE_STRING, current.value, current.line_number);
-            addChild(write_node, str);
-        } else if (current.type == TOKEN_IDENTIFIER) {
-            TreeNode* var = createNode(NODE_VARIABLE, current.value, current.line_number);
-            addChild(write_node, var);
-        } else if (current.type == TOKEN_KEYWORD && strcmp(current.value, "newline") == 0) {
-            TreeNode* newline = createNode(NODE_NEWLINE, NULL, current.line_number);
-            addChild(write_node, newline);
-        }
-        
-        consumeToken();
-        
-        // Skip "and" keyword
-        if (getCurrentToken().type == TOKEN_KEYWORD && strcmp(getCurrentToken().value, "and") == 0) {
-            consumeToken();
-        }
-    }
-    
-    consumeToken(); // ;
-    return write_node;
+static void openBlock(const char* value, int lineNumber) {
+    braceOpen((uint32_t)token_count);
+    addToken(TOKEN_OPEN_BLOCK, ATOM_OPEN_BLOCK, value, 1, lineNumber);
+    if (blockCount++ == 0) blockLine = lineNumber;
 }
 
-TreeNode* parseLoop() {
-    TreeNode* loop = createNode(NODE_LOOP, NULL, getCurrentToken().line_number);
-    
-    consumeToken(); // "repeat"
-    
-    Token count_token = getCurrentToken();
-    TreeNode* count;
-    
-    // Count hem sabit sayı hem de değişken olabilir
-    if (count_token.type == TOKEN_NUMBER) {
-        count = createNode(NODE_NUMBER, count_token.value, count_token.line_number);
-    } else if (count_token.type == TOKEN_IDENTIFIER) {
-        count = createNode(NODE_VARIABLE, count_token.value, count_token.line_number);
-    } else {
-        printf("Error on line %d: Expected number or variable after 'repeat'\n", count_token.line_number);
-        exit(1);
+static void closeBlock(const char* value, int lineNumber) {
+    if (blockCount == 0) {
+        fatal("Error on line %d: Closing block without opening block!\n", lineNumber);
     }
-    
-    addChild(loop, count);
-    
-    consumeToken(); // count
-    consumeToken(); // "times"
-    
-    if (getCurrentToken().type == TOKEN_OPEN_BLOCK) {
-        consumeToken(); // {
-        TreeNode* block = createNode(NODE_BLOCK, NULL, getCurrentToken().line_number);
-        
-        while (getCurrentToken().type != TOKEN_CLOSE_BLOCK && getCurrentToken().type != TOKEN_EOF) {
-            TreeNode* statement = parseStatement();
-            if (statement) {
-                addChild(block, statement);
-            }
+    blockCount--;
+    braceClose((uint32_t)token_count);
+    addToken(TOKEN_CLOSE_BLOCK, ATOM_CLOSE_BLOCK, value, 1, lineNumber);
+}
+
+// Classifies a word that is neither a separator nor a number:
+// keyword, block brace or declared identifier. "number" is handled by callers.
+static void classifyWord(const char* word, int length, int lineNumber) {
+    for (int i = 1; i < 6; i++) {
+        if (length == keywordLengths[i] && word[0] == keywords[i][0] &&
+            memcmp(word, keywords[i], (size_t)length) == 0) {
+            addToken(TOKEN_KEYWORD, ATOM_NUMBER + i, word, length, lineNumber);
+            return;
         }
-        
-        consumeToken(); // }
-        addChild(loop, block);
+    }
+
+    if (lex_chunk && (word[0] == '{' || word[0] == '}')) {
+        lexDefer((uint32_t)token_count);
+        addToken(word[0] == '{' ? TOKEN_OPEN_BLOCK : TOKEN_CLOSE_BLOCK,
+                 word[0] == '{' ? ATOM_OPEN_BLOCK : ATOM_CLOSE_BLOCK, word, 1, lineNumber);
+    } else if (word[0] == '{') {
+        openBlock(word, lineNumber);
+    } else if (word[0] == '}') {
+        closeBlock(word, lineNumber);
     } else {
-        TreeNode* statement = parseStatement();
-        if (statement) {
-            addChild(loop, statement);
+        uint32_t atom = internAtom(word, length);
+        if (!lex_chunk && lookupSymbol(atom) < 0) {
+            fatal("Error on line %d: Undefine variable '%.*s'\n", lineNumber, length, word);
         }
+        // Lexer aşamasında sadece identifier olarak işaretle
+        // Slot ataması resolveSymbols() içinde yapılır
+        addToken(TOKEN_IDENTIFIER, atom, word, length, lineNumber);
     }
-    
-    return loop;
 }
 
-// Simple interpreter functions
-Variable* findVariable(const char* name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(variables[i].name, name) == 0) {
-            return &variables[i];
+#ifndef PPP_LIBRARY
+// Blok kontrolleri ve identifier olarak işaretleme (legacy strtok lexer)
+static void keywordType(char *type, int lineNumber) {
+    if (strcmp(type, "number") == 0) { 
+        addToken(TOKEN_KEYWORD, ATOM_NUMBER, type, 6, lineNumber);
+
+        char* next = strtok(NULL, " \t\n");
+        if (next && isalpha((unsigned char)next[0])) {
+            int length = (int)strlen(next);
+            uint32_t atom = internAtom(next, length);
+            addToken(TOKEN_IDENTIFIER, atom, next, length, lineNumber);
+            declareSymbol(atom);
+        } else {
+            fatal("Error on line %d: Invalid variable declaration after 'number'\n", lineNumber);
         }
+        return;
     }
-    return NULL;
-}
 
-Variable* createVariable(const char* name) {
-    if (var_count < MAX_VARS) {
-        strcpy(variables[var_count].name, name);
-        variables[var_count].value = 0;
-        return &variables[var_count++];
-    }
-    return NULL;
+    classifyWord(type, (int)strlen(type), lineNumber);
 }
 
-long long getValue(TreeNode* node) {
-    if (node->type == NODE_NUMBER) {
-        return atoll(node->value);
-    } else if (node->type == NODE_VARIABLE) {
-        Variable* var = findVariable(node->value);
-        return var ? var->value : 0;
-    }
-    return 0;
-}
+// Original line-based lexer: fgets + replaceSeperator + strtok. Kept as the
+// reference implementation for --lexer=legacy and --bench-lex.
+static void lexFileLegacy(FILE* dosya) {
+    int lineControl = 0;
+    char line[1024];
 
-void executeStatement(TreeNode* node) {
-    if (!node) return;
-    
-    switch (node->type) {
-        case NODE_DECLARATION: {
-            if (node->child_count > 0) {
-                createVariable(node->children[0]->value);
-            }
-            break;
-        }
-        case NODE_ASSIGNMENT: {
-            if (node->child_count >= 2) {
-                Variable* var = findVariable(node->children[0]->value);
-                if (!var) var = createVariable(node->children[0]->value);
-                if (var) {
-                    var->value = getValue(node->children[1]);
-                }
-            }
-            break;
+    lexSource = NULL;
+    int skipMode = 0;
+    int strSkip = 0;
+
+    // Satır satır okuma
+    while (fgets(line, sizeof(line), dosya)) {
+        lineControl++;
+        replaceSeperator(line);
+
+        if (skipMode) {
+            fatal("Error on line %d: Comment block is not closed!\n", lineControl-1);
         }
-        case NODE_INCREMENT: {
-            if (node->child_count >= 2) {
-                Variable* var = findVariable(node->children[0]->value);
-                if (var) {
-                    var->value += getValue(node->children[1]);
-                }
-            }
-            break;
+        if (strSkip) {
+            fatal("Error on line %d: String block is not closed!\n", lineControl-1);
         }
-        case NODE_DECREMENT: {
-            if (node->child_count >= 2) {
-                Variable* var = findVariable(node->children[0]->value);
-                if (var) {
-                    var->value -= getValue(node->children[1]);
-                }
-            }
-            break;
-        }
-        case NODE_WRITE: {
-            for (int i = 0; i < node->child_count; i++) {
-                TreeNode* child = node->children[i];
-                if (child->type == NODE_STRING) {
-                    printf("%s", child->value);
-                } else if (child->type == NODE_VARIABLE) {
-                    Variable* var = findVariable(child->value);
-                    printf("%lld", var ? var->value : 0);
-                } else if (child->type == NODE_NEWLINE) {
-                    printf("\n");
-                }
-            }
-            break;
-        }
-        case NODE_LOOP: {
-            if (node->child_count >= 1) {
-                int count = (int)getValue(node->children[0]);
-                for (int i = 0; i < count; i++) {
-                    if (node->child_count > 1) {
-                        executeStatement(node->children[1]);
-                    }
-                }
-            }
-            break;
-        }
-        case NODE_BLOCK: {
-            for (int i = 0; i < node->child_count; i++) {
-                executeStatement(node->children[i]);
-            }
-            break;
-        }
-        // Eksik olan durumlar için default case veya explicit cases
-        case NODE_PROGRAM:
-        case NODE_VARIABLE:
-        case NODE_NUMBER:
-        case NODE_STRING:
-        case NODE_NEWLINE:
-        default:
-            // Bu node türleri executeStatement'te doğrudan işlenmez
-            // Bunlar diğer node'ların çocukları olarak işlenir
-            break;
-    }
-}
-
-void executeProgram(TreeNode* program) {
-    for (int i = 0; i < program->child_count; i++) {
-        executeStatement(program->children[i]);
-    }
-}
-
-int main(int argc, char *argv[]) {
-    int lineControl = 0;
-    
-    if (argc < 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
-        return 1;
-    }
-
-    // Dosya açma ve hata kontrolü
-    char inputFilename[256];
-    snprintf(inputFilename, sizeof(inputFilename), "%s.ppp", argv[1]);
-    FILE *dosya = fopen(inputFilename, "r");
-    if (!dosya) {
-        printf("File cannot be opened: %s\n", inputFilename);
-        return 1;
-    }
-
-    char line[1024];
-    int skipMode = 0;
-    int strSkip = 0;
-    
-    // Satır satır okuma
-    while (fgets(line, sizeof(line), dosya)) {
-        lineControl++;
-        replaceSeperator(line);
-        
-        if (skipMode) {
-            printf("Error on line %d: Comment block is not closed!\n", lineControl-1);
-            exit(1);
-        }
-        if (strSkip) {
-            printf("Error on line %d: String block is not closed!\n", lineControl-1);
-            exit(1);
-        }
-        // Tokenization işlemleri
-        char *token = strtok(line, " \t\n");
-        while (token != NULL) {
-            if (strcmp(token, "*") == 0) {
-                skipMode = !skipMode;
+        // Tokenization işlemleri
+        char *token = strtok(line, " \t\n");
+        while (token != NULL) {
+            if (strcmp(token, "*") == 0) {
+                skipMode = !skipMode;
             }
             else if (!skipMode) {
                 if (strcmp(token, "\"") == 0) {
@@ -632,30 +784,31 @@ int main(int argc, char *argv[]) {
                         strcat(strConst, token);
                         token = strtok(NULL, " \t\n");
                     }
-                
+
                     if (token != NULL && strcmp(token, "\"") == 0) {
-                        addToken(TOKEN_STRING, strConst, lineControl);
+                        int length = (int)strlen(strConst);
+                        addToken(TOKEN_STRING, internAtom(strConst, length), strConst, length, lineControl);
                         token = strtok(NULL, " \t\n");
                         continue;
                     } else {
-                        printf("Error on line %d: String literal not closed with '\"'\n", lineControl);
-                        exit(1);
+                        fatal("Error on line %d: String literal not closed with '\"'\n", lineControl);
                     }
-                }else if (strcmp(token, ";") == 0) { 
-                    addToken(TOKEN_SEMICOLON, ";", lineControl);
+                }else if (strcmp(token, ";") == 0) {
+                    addToken(TOKEN_SEMICOLON, ATOM_SEMICOLON, token, 1, lineControl);
                 }
                 else {
                     int isOperator = 0;
                     for (int i = 0; i < sep_count; i++) {
-                        if (strcmp(token, separators[i]) == 0 && strcmp(token, "*") != 0 && strcmp(token, "\"") != 0) { 
-                            addToken(TOKEN_OPERATOR, token, lineControl);
+                        if (strcmp(token, separators[i]) == 0 && strcmp(token, "*") != 0 && strcmp(token, "\"") != 0) {
+                            addToken(TOKEN_OPERATOR, ATOM_ASSIGN + i, token, 2, lineControl);
                             isOperator = 1;
                             break;
                         }
                     }
                     if (!isOperator) {
                         if (isNumber(token)) {
-                            addToken(TOKEN_NUMBER, token, lineControl);
+                            int length = (int)strlen(token);
+                            addToken(TOKEN_NUMBER, internAtom(token, length), token, length, lineControl);
                         } else {
                             keywordType(token, lineControl);
                         }
@@ -665,24 +818,8861 @@ int main(int argc, char *argv[]) {
             token = strtok(NULL, " \t\n");
         }
     }
+}
+#endif
 
-    fclose(dosya);
+// Single-pass lexer over an in-memory source buffer.
+//
+// Produces the same token stream as lexFileLegacy(): a lexeme is a run of
+// bytes delimited by blanks (' ', '\t'), newlines and the separators
+// ":=", "-=", "+=", ";", "*" and '"'. Tokens point into the buffer; only
+// string literals whose spacing has to be collapsed are rebuilt in the pool.
+// A "\r\n" pair is treated as a newline, as the text-mode stdio on Windows
+// did for the legacy lexer.
 
-    if(blockCount > 0){
-        for (int i = 0; i < blockLineIndex; i++) {
-            printf("Error: Unclosed block opened on line %d\n", blockLines[i]);
-            exit(1);
+// Character classes used by the scalar scanner
+enum {
+    CH_WORD = 0,
+    CH_BLANK,      // ' ', '\t'
+    CH_NEWLINE,    // '\n'
+    CH_SEPARATOR,  // ';', '*', '"'
+    CH_EQUALS      // '=', ends a word only when it completes ":=", "-=" or "+="
+};
+
+static const unsigned char charClass[256] = {
+    [' '] = CH_BLANK,
+    ['\t'] = CH_BLANK,
+    ['\n'] = CH_NEWLINE,
+    [';'] = CH_SEPARATOR,
+    ['*'] = CH_SEPARATOR,
+    ['"'] = CH_SEPARATOR,
+    ['='] = CH_EQUALS,
+};
+
+static int isOperatorStart(char c) {
+    return c == ':' || c == '-' || c == '+';
+}
+
+// Returns the first byte in [p, end) that is not a blank
+static const char* skipBlanks(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+        if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+        p += 16;
+    }
+#endif
+    while (p < end && charClass[(unsigned char)*p] == CH_BLANK) p++;
+    return p;
+}
+
+// Returns the first byte in [p, end) equal to a or b, or end
+static const char* findEither(const char* p, const char* end, char a, char b) {
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != a && *p != b) p++;
+    return p;
+}
+
+// Returns the first byte in [p, end) that is not CH_WORD
+static const char* findDelimiter(const char* p, const char* end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i semicolon = _mm_set1_epi8(';');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i equals = _mm_set1_epi8('=');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, newline));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, semicolon));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, star));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, equals));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && charClass[(unsigned char)*p] == CH_WORD) p++;
+    return p;
+}
+
+// Scans a word starting at p. Stops before a blank, newline, separator or an
+// operator ("x:=" yields "x"). A lone '=' stays part of the word.
+static const char* scanWord(const char* p, const char* end) {
+    const char* start = p;
+    for (;;) {
+        p = findDelimiter(p, end);
+        if (p == end || *p != '=') break;
+        if (p > start && isOperatorStart(p[-1])) return p - 1;
+        p++;
+    }
+    // "\r\n" ends a line; the '\r' is not part of the word
+    if (p < end && *p == '\n' && p > start && p[-1] == '\r') p--;
+    return p;
+}
+
+// Builds the legacy value of a string literal: its lexemes joined by single
+// spaces. Points into the source when the literal is already in that form.
+static void addStringToken(const char* s, const char* e, int line) {
+    int clean = 1;
+    for (const char* q = s; q < e; q++) {
+        char c = *q;
+        if (c == ' ') {
+            if (q == s || q + 1 == e || q[1] == ' ') { clean = 0; break; }
+        } else if (c == '\t' || c == ';' || c == '*' || c == '\r') {
+            clean = 0;
+            break;
+        } else if (c == '=' && q > s && isOperatorStart(q[-1])) {
+            clean = 0;
+            break;
+        }
+    }
+    if (clean) {
+        addToken(TOKEN_STRING, internAtom(s, (int)(e - s)), s, (int)(e - s), line);
+        return;
+    }
+
+    // Every separator adds at most two spaces
+    static THREAD_LOCAL char* out = NULL;
+    static THREAD_LOCAL size_t outSize = 0;
+    if ((size_t)(e - s) * 3 > outSize) {
+        outSize = (size_t)(e - s) * 3;
+        out = (char*)realloc(out, outSize);
+    }
+    int length = 0;
+    const char* p = s;
+    while (p < e) {
+        p = skipBlanks(p, e);
+        if (p == e) break;
+        const char* lexEnd;
+        if (*p == ';' || *p == '*') {
+            lexEnd = p + 1;
+        } else if (p + 1 < e && isOperatorStart(*p) && p[1] == '=') {
+            lexEnd = p + 2;
+        } else {
+            lexEnd = scanWord(p, e);
+            if (lexEnd == p) lexEnd = p + 1; // lone '\r'
         }
+        if (length > 0) out[length++] = ' ';
+        memcpy(out + length, p, (size_t)(lexEnd - p));
+        length += (int)(lexEnd - p);
+        p = lexEnd;
     }
+    addToken(TOKEN_STRING, internAtom(out, length), s, (int)(e - s), line);
+}
 
-    // PARSER PHASE
-    printf("=== PARSE TREE ===\n");
-    TreeNode* parseTree = parseProgram();
-    printParseTree(parseTree, 0);
-    
-    // INTERPRETER PHASE
-    printf("\n=== PROGRAM OUTPUT ===\n");
-    executeProgram(parseTree);
+// Lexes [p, end) of the source starting at src. A chunk ends after a
+// newline; limit is the end of the whole source.
+static void lexRange(const char* src, const char* p, const char* end, const char* limit, int line) {
+    int skipMode = 0;
+
+    if ((size_t)(limit - src) > UINT32_MAX) fatal("Error: Source is larger than 4 GB\n");
+    lexSource = src;
+
+    while (p < end) {
+        char c = *p;
+
+        if (skipMode) {
+            // Inside a comment only '*' and the end of the line matter
+            p = findEither(p, end, '*', '\n');
+            if (p == end) break;
+            if (*p == '*') {
+                skipMode = 0;
+                p++;
+                continue;
+            }
+            c = '\n';
+        }
+
+        if (c == '\n' || (c == '\r' && p + 1 < end && p[1] == '\n')) {
+            p += (c == '\r') ? 2 : 1;
+            // The legacy lexer only noticed an open comment when it read the next line
+            if (p < limit) {
+                if (skipMode) {
+                    fatal("Error on line %d: Comment block is not closed!\n", line);
+                }
+                line++;
+            }
+            continue;
+        }
+
+        switch (charClass[(unsigned char)c]) {
+            case CH_BLANK:
+                p = skipBlanks(p, end);
+                continue;
+            case CH_SEPARATOR:
+                if (c == '*') {
+                    skipMode = 1;
+                    p++;
+                } else if (c == ';') {
+                    addToken(TOKEN_SEMICOLON, ATOM_SEMICOLON, p, 1, line);
+                    p++;
+                } else {
+                    const char* close = findEither(p + 1, end, '"', '\n');
+                    if (close == end || *close != '"') {
+                        fatal("Error on line %d: String literal not closed with '\"'\n", line);
+                    }
+                    addStringToken(p + 1, close, line);
+                    p = close + 1;
+                }
+                continue;
+            default:
+                break;
+        }
+
+        if (p + 1 < end && isOperatorStart(c) && p[1] == '=') {
+            addToken(TOKEN_OPERATOR, c == ':' ? ATOM_ASSIGN : c == '+' ? ATOM_PLUS_ASSIGN : ATOM_MINUS_ASSIGN,
+                     p, 2, line);
+            p += 2;
+            continue;
+        }
+
+        const char* wordEnd = scanWord(p, end);
+        if (wordEnd == p) wordEnd = p + 1; // lone '\r'
+        int length = (int)(wordEnd - p);
+
+        if (isNumberN(p, length)) {
+            addToken(TOKEN_NUMBER, internAtom(p, length), p, length, line);
+        } else if (length == 6 && memcmp(p, "number", 6) == 0) {
+            addToken(TOKEN_KEYWORD, ATOM_NUMBER, p, length, line);
+
+            // The declared name is the next lexeme on the same line
+            const char* next = skipBlanks(wordEnd, end);
+            const char* nextEnd = next < end ? scanWord(next, end) : next;
+            if (nextEnd > next && isalpha((unsigned char)*next)) {
+                uint32_t atom = internAtom(next, (int)(nextEnd - next));
+                if (lex_chunk) lexDefer((uint32_t)token_count);
+                else declareSymbol(atom);
+                addToken(TOKEN_IDENTIFIER, atom, next, (int)(nextEnd - next), line);
+                wordEnd = nextEnd;
+            } else {
+                fatal("Error on line %d: Invalid variable declaration after 'number'\n", line);
+            }
+        } else {
+            classifyWord(p, length, line);
+        }
+        p = wordEnd;
+    }
+}
+
+// Parallel lexing (--lex-threads)
+//
+// Comments and strings end on the line they start, so a large source is cut
+// into chunks at newlines and each chunk is lexed on its own thread, into
+// its own tokens and atom table. The rest is done in three steps:
+//  - sequentially, the chunks' atoms are interned in chunk order, which
+//    hands out the same ids as lexing the whole source on one thread,
+//  - sequentially, the declarations and braces the workers deferred are
+//    replayed in source order: symbols, open blocks and stray '}' errors,
+//  - in parallel, every chunk copies its tokens into place with the global
+//    atom ids and checks its identifiers against the declaration positions.
+// The first error in source order is reported, as the sequential lexer would.
+static int lexThreads = 1;   // process wide, set by main()
+
+#define LEX_CHUNK_MIN ((size_t)1 << 22)   // smaller sources are lexed on one thread
+#define LEX_NONE UINT32_MAX
+
+typedef struct LexChunk {
+    const char* src;
+    const char* begin;
+    const char* end;
+    const char* limit;
+    int line;
+    size_t newlines;
+    // Filled in by the worker, in its own ids
+    Token* tokens;
+    size_t token_count;
+    Atom* atoms;
+    uint32_t atom_count;
+    uint32_t* atomTable;
+    PoolChunk* pool;
+    uint32_t* deferred;   // token indices of declared names and braces
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+    int failed;
+    char error[256];
+    // Fix-up
+    uint32_t* map;                // worker atom id -> global atom id
+    size_t offset;                // of the chunk's first token in tokens
+    Token* out;                   // tokens + offset, tokens being thread-local
+    const uint32_t* declaredAt;   // global atom -> token index of its first declaration
+    size_t undefined;             // first undeclared identifier, or SIZE_MAX
+} LexChunk;
+
+static void lexDefer(uint32_t index) {
+    LexChunk* chunk = lex_chunk;
+    if (chunk->deferred_count == chunk->deferred_capacity) {
+        chunk->deferred_capacity = chunk->deferred_capacity ? chunk->deferred_capacity * 2 : 1024;
+        chunk->deferred = (uint32_t*)realloc(chunk->deferred, sizeof(uint32_t) * chunk->deferred_capacity);
+        if (!chunk->deferred) fatal("Error: Out of memory\n");
+    }
+    chunk->deferred[chunk->deferred_count++] = index;
+}
+
+#ifndef _WIN32
+typedef struct {
+    void* (*body)(void*);
+    void* item;
+    unsigned long long allocs;
+    unsigned long long alloc_bytes;
+} WorkerThread;
+
+static void* workerThread(void* argument) {
+    WorkerThread* worker = (WorkerThread*)argument;
+    worker->body(worker->item);
+    worker->allocs = alloc_count;
+    worker->alloc_bytes = alloc_bytes;
+    return NULL;
+}
+
+// Runs body on every item in a thread of its own
+static void runThreads(void* (*body)(void*), void* items, size_t itemSize, int count) {
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)count);
+    WorkerThread* workers = (WorkerThread*)calloc((size_t)count, sizeof(WorkerThread));
+    if (!threads || !workers) fatal("Error: Out of memory\n");
+    for (int i = 0; i < count; i++) {
+        workers[i].body = body;
+        workers[i].item = (char*)items + itemSize * (size_t)i;
+        if (pthread_create(&threads[i], NULL, workerThread, &workers[i]) != 0) {
+            fatal("Error: Cannot start worker threads\n");
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        alloc_count += workers[i].allocs;
+        alloc_bytes += workers[i].alloc_bytes;
+    }
+    free(workers);
+    free(threads);
+}
+
+static void* lexCountLines(void* argument) {
+    LexChunk* chunk = (LexChunk*)argument;
+    size_t newlines = 0;
+    const char* p = chunk->begin;
+    while ((p = (const char*)memchr(p, '\n', (size_t)(chunk->end - p))) != NULL) {
+        newlines++;
+        p++;
+    }
+    chunk->newlines = newlines;
+    return NULL;
+}
+
+static void* lexChunkTokens(void* argument) {
+    LexChunk* chunk = (LexChunk*)argument;
+    ErrorTrap trap;
+    error_trap = &trap;
+    lex_chunk = chunk;
+    initAtoms();
+    if (setjmp(trap.jump) == 0) {
+        lexRange(chunk->src, chunk->begin, chunk->end, chunk->limit, chunk->line);
+    } else {
+        chunk->failed = 1;
+        memcpy(chunk->error, trap.message, sizeof(chunk->error));
+    }
+    error_trap = NULL;
+    lex_chunk = NULL;
+    // Hand this thread's lexer state over to the chunk
+    chunk->tokens = tokens;
+    chunk->token_count = token_count;
+    chunk->atoms = atoms;
+    chunk->atom_count = atom_count;
+    chunk->atomTable = atomTable;
+    chunk->pool = stringPool;
+    tokens = NULL;
+    atoms = NULL;
+    atomTable = NULL;
+    stringPool = NULL;
+    return NULL;
+}
+
+static void* lexChunkCopy(void* argument) {
+    LexChunk* chunk = (LexChunk*)argument;
+    Token* out = chunk->out;
+    chunk->undefined = SIZE_MAX;
+    for (size_t i = 0; i < chunk->token_count; i++) {
+        Token token = chunk->tokens[i];
+        token.atom = chunk->map[token.atom];
+        if (token.type == TOKEN_IDENTIFIER && chunk->undefined == SIZE_MAX &&
+            chunk->declaredAt[token.atom] >= chunk->offset + i &&
+            !(i > 0 && chunk->tokens[i - 1].type == TOKEN_KEYWORD && chunk->tokens[i - 1].atom == ATOM_NUMBER)) {
+            chunk->undefined = i;
+        }
+        out[i] = token;
+    }
+    return NULL;
+}
+
+static void lexParallel(const char* src, size_t size, int threads) {
+    LexChunk* chunks = (LexChunk*)calloc((size_t)threads, sizeof(LexChunk));
+    const char* begin = src;
+    for (int k = 0; k < threads; k++) {
+        const char* end = src + size;
+        if (k + 1 < threads && begin < end) {
+            const char* target = src + size / (size_t)threads * (size_t)(k + 1);
+            if (target < begin) target = begin;
+            const char* newline = (const char*)memchr(target, '\n', (size_t)(end - target));
+            if (newline) end = newline + 1;
+        }
+        chunks[k].src = src;
+        chunks[k].begin = begin;
+        chunks[k].end = end;
+        chunks[k].limit = src + size;
+        begin = end;
+    }
+    runThreads(lexCountLines, chunks, sizeof(LexChunk), threads);
+    int line = 1;
+    for (int k = 0; k < threads; k++) {
+        chunks[k].line = line;
+        line += (int)chunks[k].newlines;
+    }
+    runThreads(lexChunkTokens, chunks, sizeof(LexChunk), threads);
+
+    // Atoms, in the order one thread would have met them. Their text stays
+    // in the chunk's pool, which joins this thread's.
+    size_t total = token_count;
+    for (int k = 0; k < threads; k++) {
+        LexChunk* chunk = &chunks[k];
+        chunk->map = (uint32_t*)malloc(sizeof(uint32_t) * chunk->atom_count);
+        for (uint32_t id = 0; id < chunk->atom_count; id++) {
+            const Atom* atom = &chunk->atoms[id];
+            chunk->map[id] = id <= ATOM_CLOSE_BLOCK ? id : internHashed(atom->text, (int)atom->length, atom->hash, 0);
+        }
+        if (chunk->pool) {
+            PoolChunk* last = chunk->pool;
+            while (last->next) last = last->next;
+            last->next = stringPool;
+            stringPool = chunk->pool;
+        }
+        chunk->offset = total;
+        total += chunk->token_count;
+    }
+
+    // Declarations and braces, in source order
+    uint32_t* declaredAt = (uint32_t*)malloc(sizeof(uint32_t) * atom_count);
+    memset(declaredAt, 0xFF, sizeof(uint32_t) * atom_count);
+    int strayChunk = -1;
+    size_t strayIndex = 0;
+    for (int k = 0; k < threads && strayChunk < 0; k++) {
+        LexChunk* chunk = &chunks[k];
+        for (uint32_t d = 0; d < chunk->deferred_count; d++) {
+            const Token* token = &chunk->tokens[chunk->deferred[d]];
+            if (token->type == TOKEN_IDENTIFIER) {
+                uint32_t atom = chunk->map[token->atom];
+                declareSymbol(atom);
+                if (declaredAt[atom] == LEX_NONE) declaredAt[atom] = (uint32_t)(chunk->offset + chunk->deferred[d]);
+            } else if (token->type == TOKEN_OPEN_BLOCK) {
+                if (blockCount++ == 0) blockLine = token->line_number;
+                braceOpen((uint32_t)(chunk->offset + chunk->deferred[d]));
+            } else if (blockCount == 0) {
+                strayChunk = k;
+                strayIndex = chunk->deferred[d];
+                break;
+            } else {
+                blockCount--;
+                braceClose((uint32_t)(chunk->offset + chunk->deferred[d]));
+            }
+        }
+    }
+
+    if (total > token_capacity) {
+        token_capacity = total;
+        tokens = (Token*)realloc(tokens, sizeof(Token) * token_capacity);
+        if (!tokens) fatal("Error: Out of memory\n");
+    }
+    for (int k = 0; k < threads; k++) {
+        chunks[k].out = tokens + chunks[k].offset;
+        chunks[k].declaredAt = declaredAt;
+    }
+    runThreads(lexChunkCopy, chunks, sizeof(LexChunk), threads);
+    token_count = total;
+
+    // The first error in source order wins
+    char error[256] = "";
+    for (int k = 0; k < threads && !error[0]; k++) {
+        LexChunk* chunk = &chunks[k];
+        size_t stray = k == strayChunk ? strayIndex : SIZE_MAX;
+        if (chunk->undefined < stray && chunk->undefined != SIZE_MAX) {
+            const Token* token = &tokens[chunk->offset + chunk->undefined];
+            snprintf(error, sizeof(error), "Error on line %d: Undefine variable '%s'\n",
+                     token->line_number, atomText(token->atom));
+        } else if (stray != SIZE_MAX) {
+            snprintf(error, sizeof(error), "Error on line %d: Closing block without opening block!\n",
+                     chunk->tokens[stray].line_number);
+        } else if (chunk->failed) {
+            memcpy(error, chunk->error, sizeof(error));
+        }
+    }
+    for (int k = 0; k < threads; k++) {
+        free(chunks[k].tokens);
+        free(chunks[k].atoms);
+        free(chunks[k].atomTable);
+        free(chunks[k].deferred);
+        free(chunks[k].map);
+    }
+    free(declaredAt);
+    free(chunks);
+    if (error[0]) fatal("%s", error);
+}
+#endif
+
+static void lexBuffer(const char* src, size_t size) {
+#ifndef _WIN32
+    if (lexThreads > 1 && size >= LEX_CHUNK_MIN) {
+        lexParallel(src, size, lexThreads);
+        return;
+    }
+#endif
+    lexRange(src, src, src + size, src + size, 1);
+}
+
+#ifndef PPP_LIBRARY
+// Dosya yükleme: mmap when available, otherwise read into memory
+static int loadSource(const char* filename, SourceFile* source) {
+    source->data = NULL;
+    source->size = 0;
+    source->mapped = 0;
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    source->size = (size_t)st.st_size;
+    if (source->size > 0) {
+        void* data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, source->size, MADV_SEQUENTIAL);
+            source->data = (const char*)data;
+            source->mapped = 1;
+        }
+    }
+    close(fd);
+    if (source->mapped || source->size == 0) return 1;
+#endif
+    FILE* dosya = fopen(filename, "rb");
+    if (!dosya) return 0;
+    fseek(dosya, 0, SEEK_END);
+    long size = ftell(dosya);
+    fseek(dosya, 0, SEEK_SET);
+    char* data = (char*)malloc(size > 0 ? (size_t)size : 1);
+    source->size = size > 0 ? fread(data, 1, (size_t)size, dosya) : 0;
+    source->data = data;
+    fclose(dosya);
+    return 1;
+}
+
+static void unloadSource(SourceFile* source) {
+#ifndef _WIN32
+    if (source->mapped) {
+        munmap((void*)source->data, source->size);
+        source->data = NULL;
+        return;
+    }
+#endif
+    free((void*)source->data);
+    source->data = NULL;
+}
+#endif
+
+// Parser helper functions
+static const Token eof_token = {0, 0, -1, TOKEN_EOF, ATOM_EMPTY};
+static THREAD_LOCAL int tokens_exhausted = 0;   // the parser looked past the last token
+
+static const Token* getCurrentToken() {
+    if (current_token_index < token_count) {
+        return &tokens[current_token_index];
+    }
+    tokens_exhausted = 1;
+    return &eof_token;
+}
+
+static const Token* peekNextToken() {
+    if (current_token_index + 1 < token_count) {
+        return &tokens[current_token_index + 1];
+    }
+    tokens_exhausted = 1;
+    return &eof_token;
+}
+
+static void consumeToken() {
+    if (current_token_index < token_count) {
+        current_token_index++;
+    } else {
+        tokens_exhausted = 1;
+    }
+}
+
+// Parse tree functions
+static void* growArray(void* array, uint32_t* capacity, uint32_t needed, size_t itemSize) {
+    if (needed <= *capacity) return array;
+    uint32_t newCapacity = *capacity ? *capacity : 1024;
+    while (newCapacity < needed) newCapacity *= 2;
+    array = realloc(array, itemSize * newCapacity);
+    if (!array) {
+        fatal("Error: Out of memory\n");
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+static inline TreeNode* childAt(const TreeNode* node, int i) {
+    return &ast.nodes[ast.children[node->first_child + (uint32_t)i]];
+}
+
+static inline void setChild(TreeNode* node, int i, const TreeNode* child) {
+    ast.children[node->first_child + (uint32_t)i] = (uint32_t)(child - ast.nodes);
+}
+
+static inline LoopInfo* loopInfo(const TreeNode* node) {
+    return &ast.loops[node->loop];
+}
+
+// Variables, numbers and strings show their atom's text
+static inline const char* nodeText(const TreeNode* node) {
+    if (node->type == NODE_VARIABLE || node->type == NODE_NUMBER || node->type == NODE_STRING) {
+        return atomText(node->atom);
+    }
+    return NULL;
+}
+
+// Empties the arena, keeping its memory for the next tree
+static void astReset() {
+    for (uint32_t i = 0; i < ast.loop_count; i++) {
+        free(ast.loops[i].closed);
+    }
+    ast.node_count = 0;
+    ast.child_count = 0;
+    ast.pending_count = 0;
+    ast.loop_count = 0;
+}
+
+// Opens a node: the nodes passed to addChild() until its endNode() become
+// its children
+static uint32_t createNode(NodeType type, uint32_t atom, int line) {
+    ast.nodes = (TreeNode*)growArray(ast.nodes, &ast.node_capacity, ast.node_count + 1, sizeof(TreeNode));
+    uint32_t index = ast.node_count++;
+    TreeNode* node = &ast.nodes[index];
+    node->type = type;
+    node->atom = atom;
+    node->number = 0;
+    node->first_child = ast.pending_count;
+    node->child_count = 0;
+    node->line_number = line;
+    node->loop = 0;
+    if (type == NODE_LOOP) {
+        ast.loops = (LoopInfo*)growArray(ast.loops, &ast.loop_capacity, ast.loop_count + 1, sizeof(LoopInfo));
+        node->loop = ast.loop_count++;
+        ast.loops[node->loop].hits = 0;
+        ast.loops[node->loop].jit = NULL;
+        ast.loops[node->loop].closed = NULL;
+        ast.loops[node->loop].unroll = 0;
+    }
+    return index;
+}
+
+static void addChild(uint32_t child) {
+    ast.pending = (uint32_t*)growArray(ast.pending, &ast.pending_capacity, ast.pending_count + 1, sizeof(uint32_t));
+    ast.pending[ast.pending_count++] = child;
+}
+
+// Closes a node, moving its children into one range of ast.children
+static uint32_t endNode(uint32_t index) {
+    TreeNode* node = &ast.nodes[index];
+    uint32_t mark = node->first_child;
+    uint32_t count = ast.pending_count - mark;
+    ast.children = (uint32_t*)growArray(ast.children, &ast.child_capacity, ast.child_count + count, sizeof(uint32_t));
+    memcpy(ast.children + ast.child_count, ast.pending + mark, sizeof(uint32_t) * count);
+    node->first_child = ast.child_count;
+    node->child_count = (int)count;
+    ast.child_count += count;
+    ast.pending_count = mark;
+    return index;
+}
+
+static uint32_t createLeaf(NodeType type, uint32_t atom, int line) {
+    return endNode(createNode(type, atom, line));
+}
+
+static char* nodeTypeToString(NodeType type) {
+    switch(type) {
+        case NODE_PROGRAM: return "PROGRAM";
+        case NODE_DECLARATION: return "DECLARATION";
+        case NODE_ASSIGNMENT: return "ASSIGNMENT";
+        case NODE_INCREMENT: return "INCREMENT";
+        case NODE_DECREMENT: return "DECREMENT";
+        case NODE_WRITE: return "WRITE";
+        case NODE_LOOP: return "LOOP";
+        case NODE_BLOCK: return "BLOCK";
+        case NODE_VARIABLE: return "VARIABLE";
+        case NODE_NUMBER: return "NUMBER";
+        case NODE_STRING: return "STRING";
+        case NODE_NEWLINE: return "NEWLINE";
+        default: return "UNKNOWN";
+    }
+}
+
+typedef struct {
+    uint32_t node;
+    int depth;
+} PrintFrame;
     
-    return 0;
-}
\ No newline at end of file
+// Pre-order on a heap stack, so any nesting depth works
+static void printParseTree(TreeNode* root, int rootDepth) {
+    if(!root) return;
+    PrintFrame* stack = NULL;
+    uint32_t count = 0, capacity = 0;
+    stack = (PrintFrame*)growArray(stack, &capacity, 1, sizeof(PrintFrame));
+    stack[count++] = (PrintFrame){(uint32_t)(root - ast.nodes), rootDepth};
+    while (count > 0) {
+        PrintFrame frame = stack[--count];
+        TreeNode* node = &ast.nodes[frame.node];
+        for(int i = 0; i < frame.depth; i++) {
+            printf("  ");
+        }
+
+        printf("%s", nodeTypeToString(node->type));
+        const char* text = nodeText(node);
+        if(text) {
+            // Coalesced writes put newlines into string literals
+            printf("(");
+            for (const char* p = text; *p; p++) {
+                if (*p == '\n') printf("\\n");
+                else putchar(*p);
+            }
+            printf(")");
+        }
+        if (node->type == NODE_LOOP && loopInfo(node)->closed) {
+            printf(" [closed form, degree %d]", loopInfo(node)->closed->degree);
+        }
+        printf("\n");
+
+        stack = (PrintFrame*)growArray(stack, &capacity, count + (uint32_t)node->child_count, sizeof(PrintFrame));
+        for(int i = node->child_count - 1; i >= 0; i--) {
+            stack[count++] = (PrintFrame){ast.children[node->first_child + (uint32_t)i], frame.depth + 1};
+        }
+    }
+    free(stack);
+}
+
+// Parser functions
+// They return node indices: ast.nodes may move while the tree grows
+// A statement list ends at the end of input or, in a block, at a '}'
+static int statementsEnd(int inBlock) {
+    const Token* current = getCurrentToken();
+    return current->type == TOKEN_EOF || (inBlock && current->type == TOKEN_CLOSE_BLOCK);
+}
+
+// Parallel parsing (--parse-threads)
+//
+// A long statement list, the program or a large block, is cut into one
+// token range per thread at guessed statement boundaries: just after a ';'
+// or '}' at the list's own brace depth, found through the brace index.
+// Each thread parses its range into its own arena, as if a statement
+// started there. The parser skips tokens it does not expect, so a guess can
+// still be wrong. The ranges are therefore checked in order: a range is
+// kept only if the statements before it ended exactly where it starts, and
+// otherwise that stretch is parsed again on this thread. The kept arenas
+// are appended to this thread's with their indices shifted, which lays the
+// tree out exactly as one sequential parse would.
+static int parseThreads = 1;                 // process wide, set by main()
+static THREAD_LOCAL int parse_worker = 0;    // no nested splitting on worker threads
+
+// A loop parseStatement() is in, with its block if the body is one
+typedef struct {
+    uint32_t loop;
+    uint32_t block;   // NO_NODE for a single statement body
+} ParseFrame;
+
+static THREAD_LOCAL ParseFrame* parse_stack = NULL;
+static THREAD_LOCAL uint32_t parse_depth = 0;
+static THREAD_LOCAL uint32_t parse_capacity = 0;
+
+#define PARSE_SPLIT_MIN 65536   // tokens in a list worth splitting
+
+// Pair whose '{' is token index open, or NO_BRACE
+static uint32_t braceAt(uint32_t open) {
+    uint32_t low = 0, high = brace_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (braces[middle].open < open) low = middle + 1;
+        else high = middle;
+    }
+    return low < brace_count && braces[low].open == open ? low : NO_BRACE;
+}
+
+#ifndef _WIN32
+typedef struct {
+    const Token* tokens;
+    size_t token_count;
+    uint32_t begin;
+    uint32_t end;
+    int inBlock;
+    Ast ast;          // the range's statements are ast.pending
+    uint32_t stop;    // token index the parse stopped at
+    int failed;
+    char error[256];
+    // Where a kept range goes in the final arena
+    int kept;
+    TreeNode* nodes;
+    uint32_t* children;
+    LoopInfo* loops;
+    uint32_t nodeBase;
+    uint32_t childBase;
+    uint32_t loopBase;
+} ParseChunk;
+
+// Innermost pair around token index, or NO_BRACE
+static uint32_t enclosingBrace(uint32_t index) {
+    uint32_t low = 0, high = brace_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (braces[middle].open < index) low = middle + 1;
+        else high = middle;
+    }
+    uint32_t pair = low ? low - 1 : NO_BRACE;
+    while (pair != NO_BRACE && braces[pair].close < index) pair = braces[pair].outer;
+    return pair;
+}
+
+// First likely statement start at or after index, directly inside container
+static uint32_t statementBoundary(uint32_t index, uint32_t container, uint32_t end) {
+    uint32_t pair = enclosingBrace(index);
+    while (pair != NO_BRACE && pair != container && braces[pair].outer != container) pair = braces[pair].outer;
+    if (pair != NO_BRACE && pair != container) index = braces[pair].close + 1;
+    while (index < end && tokens[index - 1].type != TOKEN_SEMICOLON && tokens[index - 1].type != TOKEN_CLOSE_BLOCK) {
+        if (tokens[index].type == TOKEN_OPEN_BLOCK) {
+            pair = braceAt(index);
+            if (pair == NO_BRACE || braces[pair].close == NO_BRACE) return end;
+            index = braces[pair].close + 1;
+        } else {
+            index++;
+        }
+    }
+    return index < end ? index : end;
+}
+
+static void* parseChunk(void* argument) {
+    ParseChunk* chunk = (ParseChunk*)argument;
+    ErrorTrap trap;
+    error_trap = &trap;
+    parse_worker = 1;
+    tokens = (Token*)chunk->tokens;
+    token_count = chunk->token_count;
+    current_token_index = chunk->begin;
+    if (setjmp(trap.jump) == 0) {
+        while (current_token_index < chunk->end && !statementsEnd(chunk->inBlock)) {
+            uint32_t statement = parseStatement();
+            if (statement != NO_NODE) addChild(statement);
+        }
+        chunk->stop = (uint32_t)current_token_index;
+    } else {
+        chunk->failed = 1;
+        memcpy(chunk->error, trap.message, sizeof(chunk->error));
+    }
+    error_trap = NULL;
+    chunk->ast = ast;
+    memset(&ast, 0, sizeof(ast));
+    tokens = NULL;
+    token_count = 0;
+    return NULL;
+}
+
+// Makes room for a range's arena after this thread's; its statements become
+// children of the node being built
+static void astReserve(ParseChunk* chunk) {
+    const Ast* part = &chunk->ast;
+    chunk->kept = 1;
+    chunk->nodeBase = ast.node_count;
+    chunk->childBase = ast.child_count;
+    chunk->loopBase = ast.loop_count;
+    ast.nodes = (TreeNode*)growArray(ast.nodes, &ast.node_capacity, ast.node_count + part->node_count, sizeof(TreeNode));
+    ast.children = (uint32_t*)growArray(ast.children, &ast.child_capacity, ast.child_count + part->child_count, sizeof(uint32_t));
+    ast.loops = (LoopInfo*)growArray(ast.loops, &ast.loop_capacity, ast.loop_count + part->loop_count, sizeof(LoopInfo));
+    ast.node_count += part->node_count;
+    ast.child_count += part->child_count;
+    ast.loop_count += part->loop_count;
+    for (uint32_t i = 0; i < part->pending_count; i++) addChild(part->pending[i] + chunk->nodeBase);
+}
+
+// Copies a kept range into its reserved place with its indices shifted
+static void* parseChunkCopy(void* argument) {
+    ParseChunk* chunk = (ParseChunk*)argument;
+    Ast* part = &chunk->ast;
+    if (chunk->kept) {
+        TreeNode* nodes = chunk->nodes + chunk->nodeBase;
+        for (uint32_t i = 0; i < part->node_count; i++) {
+            nodes[i] = part->nodes[i];
+            nodes[i].first_child += chunk->childBase;
+            if (nodes[i].type == NODE_LOOP) nodes[i].loop += chunk->loopBase;
+        }
+        uint32_t* children = chunk->children + chunk->childBase;
+        for (uint32_t i = 0; i < part->child_count; i++) children[i] = part->children[i] + chunk->nodeBase;
+        if (part->loop_count) memcpy(chunk->loops + chunk->loopBase, part->loops, sizeof(LoopInfo) * part->loop_count);
+    }
+    free(part->nodes);
+    free(part->children);
+    free(part->pending);
+    free(part->loops);
+    return NULL;
+}
+
+// Parses the statements of [begin, end), leaving current_token_index where
+// the sequential parse would be after them
+static void parseParallel(uint32_t begin, uint32_t end, uint32_t container, int inBlock) {
+    int threads = parseThreads;
+    ParseChunk* chunks = (ParseChunk*)calloc((size_t)threads, sizeof(ParseChunk));
+    uint32_t start = begin;
+    for (int k = 0; k < threads; k++) {
+        uint32_t stop = end;
+        if (k + 1 < threads) {
+            stop = statementBoundary(begin + (uint32_t)((uint64_t)(end - begin) * (uint64_t)(k + 1) / (uint64_t)threads), container, end);
+            if (stop < start) stop = start;
+        }
+        chunks[k].tokens = tokens;
+        chunks[k].token_count = token_count;
+        chunks[k].begin = start;
+        chunks[k].end = stop;
+        chunks[k].inBlock = inBlock;
+        start = stop;
+    }
+    runThreads(parseChunk, chunks, sizeof(ParseChunk), threads);
+
+    uint32_t position = begin;
+    char error[256] = "";
+    int done = 0;
+    for (int k = 0; k < threads && !done && !error[0]; k++) {
+        ParseChunk* chunk = &chunks[k];
+        if (position == chunk->begin) {
+            if (chunk->failed) {
+                memcpy(error, chunk->error, sizeof(error));
+                break;
+            }
+            astReserve(chunk);
+            position = chunk->stop;
+            done = position < chunk->end;
+        } else if (position < chunk->end) {
+            // The statements before ran past the guess: redo this range here
+            current_token_index = position;
+            while (current_token_index < chunk->end && !statementsEnd(inBlock)) {
+                uint32_t statement = parseStatement();
+                if (statement != NO_NODE) addChild(statement);
+            }
+            position = (uint32_t)current_token_index;
+            done = position < chunk->end;
+        }
+    }
+    for (int k = 0; k < threads; k++) {
+        chunks[k].nodes = ast.nodes;
+        chunks[k].children = ast.children;
+        chunks[k].loops = ast.loops;
+    }
+    runThreads(parseChunkCopy, chunks, sizeof(ParseChunk), threads);
+    free(chunks);
+    if (error[0]) fatal("%s", error);
+    current_token_index = position;
+}
+#endif
+
+static TreeNode* parseProgram() {
+    astReset();
+    parse_depth = 0;
+    uint32_t program = createNode(NODE_PROGRAM, ATOM_EMPTY, 1);
+    
+    parseStatements(0);
+    
+    return &ast.nodes[endNode(program)];
+}
+
+// Hands a long statement list starting at the current token to parseParallel()
+static void parseSplit(int inBlock) {
+#ifndef _WIN32
+    if (parseThreads > 1 && !parse_worker) {
+        uint32_t begin = (uint32_t)current_token_index;
+        uint32_t container = inBlock ? braceAt(begin - 1) : NO_BRACE;
+        uint32_t end = !inBlock ? (uint32_t)token_count : container != NO_BRACE ? braces[container].close : begin;
+        if (end != NO_BRACE && end - begin >= PARSE_SPLIT_MIN) parseParallel(begin, end, container, inBlock);
+    }
+#else
+    (void)inBlock;
+#endif
+}
+
+// Statements up to statementsEnd(), added to the node being built
+static void parseStatements(int inBlock) {
+    parseSplit(inBlock);
+    while (!statementsEnd(inBlock)) {
+        uint32_t statement = parseStatement();
+        if (statement != NO_NODE) {
+            addChild(statement);
+        }
+    }
+}
+
+// "+=" and "-=" statements
+static uint32_t parseUpdate(NodeType type, const char* op) {
+    const Token* current = getCurrentToken();
+    uint32_t update = createNode(type, ATOM_EMPTY, current->line_number);
+    addChild(createLeaf(NODE_VARIABLE, current->atom, current->line_number));
+    consumeToken(); // variable
+    consumeToken(); // += or -=
+
+    const Token* value_token = getCurrentToken();
+    if (value_token->type == TOKEN_NUMBER) {
+        addChild(createLeaf(NODE_NUMBER, value_token->atom, value_token->line_number));
+    } else if (value_token->type == TOKEN_IDENTIFIER) {
+        addChild(createLeaf(NODE_VARIABLE, value_token->atom, value_token->line_number));
+    } else {
+        fatal("Error on line %d: Expected number or variable after '%s'\n", value_token->line_number, op);
+    }
+    consumeToken(); // value
+    consumeToken(); // ;
+
+    return endNode(update);
+}
+
+// Statements other than loops
+static uint32_t parseFlatStatement() {
+    const Token* current = getCurrentToken();
+    
+    if (current->type == TOKEN_KEYWORD) {
+        if (current->atom == ATOM_NUMBER) {
+            return parseDeclaration();
+        } else if (current->atom == ATOM_WRITE) {
+            return parseWrite();
+        }
+    } else if (current->type == TOKEN_IDENTIFIER) {
+        const Token* next = peekNextToken();
+        if (next->type == TOKEN_OPERATOR) {
+            if (next->atom == ATOM_ASSIGN) {
+                return parseAssignment();
+            }else if (next->atom == ATOM_PLUS_ASSIGN) {
+                return parseUpdate(NODE_INCREMENT, "+=");
+            }else if (next->atom == ATOM_MINUS_ASSIGN) {
+                return parseUpdate(NODE_DECREMENT, "-=");
+            }
+        }
+    }
+    
+    // Skip unknown tokens
+    consumeToken();
+    return NO_NODE;
+}
+
+// Loops nest through parse_stack instead of the call stack, so the nesting
+// depth is only limited by memory
+static uint32_t parseStatement() {
+    uint32_t base = parse_depth;
+    for (;;) {
+        uint32_t statement = NO_NODE;
+        const Token* current = getCurrentToken();
+        if (current->type == TOKEN_KEYWORD && current->atom == ATOM_REPEAT) {
+            parseLoop();
+            // A single statement body is parsed next
+            if (parse_stack[parse_depth - 1].block == NO_NODE) continue;
+        } else {
+            statement = parseFlatStatement();
+        }
+
+        // Hands the finished statement to the loop it belongs to; a loop
+        // that is complete with it is finished in turn
+        for (;;) {
+            if (parse_depth == base) return statement;
+            ParseFrame* frame = &parse_stack[parse_depth - 1];
+            if (statement != NO_NODE) addChild(statement);
+            if (frame->block != NO_NODE) {
+                if (!statementsEnd(1)) break;
+                consumeToken(); // }
+                addChild(endNode(frame->block));
+            }
+            statement = endNode(frame->loop);
+            parse_depth--;
+        }
+    }
+}
+
+static uint32_t parseDeclaration() {
+    uint32_t decl = createNode(NODE_DECLARATION, ATOM_EMPTY, getCurrentToken()->line_number);
+    
+    consumeToken(); // "number"
+    const Token* var_token = getCurrentToken();
+    addChild(createLeaf(NODE_VARIABLE, var_token->atom, var_token->line_number));
+    
+    // REMOVED: Don't add variable again - it's already declared in keywordType()
+    // declareSymbol(var_token->atom);
+    
+    consumeToken(); // variable name
+    consumeToken(); // ;
+    
+    return endNode(decl);
+}
+
+static uint32_t parseAssignment() {
+    uint32_t assign = createNode(NODE_ASSIGNMENT, ATOM_EMPTY, getCurrentToken()->line_number);
+    
+    const Token* var_token = getCurrentToken();
+    addChild(createLeaf(NODE_VARIABLE, var_token->atom, var_token->line_number));
+    
+    consumeToken(); // variable
+    consumeToken(); // :=
+    
+    const Token* value_token = getCurrentToken();
+    if (value_token->type == TOKEN_NUMBER) {
+        addChild(createLeaf(NODE_NUMBER, value_token->atom, value_token->line_number));
+    } else {
+        addChild(createLeaf(NODE_VARIABLE, value_token->atom, value_token->line_number));
+    }
+    
+    consumeToken(); // value
+    consumeToken(); // ;
+    
+    return endNode(assign);
+}
+
+static uint32_t parseWrite() {
+    uint32_t write_node = createNode(NODE_WRITE, ATOM_EMPTY, getCurrentToken()->line_number);
+    
+    consumeToken(); // "write"
+    
+    while (getCurrentToken()->type != TOKEN_SEMICOLON && getCurrentToken()->type != TOKEN_EOF) {
+        const Token* current = getCurrentToken();
+        
+        if (current->type == TOKEN_STRING) {
+            addChild(createLeaf(NODE_STRING, current->atom, current->line_number));
+        } else if (current->type == TOKEN_IDENTIFIER) {
+            addChild(createLeaf(NODE_VARIABLE, current->atom, current->line_number));
+        } else if (current->type == TOKEN_KEYWORD && current->atom == ATOM_NEWLINE) {
+            addChild(createLeaf(NODE_NEWLINE, ATOM_EMPTY, current->line_number));
+        }
+        
+        consumeToken();
+        
+        // Skip "and" keyword
+        if (getCurrentToken()->type == TOKEN_KEYWORD && getCurrentToken()->atom == ATOM_AND) {
+            consumeToken();
+        }
+    }
+    
+    consumeToken(); // ;
+    return endNode(write_node);
+}
+
+// Starts a loop on parse_stack: its count and, for a block body, the block
+static void parseLoop() {
+    uint32_t loop = createNode(NODE_LOOP, ATOM_EMPTY, getCurrentToken()->line_number);
+    
+    consumeToken(); // "repeat"
+    
+    const Token* count_token = getCurrentToken();
+    
+    // Count hem sabit sayı hem de değişken olabilir
+    if (count_token->type == TOKEN_NUMBER) {
+        addChild(createLeaf(NODE_NUMBER, count_token->atom, count_token->line_number));
+    } else if (count_token->type == TOKEN_IDENTIFIER) {
+        addChild(createLeaf(NODE_VARIABLE, count_token->atom, count_token->line_number));
+    } else {
+        fatal("Error on line %d: Expected number or variable after 'repeat'\n", count_token->line_number);
+    }
+    
+    consumeToken(); // count
+    consumeToken(); // "times"
+    
+    if (parse_depth == parse_capacity) {
+        parse_capacity = parse_capacity ? parse_capacity * 2 : 64;
+        parse_stack = (ParseFrame*)realloc(parse_stack, sizeof(ParseFrame) * parse_capacity);
+        if (!parse_stack) fatal("Error: Out of memory\n");
+    }
+    ParseFrame* frame = &parse_stack[parse_depth++];
+    frame->loop = loop;
+    frame->block = NO_NODE;
+    if (getCurrentToken()->type == TOKEN_OPEN_BLOCK) {
+        consumeToken(); // {
+        frame->block = createNode(NODE_BLOCK, ATOM_EMPTY, getCurrentToken()->line_number);
+        parseSplit(1);
+    }
+}
+
+// Decimal integers that do not fit a long long are BIG_TAG. Other strtod()
+// forms keep reading as their leading integer, as atoll() does.
+static long long literalValue(const char* text) {
+    char* end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (*end == '\0' && end != text && (errno == ERANGE || value == BIG_TAG)) return BIG_TAG;
+    return atoll(text);
+}
+
+// Semantic pass: gives every NODE_VARIABLE its slot and decodes every
+// NODE_NUMBER, so the interpreter does no string work. Names that are not
+// declared variables (e.g. "x := times;") get a slot of their own that
+// stays 0, which is what the old name lookup returned for them.
+// Walks the tree in pre-order on a heap stack, so any nesting depth works.
+static void resolveSymbols(TreeNode* node) {
+    if (!node) return;
+    uint32_t* stack = NULL;
+    uint32_t count = 0, capacity = 0;
+    stack = (uint32_t*)growArray(stack, &capacity, 1, sizeof(uint32_t));
+    stack[count++] = (uint32_t)(node - ast.nodes);
+    while (count > 0) {
+        node = &ast.nodes[stack[--count]];
+        if (node->type == NODE_VARIABLE) {
+            node->slot = declareSymbol(node->atom);
+        } else if (node->type == NODE_NUMBER) {
+            node->number = literalValue(atomText(node->atom));
+        }
+        stack = (uint32_t*)growArray(stack, &capacity, count + (uint32_t)node->child_count, sizeof(uint32_t));
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[count++] = ast.children[node->first_child + (uint32_t)i];
+        }
+    }
+    free(stack);
+}
+
+// Optimization passes (-O1, -O2)
+//
+// Passes rewrite the resolved parse tree in place before any engine runs, so
+// the tree walker, VM, JIT and native backends all execute the optimized
+// program. Each pass returns the number of changes it made.
+
+// Set while optimizing one piece of a --stream run: the variables start with
+// these values instead of 0, and all of them are read after the piece
+static THREAD_LOCAL const long long* opt_entry_values = NULL;
+
+typedef struct {
+    const char* name;
+    int level;                      // lowest -O level that runs the pass
+    int (*run)(TreeNode* program);
+} OptPass;
+
+// The removed subtree stays in the arena until the next astReset()
+static void removeChild(TreeNode* parent, int index) {
+    uint32_t* range = ast.children + parent->first_child;
+    memmove(range + index, range + index + 1, sizeof(uint32_t) * (size_t)(parent->child_count - index - 1));
+    parent->child_count--;
+}
+
+static void makeNumber(TreeNode* node, long long number) {
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%lld", number);
+    node->type = NODE_NUMBER;
+    node->atom = internAtom(text, length);
+    node->number = number;
+}
+
+static void makeString(TreeNode* node, const char* text, int length) {
+    node->type = NODE_STRING;
+    node->atom = internAtom(text, length);
+    node->number = 0;
+}
+
+// Parser only produces numbers and variables as operands, anything else reads
+// as 0. Numbers past 64 bits are not tracked.
+static int constantValue(TreeNode* value, long long* number) {
+    if (value->type == NODE_VARIABLE || (value->type == NODE_NUMBER && value->number == BIG_TAG)) return 0;
+    *number = value->type == NODE_NUMBER ? value->number : 0;
+    return 1;
+}
+
+static int isEmptyStatement(TreeNode* node) {
+    return !node || (node->type == NODE_BLOCK && node->child_count == 0);
+}
+
+// Slots each loop reads or writes, nested loops included: loop L (its
+// LoopInfo index) has slots[first[L]] .. slots[first[L] + length[L] - 1]
+typedef struct {
+    uint32_t* slots;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* first;
+    uint32_t* length;
+} LoopSlots;
+
+typedef struct {
+    uint32_t node;
+    uint32_t mark;     // a loop being left: where its slots start in pending
+} LoopSlotFrame;
+
+// Fills sets in one walk, bottom-up: a loop has the slots its own
+// statements and count read (or its stores write) plus those of the loops
+// directly inside it. Reads are what markReads() clears.
+static void collectLoopSlots(TreeNode* program, LoopSlots* sets, int reads) {
+    memset(sets, 0, sizeof(*sets));
+    sets->first = (uint32_t*)calloc((size_t)ast.loop_count + 1, sizeof(uint32_t));
+    sets->length = (uint32_t*)calloc((size_t)ast.loop_count + 1, sizeof(uint32_t));
+    uint32_t* stamp = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)symbol_count + 1));
+    memset(stamp, 0xff, sizeof(uint32_t) * ((size_t)symbol_count + 1));
+    uint32_t* pending = NULL;
+    uint32_t pendingCount = 0, pendingCapacity = 0;
+    LoopSlotFrame* stack = NULL;
+    uint32_t count = 0, capacity = 0;
+    stack = (LoopSlotFrame*)growArray(stack, &capacity, 1, sizeof(LoopSlotFrame));
+    stack[count++] = (LoopSlotFrame){(uint32_t)(program - ast.nodes), NO_NODE};
+    while (count > 0) {
+        LoopSlotFrame frame = stack[--count];
+        TreeNode* node = &ast.nodes[frame.node];
+        if (frame.mark != NO_NODE) {
+            // Everything inside has been seen: keep each slot once
+            uint32_t loop = node->loop;
+            sets->first[loop] = sets->count;
+            for (uint32_t p = frame.mark; p < pendingCount; p++) {
+                uint32_t slot = pending[p];
+                if (stamp[slot] == loop) continue;
+                stamp[slot] = loop;
+                sets->slots = (uint32_t*)growArray(sets->slots, &sets->capacity, sets->count + 1, sizeof(uint32_t));
+                sets->slots[sets->count++] = slot;
+            }
+            sets->length[loop] = sets->count - sets->first[loop];
+            pendingCount = frame.mark;
+            pending = (uint32_t*)growArray(pending, &pendingCapacity, pendingCount + sets->length[loop] + 1,
+                                           sizeof(uint32_t));
+            memcpy(pending + pendingCount, sets->slots + sets->first[loop], sizeof(uint32_t) * sets->length[loop]);
+            pendingCount += sets->length[loop];
+            continue;
+        }
+        int from = 0;
+        if (node->type == NODE_VARIABLE) {
+            if (reads) {
+                pending = (uint32_t*)growArray(pending, &pendingCapacity, pendingCount + 1, sizeof(uint32_t));
+                pending[pendingCount++] = (uint32_t)node->slot;
+            }
+            continue;
+        }
+        if (node->type == NODE_DECLARATION) continue;
+        if (node->type == NODE_ASSIGNMENT || node->type == NODE_INCREMENT || node->type == NODE_DECREMENT) {
+            if (!reads) {
+                if (node->child_count >= 1) {
+                    pending = (uint32_t*)growArray(pending, &pendingCapacity, pendingCount + 1, sizeof(uint32_t));
+                    pending[pendingCount++] = (uint32_t)childAt(node, 0)->slot;
+                }
+                continue;
+            }
+            // ":=" does not read its target
+            if (node->type == NODE_ASSIGNMENT) from = 1;
+        }
+        stack = (LoopSlotFrame*)growArray(stack, &capacity, count + (uint32_t)node->child_count + 1,
+                                          sizeof(LoopSlotFrame));
+        if (node->type == NODE_LOOP) stack[count++] = (LoopSlotFrame){frame.node, pendingCount};
+        for (int i = node->child_count - 1; i >= from; i--) {
+            stack[count++] = (LoopSlotFrame){ast.children[node->first_child + (uint32_t)i], NO_NODE};
+        }
+    }
+    free(stack);
+    free(pending);
+    free(stamp);
+}
+
+static void freeLoopSlots(LoopSlots* sets) {
+    free(sets->slots);
+    free(sets->first);
+    free(sets->length);
+}
+
+// Constant propagation and folding.
+//
+// Walks the program in execution order tracking which slots hold a known
+// value; every slot starts out as a known 0. Known operands become numbers,
+// writes of known variables become string literals, "x += c" on a known x
+// becomes an assignment, and loops that never run or have an empty body
+// are removed. Slots written inside a loop are unknown in and after it.
+typedef struct {
+    unsigned char* known;
+    long long* value;
+    LoopSlots written;
+} ConstState;
+
+static void forgetWrites(TreeNode* loop, ConstState* state) {
+    const uint32_t* slot = state->written.slots + state->written.first[loop->loop];
+    for (uint32_t i = 0; i < state->written.length[loop->loop]; i++) state->known[slot[i]] = 0;
+}
+
+static int propagateOperand(TreeNode* value, ConstState* state) {
+    if (value->type == NODE_VARIABLE && state->known[value->slot]) {
+        makeNumber(value, state->value[value->slot]);
+        return 1;
+    }
+    return 0;
+}
+
+// A statement that is not a loop or block. Sets *remove when it turned out
+// to do nothing.
+static int propagateStatement(TreeNode* node, ConstState* state, int* remove) {
+    int changes = 0;
+    long long number = 0;
+    *remove = 0;
+    switch (node->type) {
+        case NODE_ASSIGNMENT: {
+            if (node->child_count < 2) break;
+            int target = childAt(node, 0)->slot;
+            changes += propagateOperand(childAt(node, 1), state);
+            state->known[target] = (unsigned char)constantValue(childAt(node, 1), &number);
+            state->value[target] = number;
+            break;
+        }
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count < 2) break;
+            int target = childAt(node, 0)->slot;
+            changes += propagateOperand(childAt(node, 1), state);
+            if (!constantValue(childAt(node, 1), &number)) {
+                state->known[target] = 0;
+            } else if (number == 0) {
+                *remove = 1;
+                changes++;
+            } else if (state->known[target]) {
+                // A result past 64 bits is left to the engines
+                long long folded;
+                if (!isSmall(state->value[target]) || !isSmall(number) ||
+                    !smallAdd(state->value[target], number, node->type == NODE_DECREMENT, &folded)) {
+                    state->known[target] = 0;
+                    break;
+                }
+                node->type = NODE_ASSIGNMENT;
+                makeNumber(childAt(node, 1), folded);
+                state->value[target] = folded;
+                changes++;
+            }
+            break;
+        }
+        case NODE_WRITE: {
+            for (int i = 0; i < node->child_count; i++) {
+                TreeNode* piece = childAt(node, i);
+                if (piece->type == NODE_VARIABLE && state->known[piece->slot]) {
+                    char text[32];
+                    makeString(piece, text, snprintf(text, sizeof(text), "%lld", state->value[piece->slot]));
+                    changes++;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return changes;
+}
+
+// One statement list being walked: the children of parent from index on.
+// A loop's own frame covers its body, child 1, when that is not a block.
+typedef struct {
+    TreeNode* parent;
+    int index;
+    TreeNode* loop;    // left when the list is done, or NULL
+} ConstFrame;
+
+// Walks the statements on a heap stack, so any nesting depth works
+static int propagateSequence(TreeNode* program, ConstState* state) {
+    int changes = 0;
+    ConstFrame* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (ConstFrame*)growArray(stack, &capacity, 1, sizeof(ConstFrame));
+    stack[depth++] = (ConstFrame){program, 0, NULL};
+    while (depth > 0) {
+        ConstFrame* frame = &stack[depth - 1];
+        if (frame->index >= frame->parent->child_count) {
+            if (frame->loop) forgetWrites(frame->loop, state);
+            depth--;
+            continue;
+        }
+        TreeNode* node = childAt(frame->parent, frame->index);
+        int remove = 0;
+        if (node->type == NODE_LOOP) {
+            if (node->child_count < 1) {
+                frame->index++;
+                continue;
+            }
+            long long number;
+            changes += propagateOperand(childAt(node, 0), state);
+            TreeNode* body = node->child_count > 1 ? childAt(node, 1) : NULL;
+            if (isEmptyStatement(body) || (constantValue(childAt(node, 0), &number) && number <= 0)) {
+                removeChild(frame->parent, frame->index);
+                changes++;
+                continue;
+            }
+            forgetWrites(node, state);
+            frame->index++;
+            stack = (ConstFrame*)growArray(stack, &capacity, depth + 1, sizeof(ConstFrame));
+            if (body->type == NODE_BLOCK) stack[depth++] = (ConstFrame){body, 0, node};
+            else stack[depth++] = (ConstFrame){node, 1, node};
+            continue;
+        }
+        if (node->type == NODE_BLOCK) {
+            frame->index++;
+            stack = (ConstFrame*)growArray(stack, &capacity, depth + 1, sizeof(ConstFrame));
+            stack[depth++] = (ConstFrame){node, 0, NULL};
+            continue;
+        }
+        changes += propagateStatement(node, state, &remove);
+        if (remove) removeChild(frame->parent, frame->index);
+        else frame->index++;
+    }
+    free(stack);
+    return changes;
+}
+
+static int passConstants(TreeNode* program) {
+    ConstState state;
+    state.known = (unsigned char*)malloc((size_t)symbol_count + 1);
+    state.value = (long long*)calloc((size_t)symbol_count + 1, sizeof(long long));
+    memset(state.known, 1, (size_t)symbol_count + 1);
+    if (opt_entry_values) {
+        memcpy(state.value, opt_entry_values, sizeof(long long) * ((size_t)symbol_count + 1));
+        for (int i = 0; i <= symbol_count; i++) {
+            if (state.value[i] == BIG_TAG) state.known[i] = 0;
+        }
+    }
+    collectLoopSlots(program, &state.written, 0);
+    int changes = propagateSequence(program, &state);
+    free(state.known);
+    free(state.value);
+    freeLoopSlots(&state.written);
+    return changes;
+}
+
+// Dead-store elimination.
+//
+// First removes every store to a variable whose value can never reach a
+// write or a loop count. Then walks each statement list backwards and
+// removes stores that are overwritten by ":=" before anything reads them,
+// including the last stores before the program ends.
+
+// Sets set[] for the slots a statement without a nested statement reads
+static void markReads(TreeNode* node, unsigned char* set, unsigned char value) {
+    if (node->type == NODE_DECLARATION) return;
+    // += and -= read their target too
+    for (int i = node->type == NODE_ASSIGNMENT ? 1 : 0; i < node->child_count; i++) {
+        TreeNode* child = childAt(node, i);
+        if (child->type == NODE_VARIABLE) set[child->slot] = value;
+    }
+}
+
+static int isStore(TreeNode* node) {
+    return node && (node->type == NODE_ASSIGNMENT || node->type == NODE_INCREMENT || node->type == NODE_DECREMENT) &&
+           node->child_count >= 2;
+}
+
+// Marks what writes and loop counts read, and collects the stores
+static uint32_t* markObservable(TreeNode* program, unsigned char* live, uint32_t* storeCount) {
+    uint32_t* stores = NULL;
+    uint32_t count = 0, capacity = 0;
+    uint32_t* stack = NULL;
+    uint32_t depth = 0, stackCapacity = 0;
+    stack = (uint32_t*)growArray(stack, &stackCapacity, 1, sizeof(uint32_t));
+    stack[depth++] = (uint32_t)(program - ast.nodes);
+    while (depth > 0) {
+        TreeNode* node = &ast.nodes[stack[--depth]];
+        if (node->type == NODE_WRITE) {
+            markReads(node, live, 1);
+            continue;
+        }
+        if (isStore(node)) {
+            stores = (uint32_t*)growArray(stores, &capacity, count + 1, sizeof(uint32_t));
+            stores[count++] = (uint32_t)(node - ast.nodes);
+            continue;
+        }
+        if (node->type == NODE_LOOP && node->child_count >= 1 && childAt(node, 0)->type == NODE_VARIABLE) {
+            live[childAt(node, 0)->slot] = 1;
+        }
+        stack = (uint32_t*)growArray(stack, &stackCapacity, depth + (uint32_t)node->child_count, sizeof(uint32_t));
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[depth++] = ast.children[node->first_child + (uint32_t)i];
+        }
+    }
+    free(stack);
+    *storeCount = count;
+    return stores;
+}
+
+static int propagateLiveness(const uint32_t* stores, uint32_t count, unsigned char* live) {
+    int changes = 0;
+    for (uint32_t s = 0; s < count; s++) {
+        TreeNode* node = &ast.nodes[stores[s]];
+        TreeNode* value = childAt(node, 1);
+        if (live[childAt(node, 0)->slot] && value->type == NODE_VARIABLE && !live[value->slot]) {
+            live[value->slot] = 1;
+            changes++;
+        }
+    }
+    return changes;
+}
+
+static int removeUselessStores(TreeNode* program, const unsigned char* live) {
+    int changes = 0;
+    uint32_t* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (uint32_t*)growArray(stack, &capacity, 1, sizeof(uint32_t));
+    stack[depth++] = (uint32_t)(program - ast.nodes);
+    while (depth > 0) {
+        TreeNode* parent = &ast.nodes[stack[--depth]];
+        for (int i = 0; i < parent->child_count;) {
+            TreeNode* child = childAt(parent, i);
+            if (isStore(child) && !live[childAt(child, 0)->slot]) {
+                removeChild(parent, i);
+                changes++;
+                continue;
+            }
+            if (child->type == NODE_LOOP || child->type == NODE_BLOCK) {
+                stack = (uint32_t*)growArray(stack, &capacity, depth + 1, sizeof(uint32_t));
+                stack[depth++] = (uint32_t)(child - ast.nodes);
+            }
+            i++;
+        }
+    }
+    free(stack);
+    return changes;
+}
+
+// A statement list walked backwards: the children of parent from index
+// down to first. A loop's own frame covers its body when that is not a
+// block. Each loop body starts with nothing known to be overwritten.
+typedef struct {
+    TreeNode* parent;
+    int index;
+    int first;
+    uint32_t id;       // killed[slot] == id while the slot is overwritten
+    uint32_t undo;     // undo log length when the loop body started
+    TreeNode* loop;    // its reads go into the enclosing list, or NULL
+} StoreFrame;
+
+typedef struct {
+    uint32_t* killed;
+    uint32_t* undo;    // pairs of slot and previous killed[slot]
+    uint32_t undo_count;
+    uint32_t undo_capacity;
+} KilledState;
+
+static void setKilled(KilledState* state, int slot, uint32_t id) {
+    state->undo = (uint32_t*)growArray(state->undo, &state->undo_capacity, state->undo_count + 2, sizeof(uint32_t));
+    state->undo[state->undo_count++] = (uint32_t)slot;
+    state->undo[state->undo_count++] = state->killed[slot];
+    state->killed[slot] = id;
+}
+
+// Reads of a statement without a nested statement end the slots' overwritten state
+static void clearReads(KilledState* state, TreeNode* node) {
+    if (node->type == NODE_DECLARATION) return;
+    for (int i = node->type == NODE_ASSIGNMENT ? 1 : 0; i < node->child_count; i++) {
+        TreeNode* child = childAt(node, i);
+        if (child->type == NODE_VARIABLE && state->killed[child->slot] != 0) setKilled(state, child->slot, 0);
+    }
+}
+
+static int removeOverwrittenStores(TreeNode* program, int startKilled) {
+    LoopSlots reads;
+    collectLoopSlots(program, &reads, 1);
+    KilledState state = {NULL, NULL, 0, 0};
+    state.killed = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)symbol_count + 1));
+    for (int i = 0; i <= symbol_count; i++) state.killed[i] = startKilled ? 1 : 0;
+    uint32_t ids = 1;
+    int changes = 0;
+    StoreFrame* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (StoreFrame*)growArray(stack, &capacity, 1, sizeof(StoreFrame));
+    stack[depth++] = (StoreFrame){program, program->child_count - 1, 0, ids, 0, NULL};
+    while (depth > 0) {
+        StoreFrame* frame = &stack[depth - 1];
+        if (frame->index < frame->first) {
+            TreeNode* loop = frame->loop;
+            if (loop) {
+                // The body may run any number of times, so nothing is known to
+                // be overwritten at its end; ahead of the loop only its reads matter
+                while (state.undo_count > frame->undo) {
+                    state.undo_count -= 2;
+                    state.killed[state.undo[state.undo_count]] = state.undo[state.undo_count + 1];
+                }
+                const uint32_t* slot = reads.slots + reads.first[loop->loop];
+                for (uint32_t i = 0; i < reads.length[loop->loop]; i++) {
+                    if (state.killed[slot[i]] != 0) setKilled(&state, (int)slot[i], 0);
+                }
+            }
+            depth--;
+            continue;
+        }
+        TreeNode* child = childAt(frame->parent, frame->index);
+        uint32_t id = frame->id;
+        if (isStore(child)) {
+            int target = childAt(child, 0)->slot;
+            if (state.killed[target] == id) {
+                removeChild(frame->parent, frame->index--);
+                changes++;
+                continue;
+            }
+            frame->index--;
+            if (child->type == NODE_ASSIGNMENT) setKilled(&state, target, id);
+            clearReads(&state, child);
+        } else if (child->type == NODE_BLOCK) {
+            frame->index--;
+            stack = (StoreFrame*)growArray(stack, &capacity, depth + 1, sizeof(StoreFrame));
+            stack[depth++] = (StoreFrame){child, child->child_count - 1, 0, id, 0, NULL};
+        } else if (child->type == NODE_LOOP) {
+            frame->index--;
+            stack = (StoreFrame*)growArray(stack, &capacity, depth + 1, sizeof(StoreFrame));
+            if (child->child_count > 1 && childAt(child, 1)->type == NODE_BLOCK) {
+                TreeNode* body = childAt(child, 1);
+                stack[depth++] = (StoreFrame){body, body->child_count - 1, 0, ++ids, state.undo_count, child};
+            } else {
+                stack[depth++] = (StoreFrame){child, child->child_count - 1, 1, ++ids, state.undo_count, child};
+            }
+        } else {
+            frame->index--;
+            clearReads(&state, child);
+        }
+    }
+    free(stack);
+    free(state.killed);
+    free(state.undo);
+    freeLoopSlots(&reads);
+    return changes;
+}
+
+static int passDeadStores(TreeNode* program) {
+    unsigned char* live = (unsigned char*)calloc((size_t)symbol_count + 1, 1);
+    if (opt_entry_values) memset(live, 1, (size_t)symbol_count + 1);
+    uint32_t storeCount;
+    uint32_t* stores = markObservable(program, live, &storeCount);
+    while (propagateLiveness(stores, storeCount, live) > 0) {
+    }
+    free(stores);
+    int changes = removeUselessStores(program, live);
+    free(live);
+    changes += removeOverwrittenStores(program, !opt_entry_values);
+    return changes;
+}
+
+// Write coalescing.
+//
+// Adjacent string and newline pieces of a write become one pre-rendered
+// string literal, and consecutive writes are merged into one as long as the
+// result fits in a node.
+static int isLiteralPiece(TreeNode* node) {
+    return node->type == NODE_STRING || node->type == NODE_NEWLINE;
+}
+
+// Merges literal runs in pieces[], returns the new piece count
+static int coalescePieces(TreeNode** pieces, int count, int* changes) {
+    int out = 0;
+    for (int i = 0; i < count;) {
+        int end = i + 1;
+        while (isLiteralPiece(pieces[i]) && end < count && isLiteralPiece(pieces[end])) end++;
+        if (end - i > 1) {
+            size_t length = 0;
+            for (int j = i; j < end; j++) {
+                length += pieces[j]->type == NODE_NEWLINE ? 1 : atomLength(pieces[j]->atom);
+            }
+            char* text = (char*)malloc(length + 1);
+            size_t used = 0;
+            for (int j = i; j < end; j++) {
+                if (pieces[j]->type == NODE_NEWLINE) {
+                    text[used++] = '\n';
+                } else {
+                    size_t n = atomLength(pieces[j]->atom);
+                    memcpy(text + used, atomText(pieces[j]->atom), n);
+                    used += n;
+                }
+            }
+            makeString(pieces[i], text, (int)used);
+            free(text);
+            (*changes)++;
+        }
+        pieces[out++] = pieces[i];
+        i = end;
+    }
+    return out;
+}
+
+// Statement lists: a block's children, or a loop's body (child 1) when that
+// is not a block
+typedef struct {
+    TreeNode* parent;
+    int first;
+} CoalesceList;
+
+static int passCoalesceWrites(TreeNode* program) {
+    int changes = 0;
+    CoalesceList* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (CoalesceList*)growArray(stack, &capacity, 1, sizeof(CoalesceList));
+    stack[depth++] = (CoalesceList){program, 0};
+    while (depth > 0) {
+        CoalesceList list = stack[--depth];
+        TreeNode* parent = list.parent;
+        for (int i = list.first; i < parent->child_count; i++) {
+            TreeNode* child = childAt(parent, i);
+            if (child->type == NODE_WRITE) {
+                // Pull the following writes in
+                int last = i;
+                int total = child->child_count;
+                while (last + 1 < parent->child_count && childAt(parent, last + 1)->type == NODE_WRITE) {
+                    last++;
+                    total += childAt(parent, last)->child_count;
+                }
+                TreeNode** pieces = (TreeNode**)malloc(sizeof(TreeNode*) * (size_t)(total ? total : 1));
+                int count = 0;
+                for (int w = i; w <= last; w++) {
+                    TreeNode* write = childAt(parent, w);
+                    for (int j = 0; j < write->child_count; j++) pieces[count++] = childAt(write, j);
+                }
+                count = coalescePieces(pieces, count, &changes);
+                if (count > child->child_count) {
+                    // Merged writes need a longer range than the first one had
+                    ast.children = (uint32_t*)growArray(ast.children, &ast.child_capacity,
+                                                        ast.child_count + (uint32_t)count, sizeof(uint32_t));
+                    child->first_child = ast.child_count;
+                    ast.child_count += (uint32_t)count;
+                }
+                for (int j = 0; j < count; j++) setChild(child, j, pieces[j]);
+                child->child_count = count;
+                free(pieces);
+                for (int w = i + 1; w <= last; w++) {
+                    removeChild(parent, i + 1);
+                    changes++;
+                }
+            } else if (child->type == NODE_BLOCK || (child->type == NODE_LOOP && child->child_count > 1)) {
+                stack = (CoalesceList*)growArray(stack, &capacity, depth + 1, sizeof(CoalesceList));
+                stack[depth++] = (CoalesceList){child, child->type == NODE_LOOP ? 1 : 0};
+            }
+        }
+    }
+    free(stack);
+    return changes;
+}
+
+// Closed-form loops (-O1)
+//
+// A loop whose body only adds and subtracts (+=, -=), possibly inside nested
+// loops with counts that stay fixed while it runs, applies the same affine
+// map to the variables on every iteration. When no variable feeds back into
+// itself, that map is I + N with N nilpotent, so each written variable is a
+// polynomial in the trip count of degree at most the longest chain of
+// variables feeding each other. runClosedForm() runs the body that many
+// times, takes forward differences and evaluates the Newton form
+// sum C(count, j) * delta^j at the real count. That sum is exact, like the
+// engines' own arithmetic: it runs in long longs while every difference,
+// binomial and term fits, and otherwise, or when a variable already holds a
+// big value, in BigNums via closedFormBig(). Bodies with a write or ":="
+// keep iterating.
+// Only loops with at most CLOSED_MAX_DEPTH levels of loops inside are
+// analyzed, which keeps the pass linear and the analysis and
+// runClosedForm() from recursing deeper than that.
+#define CLOSED_MAX_SLOTS 64
+#define CLOSED_MAX_DEPTH 16
+
+// Collects written slots in order, fails on statements that are not sums
+static int collectSums(TreeNode* node, int* index, int* written, int* count) {
+    if (!node) return 1;
+    switch (node->type) {
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count < 2) return 1;
+            int slot = childAt(node, 0)->slot;
+            if (index[slot] < 0) {
+                if (*count == CLOSED_MAX_SLOTS) return 0;
+                index[slot] = *count;
+                written[(*count)++] = slot;
+            }
+            return 1;
+        }
+        case NODE_DECLARATION:
+            return 1;
+        case NODE_BLOCK:
+        case NODE_LOOP:
+            for (int i = node->type == NODE_LOOP ? 1 : 0; i < node->child_count; i++) {
+                if (!collectSums(childAt(node, i), index, written, count)) return 0;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Inner loop counts must not change while the outer loop runs
+static int hasFixedCounts(TreeNode* node, const int* index) {
+    if (!node) return 1;
+    if (node->type == NODE_LOOP && node->child_count >= 1) {
+        TreeNode* count = childAt(node, 0);
+        if (count->type == NODE_VARIABLE && index[count->slot] >= 0) return 0;
+    }
+    for (int i = 0; i < node->child_count; i++) {
+        if (!hasFixedCounts(childAt(node, i), index)) return 0;
+    }
+    return 1;
+}
+
+// depends[w]: written slots (by index) whose start-of-iteration value the
+// value of written slot w depends on. Dependencies only grow, so inside a
+// loop that is being repeated until nothing changes (nested set), inner
+// loops need no fixpoint of their own.
+static void collectDependencies(TreeNode* node, const int* index, uint64_t* depends, int nested) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count < 2 || childAt(node, 1)->type != NODE_VARIABLE) break;
+            int source = index[childAt(node, 1)->slot];
+            if (source >= 0) {
+                depends[index[childAt(node, 0)->slot]] |= ((uint64_t)1 << source) | depends[source];
+            }
+            break;
+        }
+        case NODE_BLOCK:
+            for (int i = 0; i < node->child_count; i++) {
+                collectDependencies(childAt(node, i), index, depends, nested);
+            }
+            break;
+        case NODE_LOOP: {
+            // Any number of trips: repeat the body until nothing new shows up
+            if (node->child_count < 2) break;
+            if (nested) {
+                collectDependencies(childAt(node, 1), index, depends, 1);
+                break;
+            }
+            uint64_t before[CLOSED_MAX_SLOTS];
+            do {
+                memcpy(before, depends, sizeof(before));
+                collectDependencies(childAt(node, 1), index, depends, 1);
+            } while (memcmp(before, depends, sizeof(before)) != 0);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Returns the analysis for loop, or NULL if it has to iterate. index[] is
+// all -1 for every slot, and is left that way.
+static ClosedForm* analyzeLoop(TreeNode* loop, int* index) {
+    if (loop->child_count < 2) return NULL;
+    TreeNode* body = childAt(loop, 1);
+    int written[CLOSED_MAX_SLOTS];
+    int count = 0;
+    ClosedForm* form = NULL;
+
+    if (collectSums(body, index, written, &count) && hasFixedCounts(body, index)) {
+        uint64_t depends[CLOSED_MAX_SLOTS] = {0};
+        collectDependencies(body, index, depends, 0);
+
+        // A slot that reaches itself grows exponentially (x += x)
+        uint64_t reach[CLOSED_MAX_SLOTS];
+        memcpy(reach, depends, sizeof(reach));
+        for (int k = 0; k < count; k++) {
+            for (int i = 0; i < count; i++) {
+                if (reach[i] & ((uint64_t)1 << k)) reach[i] |= reach[k];
+            }
+        }
+        int cyclic = 0;
+        for (int i = 0; i < count; i++) {
+            if (reach[i] & ((uint64_t)1 << i)) cyclic = 1;
+        }
+
+        if (!cyclic) {
+            int degrees[CLOSED_MAX_SLOTS];
+            int degree = 0;
+            for (int i = 0; i < count; i++) degrees[i] = 1;
+            for (int round = 0; round < count; round++) {
+                for (int i = 0; i < count; i++) {
+                    for (int j = 0; j < count; j++) {
+                        if ((depends[i] & ((uint64_t)1 << j)) && degrees[j] + 1 > degrees[i]) {
+                            degrees[i] = degrees[j] + 1;
+                        }
+                    }
+                }
+            }
+            for (int i = 0; i < count; i++) {
+                if (degrees[i] > degree) degree = degrees[i];
+            }
+            form = (ClosedForm*)malloc(sizeof(ClosedForm) + sizeof(int) * (size_t)count);
+            form->degree = degree;
+            form->count = count;
+            memcpy(form->slots, written, sizeof(int) * (size_t)count);
+        }
+    }
+    for (int i = 0; i < count; i++) index[written[i]] = -1;
+    return form;
+}
+
+typedef struct {
+    uint32_t node;
+    int leaving;       // a loop whose nested loops have all been seen
+} HeightFrame;
+
+// Annotates the loops bottom-up on a heap stack. open[] holds, for each
+// loop being walked, the most levels of loops seen inside it so far.
+static int passClosedForms(TreeNode* program) {
+    int changes = 0;
+    int* index = (int*)malloc(sizeof(int) * ((size_t)symbol_count + 1));
+    for (int i = 0; i <= symbol_count; i++) index[i] = -1;
+    int* open = NULL;
+    uint32_t openCount = 0, openCapacity = 0;
+    HeightFrame* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (HeightFrame*)growArray(stack, &capacity, 1, sizeof(HeightFrame));
+    stack[depth++] = (HeightFrame){(uint32_t)(program - ast.nodes), 0};
+    while (depth > 0) {
+        HeightFrame frame = stack[--depth];
+        TreeNode* node = &ast.nodes[frame.node];
+        if (frame.leaving) {
+            int height = open[--openCount] + 1;
+            if (openCount > 0 && height > open[openCount - 1]) open[openCount - 1] = height;
+            LoopInfo* info = loopInfo(node);
+            ClosedForm* form = height <= CLOSED_MAX_DEPTH ? analyzeLoop(node, index) : NULL;
+            int before = info->closed ? info->closed->degree : -1;
+            int after = form ? form->degree : -1;
+            if (before != after || (form && form->count != info->closed->count)) changes++;
+            free(info->closed);
+            info->closed = form;
+            continue;
+        }
+        stack = (HeightFrame*)growArray(stack, &capacity, depth + (uint32_t)node->child_count + 1, sizeof(HeightFrame));
+        if (node->type == NODE_LOOP) {
+            open = (int*)growArray(open, &openCapacity, openCount + 1, sizeof(int));
+            open[openCount++] = 0;
+            stack[depth++] = (HeightFrame){frame.node, 1};
+        }
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[depth++] = (HeightFrame){ast.children[node->first_child + (uint32_t)i], 0};
+        }
+    }
+    free(stack);
+    free(open);
+    free(index);
+    return changes;
+}
+
+// C(n, k) for n > k, 0 when it does not fit a long long
+static long long binomialExact(long long n, int k) {
+    unsigned __int128 value = 1;
+    for (int i = 0; i < k; i++) {
+        // C(n, i) * (n - i) is divisible by i + 1
+        value = value * (unsigned __int128)(n - i) / (unsigned)(i + 1);
+        if (value > LLONG_MAX) return 0;
+    }
+    return (long long)value;
+}
+
+// Runs loop to its final state without iterating when that is cheaper.
+// Returns the number of iterations still to run the ordinary way.
+static long long runClosedForm(TreeNode* loop, long long count) {
+    ClosedForm* form = loopInfo(loop)->closed;
+    if (!form || count <= form->degree) return count;
+    int degree = form->degree;
+    int n = form->count;
+    size_t cells = (size_t)(degree + 1) * (size_t)n;
+    long long* table = (long long*)malloc(sizeof(long long) * (cells * 2 + (size_t)n + 1));
+    long long* delta = table + cells;
+    long long* result = delta + cells;
+    BigNum* bigTable = NULL;
+
+    // f(0) .. f(degree), the values after that many iterations
+    for (int j = 0; j <= degree; j++) {
+        if (j > 0) executeStatement(childAt(loop, 1));
+        for (int w = 0; w < n; w++) {
+            long long value = slots[form->slots[w]];
+            table[j * n + w] = value;
+            if (value == BIG_TAG) {
+                if (!bigTable) bigTable = (BigNum*)calloc(cells, sizeof(BigNum));
+                bigCopy(&bigTable[j * n + w], &bigs[form->slots[w]]);
+            }
+        }
+    }
+    // Forward differences: delta[j] is delta^j f(0). Then f(count) is the sum
+    // of C(count, j) * delta[j], all in long longs unless something overflows.
+    int exact = !bigTable;
+    if (exact) memcpy(delta, table, sizeof(long long) * cells);
+    for (int j = 1; j <= degree && exact; j++) {
+        for (int i = degree; i >= j; i--) {
+            for (int w = 0; w < n; w++) {
+                long long* cell = &delta[i * n + w];
+                if (__builtin_sub_overflow(*cell, cell[-n], cell)) exact = 0;
+            }
+        }
+    }
+    for (int w = 0; w < n && exact; w++) result[w] = 0;
+    for (int j = 0; j <= degree && exact; j++) {
+        long long binomial = binomialExact(count, j);
+        if (binomial == 0) exact = 0;
+        for (int w = 0; w < n && exact; w++) {
+            long long term;
+            if (__builtin_mul_overflow(binomial, delta[j * n + w], &term) ||
+                __builtin_add_overflow(result[w], term, &result[w])) exact = 0;
+        }
+    }
+    for (int w = 0; w < n && exact; w++) {
+        if (!isSmall(result[w])) exact = 0;
+    }
+    if (exact) {
+        for (int w = 0; w < n; w++) slots[form->slots[w]] = result[w];
+    } else {
+        closedFormBig(form, count, table, bigTable);
+    }
+    if (bigTable) {
+        for (size_t i = 0; i < cells; i++) free(bigTable[i].limbs);
+        free(bigTable);
+    }
+    free(table);
+    return 0;
+}
+
+static const OptPass optPasses[] = {
+    {"constant-propagation", 1, passConstants},
+    {"dead-store-elimination", 2, passDeadStores},
+    {"write-coalescing", 1, passCoalesceWrites},
+    {"closed-form-loops", 1, passClosedForms},
+};
+
+// Runs the passes enabled at level, repeating the pipeline at -O2 until it
+// stops changing the program. With dump set, prints the tree after each pass.
+static int optimizeProgram(TreeNode* program, int level, int dump) {
+    int total = 0;
+    int rounds = level >= 2 ? 8 : 1;
+    for (int round = 1; round <= rounds; round++) {
+        int changes = 0;
+        for (size_t p = 0; p < sizeof(optPasses) / sizeof(optPasses[0]); p++) {
+            if (optPasses[p].level > level) continue;
+            int n = optPasses[p].run(program);
+            changes += n;
+            if (dump) {
+                printf("=== AFTER %s (round %d, %d changes) ===\n", optPasses[p].name, round, n);
+                if (n > 0) printParseTree(program, 0);
+            }
+        }
+        total += changes;
+        if (changes == 0) break;
+    }
+    return total;
+}
+
+// Output sink
+//
+// write statements fill one reusable buffer that goes out with write(2),
+// without stdio's locking and format parsing. Literals long enough not to be
+// worth copying are sent straight from the string pool, together with the
+// buffered bytes, in a single writev(2).
+#define SINK_BUFFER_SIZE 65536
+#define SINK_DIRECT_SIZE 4096
+
+static const char digitPairs[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static void sinkSend(int fd, const char* a, size_t aLength, const char* b, size_t bLength) {
+#ifdef _WIN32
+    const char* parts[2] = {a, b};
+    size_t lengths[2] = {aLength, bLength};
+    for (int i = 0; i < 2; i++) {
+        while (lengths[i] > 0) {
+            int n = _write(fd, parts[i], lengths[i] > INT_MAX ? INT_MAX : (unsigned)lengths[i]);
+            if (n <= 0) return;
+            parts[i] += n;
+            lengths[i] -= (size_t)n;
+        }
+    }
+#else
+    struct iovec parts[2] = {{(void*)a, aLength}, {(void*)b, bLength}};
+    struct iovec* part = parts;
+    int count = 2;
+    while (count > 0) {
+        if (part->iov_len == 0) {
+            part++;
+            count--;
+            continue;
+        }
+        ssize_t n = writev(fd, part, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;  // like stdio, output errors are not fatal
+        }
+        // Partial write: skip what went out and retry the rest
+        while (n > 0) {
+            size_t step = (size_t)n < part->iov_len ? (size_t)n : part->iov_len;
+            part->iov_base = (char*)part->iov_base + step;
+            part->iov_len -= step;
+            n -= (ssize_t)step;
+            if (part->iov_len == 0) {
+                part++;
+                count--;
+            }
+        }
+    }
+#endif
+}
+
+#ifndef _WIN32
+static void execHandOff(const char* a, size_t aLength, const char* b, size_t bLength);
+#endif
+
+// Sends the buffer and then text, and copies both to copy_fd if it has room
+static void sinkDeliver(OutputSink* sink, const char* text, size_t length) {
+#ifndef _WIN32
+    if (sink->policy == FLUSH_REGION) {
+        execHandOff(sink->data, sink->used, text, length);
+        sink->used = 0;
+        return;
+    }
+#endif
+    if (sink->framed) {
+        char header[32];
+        int headerLength = snprintf(header, sizeof(header), "D %zu\n", sink->used + length);
+        sinkSend(sink->fd, header, (size_t)headerLength, NULL, 0);
+    }
+    sinkSend(sink->fd, sink->data, sink->used, text, length);
+    if (sink->sent == 0) sink->first_sent = nowSeconds();
+    sink->sent += sink->used + length;
+    if (sink->copy_fd >= 0) {
+        if (sink->used + length <= sink->copy_room) {
+            sinkSend(sink->copy_fd, sink->data, sink->used, text, length);
+            sink->copy_room -= sink->used + length;
+        } else {
+            sink->copy_fd = -1;
+        }
+    }
+    sink->used = 0;
+}
+
+static void sinkFlush(OutputSink* sink) {
+    if (sink->used > 0) sinkDeliver(sink, NULL, 0);
+}
+
+// Sends what is buffered to the old destination, then switches
+static void sinkRedirect(OutputSink* sink, int fd, FlushPolicy policy) {
+    sinkFlush(sink);
+    sink->fd = fd;
+    sink->policy = policy;
+}
+
+// --max-output: cuts the output off right at the limit and stops the run
+static void sinkOverLimit(OutputSink* sink) {
+    sink->used = (size_t)(governor.max_output - sink->sent);
+    // On the command line the output so far goes out before the message
+    if (!error_trap) sinkFlush(sink);
+    fatal("Error: Output limit of %llu bytes exceeded\n", governor.max_output);
+}
+
+// Every write checks the limit before anything can be flushed past it
+static inline void sinkCheckLimit(OutputSink* sink) {
+    if (__builtin_expect(governor.max_output > 0, 0) && sink->sent + sink->used > governor.max_output) {
+        sinkOverLimit(sink);
+    }
+}
+
+// Makes room for length more bytes: flushes, or grows when flushing is
+// only allowed at exit (or the buffer was never allocated)
+static void sinkReserve(OutputSink* sink, size_t length) {
+    if (sink->capacity - sink->used >= length) return;
+    if (sink->policy != FLUSH_EXIT) sinkFlush(sink);
+    size_t capacity = sink->capacity ? sink->capacity : SINK_BUFFER_SIZE;
+    while (capacity - sink->used < length) capacity *= 2;
+    if (capacity != sink->capacity) {
+        sink->data = (char*)realloc(sink->data, capacity);
+        sink->capacity = capacity;
+    }
+}
+
+static void sinkWrite(OutputSink* sink, const char* text, size_t length) {
+    if (length >= SINK_DIRECT_SIZE && sink->policy != FLUSH_EXIT &&
+        (!governor.max_output || sink->sent + sink->used + length <= governor.max_output)) {
+        sinkDeliver(sink, text, length);
+        return;
+    }
+    sinkReserve(sink, length);
+    memcpy(sink->data + sink->used, text, length);
+    sink->used += length;
+    sinkCheckLimit(sink);
+    if (sink->policy == FLUSH_LINE && memchr(text, '\n', length)) sinkFlush(sink);
+}
+
+static void sinkPutc(OutputSink* sink, char c) {
+    sinkReserve(sink, 1);
+    sink->data[sink->used++] = c;
+    sinkCheckLimit(sink);
+    if (sink->policy == FLUSH_LINE && c == '\n') sinkFlush(sink);
+}
+
+// Decimal formatting two digits at a time, straight into the buffer
+static void sinkWriteInt(OutputSink* sink, long long value) {
+    char text[24];
+    char* p = text + sizeof(text);
+    unsigned long long n = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    while (n >= 100) {
+        unsigned pair = (unsigned)(n % 100) * 2;
+        n /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (n >= 10) {
+        *--p = digitPairs[n * 2 + 1];
+        *--p = digitPairs[n * 2];
+    } else {
+        *--p = (char)('0' + n);
+    }
+    if (value < 0) *--p = '-';
+    size_t length = (size_t)(text + sizeof(text) - p);
+    sinkReserve(sink, length);
+    memcpy(sink->data + sink->used, p, length);
+    sink->used += length;
+    sinkCheckLimit(sink);
+}
+
+// Arbitrary precision numbers
+//
+// Variables stay plain long longs until an addition or subtraction
+// overflows. The exact result then goes to bigs[slot] and the slot holds
+// BIG_TAG; a big result that fits again goes back into the slot.
+enum { BIG_LEFT, BIG_RIGHT, BIG_RESULT, BIG_LITERAL, BIG_SCRATCH };
+static THREAD_LOCAL BigNum big_scratch[BIG_SCRATCH];
+
+#define BIG_DECIMAL_DIGITS 19
+#define BIG_DECIMAL_BASE 10000000000000000000ULL   // 10^19, the largest power of ten in a limb
+
+static void bigReserve(BigNum* big, uint32_t count) {
+    if (count <= big->capacity) return;
+    uint32_t capacity = big->capacity ? big->capacity : 4;
+    while (capacity < count) capacity *= 2;
+    big->limbs = (uint64_t*)realloc(big->limbs, sizeof(uint64_t) * capacity);
+    if (!big->limbs) fatal("Error: Out of memory\n");
+    big->capacity = capacity;
+}
+
+static void bigTrim(BigNum* big) {
+    while (big->count > 0 && big->limbs[big->count - 1] == 0) big->count--;
+    if (big->count == 0) big->negative = 0;
+}
+
+static void bigSetInt(BigNum* big, long long value) {
+    bigReserve(big, 1);
+    big->negative = value < 0;
+    big->limbs[0] = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    big->count = 1;
+    bigTrim(big);
+}
+
+static void bigCopy(BigNum* to, const BigNum* from) {
+    bigReserve(to, from->count);
+    if (from->count) memcpy(to->limbs, from->limbs, sizeof(uint64_t) * from->count);
+    to->count = from->count;
+    to->negative = from->negative;
+}
+
+static int bigToSmall(const BigNum* big, long long* value) {
+    if (big->count > 1) return 0;
+    uint64_t magnitude = big->count ? big->limbs[0] : 0;
+    if (magnitude > (uint64_t)SMALL_LIMIT || (magnitude == (uint64_t)SMALL_LIMIT && !big->negative)) return 0;
+    *value = big->negative ? -(long long)magnitude : (long long)magnitude;
+    return 1;
+}
+
+static int bigCompareMagnitude(const BigNum* a, const BigNum* b) {
+    if (a->count != b->count) return a->count < b->count ? -1 : 1;
+    for (uint32_t i = a->count; i-- > 0;) {
+        if (a->limbs[i] != b->limbs[i]) return a->limbs[i] < b->limbs[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// result = a + b, or a - b. result must not be a or b.
+static void bigAdd(BigNum* result, const BigNum* a, const BigNum* b, int subtract) {
+    int aNegative = a->negative;
+    int bNegative = b->negative ^ (subtract && b->count);
+    int same = aNegative == bNegative;
+    // a gets the larger magnitude, and with it the sign of the result
+    if (same ? a->count < b->count : bigCompareMagnitude(a, b) < 0) {
+        const BigNum* swap = a;
+        a = b;
+        b = swap;
+        aNegative = bNegative;
+    }
+    bigReserve(result, a->count + 1);
+    const uint64_t* x = a->limbs;
+    const uint64_t* y = b->limbs;
+    uint64_t* z = result->limbs;
+    uint64_t carry = 0;
+    uint32_t i = 0;
+    if (same) {
+        for (; i < b->count; i++) {
+            unsigned __int128 sum = (unsigned __int128)x[i] + y[i] + carry;
+            z[i] = (uint64_t)sum;
+            carry = (uint64_t)(sum >> 64);
+        }
+        for (; i < a->count; i++) {
+            z[i] = x[i] + carry;
+            carry = z[i] < carry;
+        }
+    } else {
+        for (; i < b->count; i++) {
+            uint64_t difference = x[i] - y[i] - carry;
+            carry = x[i] < y[i] || (x[i] == y[i] && carry);
+            z[i] = difference;
+        }
+        for (; i < a->count; i++) {
+            z[i] = x[i] - carry;
+            carry = x[i] < carry;
+        }
+    }
+    result->count = a->count;
+    if (carry) result->limbs[result->count++] = carry;
+    result->negative = aNegative;
+    bigTrim(result);
+}
+
+// result = a * b. result must not be a or b.
+static void bigMultiply(BigNum* result, const BigNum* a, const BigNum* b) {
+    uint32_t count = a->count + b->count;
+    bigReserve(result, count ? count : 1);
+    memset(result->limbs, 0, sizeof(uint64_t) * count);
+    for (uint32_t i = 0; i < a->count; i++) {
+        uint64_t carry = 0;
+        for (uint32_t j = 0; j < b->count; j++) {
+            unsigned __int128 product = (unsigned __int128)a->limbs[i] * b->limbs[j] + result->limbs[i + j] + carry;
+            result->limbs[i + j] = (uint64_t)product;
+            carry = (uint64_t)(product >> 64);
+        }
+        result->limbs[i + b->count] = carry;
+    }
+    result->count = count;
+    result->negative = a->negative ^ b->negative;
+    bigTrim(result);
+}
+
+// |big| = |big| * factor + addend
+static void bigMultiplyAdd(BigNum* big, uint64_t factor, uint64_t addend) {
+    uint64_t carry = addend;
+    for (uint32_t i = 0; i < big->count; i++) {
+        unsigned __int128 product = (unsigned __int128)big->limbs[i] * factor + carry;
+        big->limbs[i] = (uint64_t)product;
+        carry = (uint64_t)(product >> 64);
+    }
+    if (carry) {
+        bigReserve(big, big->count + 1);
+        big->limbs[big->count++] = carry;
+    }
+    bigTrim(big);
+}
+
+// |big| /= divisor, returns the remainder
+static uint64_t bigDivideSmall(BigNum* big, uint64_t divisor) {
+    unsigned __int128 remainder = 0;
+    for (uint32_t i = big->count; i-- > 0;) {
+        unsigned __int128 part = (remainder << 64) | big->limbs[i];
+        big->limbs[i] = (uint64_t)(part / divisor);
+        remainder = part % divisor;
+    }
+    bigTrim(big);
+    return (uint64_t)remainder;
+}
+
+// An optionally signed run of decimal digits, 19 digits per multiplication
+static void bigFromDecimal(BigNum* big, const char* text) {
+    int negative = *text == '-';
+    if (*text == '-' || *text == '+') text++;
+    big->count = 0;
+    while (*text) {
+        uint64_t chunk = 0, scale = 1;
+        for (int i = 0; i < BIG_DECIMAL_DIGITS && *text; i++, text++) {
+            chunk = chunk * 10 + (uint64_t)(*text - '0');
+            scale *= 10;
+        }
+        bigMultiplyAdd(big, scale, chunk);
+    }
+    big->negative = negative && big->count;
+}
+
+// Splits off 19 digits per division, so n limbs take about n * n divisions
+static void sinkWriteBig(OutputSink* sink, const BigNum* big) {
+    BigNum* work = &big_scratch[BIG_RESULT];
+    bigCopy(work, big);
+    uint64_t* chunks = (uint64_t*)malloc(sizeof(uint64_t) * ((size_t)big->count * 2 + 1));
+    size_t count = 0;
+    do {
+        chunks[count++] = bigDivideSmall(work, BIG_DECIMAL_BASE);
+    } while (work->count > 0);
+    char first[24];
+    int length = snprintf(first, sizeof(first), "%s%llu", big->negative ? "-" : "",
+                          (unsigned long long)chunks[count - 1]);
+    sinkReserve(sink, (size_t)length + (count - 1) * BIG_DECIMAL_DIGITS);
+    char* p = sink->data + sink->used;
+    memcpy(p, first, (size_t)length);
+    p += length;
+    for (size_t i = count - 1; i-- > 0;) {
+        uint64_t chunk = chunks[i];
+        for (int d = BIG_DECIMAL_DIGITS - 1; d >= 0; d--) {
+            p[d] = (char)('0' + chunk % 10);
+            chunk /= 10;
+        }
+        p += BIG_DECIMAL_DIGITS;
+    }
+    sink->used = (size_t)(p - sink->data);
+    free(chunks);
+    sinkCheckLimit(sink);
+}
+
+// Makes bigs[] cover count slots. executeParallel() does this up front, as
+// its workers share the array.
+static void bigsReserve(uint32_t count) {
+    if (count <= big_capacity) return;
+    uint32_t capacity = big_capacity ? big_capacity : 64;
+    while (capacity < count) capacity *= 2;
+    bigs = (BigNum*)realloc(bigs, sizeof(BigNum) * capacity);
+    if (!bigs) fatal("Error: Out of memory\n");
+    memset(bigs + big_capacity, 0, sizeof(BigNum) * (capacity - big_capacity));
+    big_capacity = capacity;
+}
+
+static void bigScratchRelease() {
+    for (int i = 0; i < BIG_SCRATCH; i++) {
+        free(big_scratch[i].limbs);
+        memset(&big_scratch[i], 0, sizeof(BigNum));
+    }
+}
+
+// The value of a number or variable operand, for the slow paths
+static const BigNum* bigOperand(TreeNode* value) {
+    BigNum* big = &big_scratch[BIG_LITERAL];
+    if (value->type == NODE_VARIABLE) {
+        if (slots[value->slot] == BIG_TAG) return &bigs[value->slot];
+        bigSetInt(big, slots[value->slot]);
+    } else if (value->type == NODE_NUMBER && value->number == BIG_TAG) {
+        bigFromDecimal(big, atomText(value->atom));
+    } else {
+        bigSetInt(big, value->type == NODE_NUMBER ? value->number : 0);
+    }
+    return big;
+}
+
+// slots[slot] = value. Takes over value's limbs when it stays big.
+static void bigStore(int slot, BigNum* value) {
+    long long small;
+    if (bigToSmall(value, &small)) {
+        slots[slot] = small;
+        return;
+    }
+    bigsReserve((uint32_t)slot + 1);
+    BigNum swap = bigs[slot];
+    bigs[slot] = *value;
+    *value = swap;
+    slots[slot] = BIG_TAG;
+}
+
+static void bigAssign(int target, const BigNum* value) {
+    bigCopy(&big_scratch[BIG_RESULT], value);
+    bigStore(target, &big_scratch[BIG_RESULT]);
+}
+
+// slots[target] += or -= value when that does not fit a long long. big is
+// the operand's value when value is BIG_TAG.
+static void bigUpdate(int target, long long value, const BigNum* big, int subtract) {
+    const BigNum* left = &bigs[target];
+    if (slots[target] != BIG_TAG) {
+        bigSetInt(&big_scratch[BIG_LEFT], slots[target]);
+        left = &big_scratch[BIG_LEFT];
+    }
+    if (value != BIG_TAG) {
+        bigSetInt(&big_scratch[BIG_RIGHT], value);
+        big = &big_scratch[BIG_RIGHT];
+    }
+    bigAdd(&big_scratch[BIG_RESULT], left, big, subtract);
+    bigStore(target, &big_scratch[BIG_RESULT]);
+}
+
+// Iteration count for a loop count that does not fit a long long
+static long long bigCount(const BigNum* big) {
+    return big->negative ? 0 : LLONG_MAX;
+}
+
+// runClosedForm() when the result does not fit long longs. table holds
+// f(0) .. f(degree), with BIG_TAG entries taken from bigTable.
+static void closedFormBig(const ClosedForm* form, long long count, const long long* table, BigNum* bigTable) {
+    int degree = form->degree;
+    int n = form->count;
+    size_t cells = (size_t)(degree + 1) * (size_t)n;
+    BigNum* delta = (BigNum*)calloc(cells + 4, sizeof(BigNum));
+    BigNum* binomial = &delta[cells];
+    BigNum* product = &delta[cells + 1];
+    BigNum* sum = &delta[cells + 2];
+    BigNum* total = &delta[cells + 3];
+    for (size_t i = 0; i < cells; i++) {
+        if (table[i] == BIG_TAG) bigCopy(&delta[i], &bigTable[i]);
+        else bigSetInt(&delta[i], table[i]);
+    }
+    for (int j = 1; j <= degree; j++) {
+        for (int i = degree; i >= j; i--) {
+            for (int w = 0; w < n; w++) {
+                BigNum* cell = &delta[i * n + w];
+                bigAdd(sum, cell, cell - n, 1);
+                BigNum swap = *cell;
+                *cell = *sum;
+                *sum = swap;
+            }
+        }
+    }
+    for (int w = 0; w < n; w++) {
+        total->count = 0;
+        total->negative = 0;
+        bigSetInt(binomial, 1);
+        for (int j = 0; j <= degree; j++) {
+            bigMultiply(product, binomial, &delta[j * n + w]);
+            bigAdd(sum, total, product, 0);
+            BigNum swap = *total;
+            *total = *sum;
+            *sum = swap;
+            bigMultiplyAdd(binomial, (uint64_t)(count - j), 0);
+            bigDivideSmall(binomial, (uint64_t)j + 1);
+        }
+        bigStore(form->slots[w], total);
+    }
+    for (size_t i = 0; i < cells + 4; i++) free(delta[i].limbs);
+    free(delta);
+}
+
+static inline void sinkWriteSlot(OutputSink* sink, int slot) {
+    if (slots[slot] == BIG_TAG) sinkWriteBig(sink, &bigs[slot]);
+    else sinkWriteInt(sink, slots[slot]);
+}
+
+// Resource governor
+//
+// The engines count steps in governor.fuel at loop back edges: the tree
+// walker an iteration plus the statements of its body, the VM its
+// instructions. Top-level statements outside loops are bounded by the
+// program's size and are not counted. Only when a slice of steps is used
+// up does governorTick() look at the step limit and the clock, so a run
+// pays a subtract and a branch per iteration. The output sink checks
+// max_output on every write instead, so output stops right at the limit.
+// Compiled loops have no back edge checks, so the JIT is off under a
+// governor.
+static void governorRefill() {
+    governor.fuel = governor.slice;
+    // The last slice ends right at the step limit
+    if (governor.max_steps > 0 && governor.max_steps - governor.steps < (unsigned long long)governor.fuel) {
+        governor.fuel = (long long)(governor.max_steps - governor.steps);
+    }
+    governor.granted = governor.fuel;
+}
+
+// Limits from options; preempt ends every slice in ppp_resume()
+static void governorStart(const PppOptions* options, int preempt) {
+    Governor fresh = {LLONG_MAX, LLONG_MAX, LLONG_MAX, 0, options->max_steps, options->max_output,
+                      options->max_seconds, 0, preempt};
+    if (preempt || options->max_steps > 0 || options->max_output > 0 || options->max_seconds > 0) {
+        fresh.slice = options->slice_steps > 0 && options->slice_steps < LLONG_MAX ?
+                      (long long)options->slice_steps : GOVERNOR_SLICE;
+    }
+    if (options->max_seconds > 0) fresh.deadline = nowSeconds() + options->max_seconds;
+    governor = fresh;
+    governorRefill();
+}
+
+static inline int governorActive() {
+    return governor.slice != LLONG_MAX;
+}
+
+// Steps run so far
+static unsigned long long governorSteps() {
+    return governor.steps + (unsigned long long)(governor.granted - governor.fuel);
+}
+
+// Called when the fuel runs out: stops the run with an error if it is past
+// a limit, else starts the next slice. Returns 1 when the run should go
+// back to ppp_resume().
+static int governorTick() {
+    governor.steps = governorSteps();
+    int steps = governor.max_steps > 0 && governor.steps > governor.max_steps;
+    int time = governor.deadline > 0 && nowSeconds() > governor.deadline;
+    if (steps || time) {
+        // On the command line the output so far goes out before the message
+        if (!error_trap) sinkFlush(&programOutput);
+        if (steps) fatal("Error: Step limit of %llu exceeded\n", governor.max_steps);
+        fatal("Error: Time limit of %g s exceeded\n", governor.max_seconds);
+    }
+    governorRefill();
+    return governor.preempt;
+}
+
+// Simple interpreter functions
+static long long getValue(TreeNode* node) {
+    if (node->type == NODE_NUMBER) {
+        return node->number;
+    } else if (node->type == NODE_VARIABLE) {
+        return slots[node->slot];
+    }
+    return 0;
+}
+
+// Loops with a count past LLONG_MAX run for good, negative ones not at all
+static long long loopCount(TreeNode* node) {
+    long long count = getValue(node);
+    return count == BIG_TAG ? bigCount(bigOperand(node)) : count;
+}
+
+// slots[target] += or -= value, exactly
+static inline void updateSlot(int target, TreeNode* value, int subtract) {
+    long long operand = getValue(value), result;
+    if (__builtin_expect(isSmall(operand) && smallAdd(slots[target], operand, subtract, &result), 1)) {
+        slots[target] = result;
+    } else {
+        bigUpdate(target, operand, operand == BIG_TAG ? bigOperand(value) : NULL, subtract);
+    }
+}
+
+// Runs a statement that contains no other statements
+static inline void executeFlat(TreeNode* node) {
+    switch (node->type) {
+        case NODE_DECLARATION: {
+            // Slots are allocated up front and start at 0
+            break;
+        }
+        case NODE_ASSIGNMENT: {
+            if (node->child_count >= 2) {
+                TreeNode* value = childAt(node, 1);
+                long long operand = getValue(value);
+                if (isSmall(operand)) slots[childAt(node, 0)->slot] = operand;
+                else bigAssign(childAt(node, 0)->slot, bigOperand(value));
+            }
+            break;
+        }
+        case NODE_INCREMENT: {
+            if (node->child_count >= 2) {
+                updateSlot(childAt(node, 0)->slot, childAt(node, 1), 0);
+            }
+            break;
+        }
+        case NODE_DECREMENT: {
+            if (node->child_count >= 2) {
+                updateSlot(childAt(node, 0)->slot, childAt(node, 1), 1);
+            }
+            break;
+        }
+        case NODE_WRITE: {
+            for (int i = 0; i < node->child_count; i++) {
+                TreeNode* child = childAt(node, i);
+                if (child->type == NODE_STRING) {
+                    sinkWrite(&programOutput, atomText(child->atom), atomLength(child->atom));
+                } else if (child->type == NODE_VARIABLE) {
+                    sinkWriteSlot(&programOutput, child->slot);
+                } else if (child->type == NODE_NEWLINE) {
+                    sinkPutc(&programOutput, '\n');
+                }
+            }
+            break;
+        }
+        // Eksik olan durumlar için default case veya explicit cases
+        case NODE_PROGRAM:
+        case NODE_VARIABLE:
+        case NODE_NUMBER:
+        case NODE_STRING:
+        case NODE_NEWLINE:
+        default:
+            // Bu node türleri executeStatement'te doğrudan işlenmez
+            // Bunlar diğer node'ların çocukları olarak işlenir
+            break;
+    }
+}
+
+// A loop or block being run by executeStatement(). The body is a range of
+// ast.children: the block's statements, or the loop's single statement.
+typedef struct {
+    TreeNode* loop;          // NULL for a block outside a loop
+    long long next;          // iterations started
+    long long count;
+    uint32_t body;
+    int body_count;
+    int position;            // next statement of the body
+} ExecFrame;
+
+static THREAD_LOCAL ExecFrame* exec_stack = NULL;
+static THREAD_LOCAL uint32_t exec_depth = 0;
+static THREAD_LOCAL uint32_t exec_capacity = 0;
+
+static void execEnter(TreeNode* node) {
+    long long count = 1;
+    if (node->type == NODE_LOOP) {
+        if (node->child_count < 1) return;
+        count = loopCount(childAt(node, 0));
+        // Accumulator loops jump straight to their final values
+        if (loopInfo(node)->closed) count = runClosedForm(node, count);
+        if (count <= 0) return;
+    } else if (node->child_count == 0) {
+        return;
+    }
+    if (exec_depth == exec_capacity) {
+        exec_capacity = exec_capacity ? exec_capacity * 2 : 64;
+        exec_stack = (ExecFrame*)realloc(exec_stack, sizeof(ExecFrame) * exec_capacity);
+        if (!exec_stack) fatal("Error: Out of memory\n");
+    }
+    ExecFrame* frame = &exec_stack[exec_depth++];
+    frame->loop = NULL;
+    frame->next = 0;
+    frame->count = count;
+    frame->body = node->first_child;
+    frame->body_count = node->child_count;
+    if (node->type == NODE_LOOP) {
+        frame->loop = node;
+        frame->body_count = 0;
+        if (node->child_count > 1) {
+            TreeNode* body = childAt(node, 1);
+            frame->body = node->first_child + 1;
+            frame->body_count = 1;
+            if (body->type == NODE_BLOCK) {
+                frame->body = body->first_child;
+                frame->body_count = body->child_count;
+            }
+        }
+    }
+    frame->position = frame->body_count;   // the first iteration starts in executeStatement()
+}
+
+// Runs exec_stack down to base. Loops and blocks go on exec_stack instead
+// of the call stack, so the nesting depth is only limited by memory, and a
+// run that ppp_resume() drives (suspendable) can stop at the end of a
+// governor slice: it returns 0 then, and the next call carries on with the
+// iteration that was about to start.
+static int execRun(uint32_t base, int suspendable) {
+    while (exec_depth > base) {
+        ExecFrame* frame = &exec_stack[exec_depth - 1];
+        if (frame->position == frame->body_count) {
+            // Start the next iteration, or leave
+            TreeNode* loop = frame->loop;
+            if (frame->next == frame->count) {
+                exec_depth--;
+                continue;
+            }
+            if (loop) {
+                // Hot loops run their remaining iterations as machine code
+                if (jitThreshold > 0 && ++loopInfo(loop)->hits >= jitThreshold &&
+                    jitEnter(loop, frame->count - frame->next)) {
+                    exec_depth--;
+                    continue;
+                }
+                frame = &exec_stack[exec_depth - 1];
+            }
+            frame->next++;
+            frame->position = 0;
+            if (__builtin_expect((governor.fuel -= frame->body_count + 1) < 0, 0) &&
+                governorTick() && suspendable) {
+                return 0;
+            }
+        }
+
+        // Straight-line statements of the body, up to a nested loop or block
+        const uint32_t* body = ast.children + frame->body;
+        int position = frame->position;
+        int end = frame->body_count;
+        while (position < end) {
+            TreeNode* statement = &ast.nodes[body[position++]];
+            if (statement->type == NODE_LOOP || statement->type == NODE_BLOCK) {
+                frame->position = position;
+                execEnter(statement);
+                goto next;
+            }
+            executeFlat(statement);
+        }
+        frame->position = position;
+    next:;
+    }
+    return 1;
+}
+
+// Reentrant: the JIT and closed forms call back in for single statements
+static void executeStatement(TreeNode* node) {
+    if (!node) return;
+    if (node->type != NODE_LOOP && node->type != NODE_BLOCK) {
+        executeFlat(node);
+        return;
+    }
+    uint32_t base = exec_depth;
+    execEnter(node);
+    execRun(base, 0);
+}
+
+// executeProgram() for ppp_resume(): runs the top-level statements from
+// *next on, and returns 0 when a governor slice ends inside one of them
+static int executeSlice(TreeNode* program, int* next) {
+    if (exec_depth > 0 && !execRun(0, 1)) return 0;
+    while (*next < program->child_count) {
+        TreeNode* statement = childAt(program, (*next)++);
+        if (statement->type != NODE_LOOP && statement->type != NODE_BLOCK) {
+            executeFlat(statement);
+            continue;
+        }
+        execEnter(statement);
+        if (!execRun(0, 1)) return 0;
+    }
+    return 1;
+}
+
+// Parallel execution (--exec-threads)
+//
+// Top-level statements are grouped into regions by the variables they read
+// and write. A statement that only depends on statements of one region joins
+// that region; otherwise it starts a new region that waits for every region
+// it depends on. Regions run on a pool of threads, each in program order and
+// all on the one slots array: two regions running at the same time never
+// touch a slot that one of them writes. The output of each statement is
+// collected on its own and written out here, in program order, so stdout is
+// the same as executeProgram()'s. Worker threads have no JIT.
+//
+// A region holds at most EXEC_OUTPUT_LIMIT bytes that are not written out
+// yet; past that its worker waits for the committer. That wait ends only if
+// the region the committer is waiting on makes progress, so the region goes
+// to the front of the queue, and workers buffer without a limit until some
+// thread has started it. Once it runs the committer takes its output as it
+// comes, and it never waits for a later region.
+static int execThreads = 1;   // process wide, set by main()
+
+#ifndef _WIN32
+#define EXEC_OUTPUT_LIMIT (1u << 20)
+
+typedef struct {
+    uint32_t* statements;   // indices among the program's children, in order
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* successors;
+    uint32_t successor_count;
+    uint32_t successor_capacity;
+    int waiting;            // regions that have to finish first
+    size_t pending;         // output bytes the committer has not taken yet
+    uint32_t at;            // its index in the queue, once queued
+    int started;
+} ExecRegion;
+
+typedef struct {
+    char* data;             // output not taken by the committer yet
+    size_t size;
+    size_t capacity;
+    ExecRegion* region;
+    int ready;              // the statement has finished
+} ExecOutput;
+
+typedef struct {
+    TreeNode* program;
+    ExecRegion* regions;
+    uint32_t region_count;
+    int32_t* outputOf;      // statement -> its entry in outputs, -1 if it writes nothing
+    ExecOutput* outputs;
+    uint32_t* queue;        // regions ready to run
+    uint32_t head;
+    uint32_t tail;
+    uint32_t finished;
+    ExecRegion* committing;   // region of the statement the committer waits on
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t written;
+    pthread_cond_t drained;
+    // The running program, for the workers' thread-local copies
+    Ast ast;
+    Atom* atoms;
+    long long* slots;
+    BigNum* bigs;
+    uint32_t big_capacity;
+    // The workers' allocation counters, for --stats
+    unsigned long long allocs;
+    unsigned long long alloc_bytes;
+} ExecSchedule;
+
+typedef struct {
+    uint32_t* slots;
+    uint32_t count;
+    uint32_t capacity;
+} SlotList;
+
+static void slotListAdd(SlotList* list, uint32_t* stamps, uint32_t stamp, int slot) {
+    if (stamps[slot] == stamp) return;
+    stamps[slot] = stamp;
+    list->slots = (uint32_t*)growArray(list->slots, &list->capacity, list->count + 1, sizeof(uint32_t));
+    list->slots[list->count++] = (uint32_t)slot;
+}
+
+// Slots a statement reads and writes, and whether it writes output. walk
+// is the node stack, kept between calls.
+static int collectAccesses(const TreeNode* statement, SlotList* reads, SlotList* writes, uint32_t* readStamps,
+                           uint32_t* writeStamps, uint32_t stamp, SlotList* walk) {
+    int output = 0;
+    walk->count = 0;
+    walk->slots = (uint32_t*)growArray(walk->slots, &walk->capacity, 1, sizeof(uint32_t));
+    walk->slots[walk->count++] = (uint32_t)(statement - ast.nodes);
+    while (walk->count > 0) {
+        const TreeNode* node = &ast.nodes[walk->slots[--walk->count]];
+        switch (node->type) {
+            case NODE_ASSIGNMENT:
+            case NODE_INCREMENT:
+            case NODE_DECREMENT:
+                if (node->child_count < 2) break;
+                if (node->type != NODE_ASSIGNMENT) slotListAdd(reads, readStamps, stamp, childAt(node, 0)->slot);
+                slotListAdd(writes, writeStamps, stamp, childAt(node, 0)->slot);
+                if (childAt(node, 1)->type == NODE_VARIABLE) slotListAdd(reads, readStamps, stamp, childAt(node, 1)->slot);
+                break;
+            case NODE_WRITE:
+                output = 1;
+                for (int i = 0; i < node->child_count; i++) {
+                    if (childAt(node, i)->type == NODE_VARIABLE) slotListAdd(reads, readStamps, stamp, childAt(node, i)->slot);
+                }
+                break;
+            case NODE_LOOP:
+                if (node->child_count >= 1 && childAt(node, 0)->type == NODE_VARIABLE) {
+                    slotListAdd(reads, readStamps, stamp, childAt(node, 0)->slot);
+                }
+                if (node->child_count > 1) {
+                    walk->slots = (uint32_t*)growArray(walk->slots, &walk->capacity, walk->count + 1, sizeof(uint32_t));
+                    walk->slots[walk->count++] = ast.children[node->first_child + 1];
+                }
+                break;
+            case NODE_BLOCK:
+                walk->slots = (uint32_t*)growArray(walk->slots, &walk->capacity, walk->count + (uint32_t)node->child_count,
+                                                   sizeof(uint32_t));
+                for (int i = node->child_count - 1; i >= 0; i--) {
+                    walk->slots[walk->count++] = ast.children[node->first_child + (uint32_t)i];
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return output;
+}
+
+static void regionAdd(ExecRegion* region, uint32_t statement) {
+    region->statements = (uint32_t*)growArray(region->statements, &region->capacity, region->count + 1, sizeof(uint32_t));
+    region->statements[region->count++] = statement;
+}
+
+// Def-use pass: splits the program into regions and links them
+static void planRegions(ExecSchedule* schedule) {
+    TreeNode* program = schedule->program;
+    uint32_t statements = (uint32_t)program->child_count;
+    uint32_t slotCount = (uint32_t)symbol_count + 1;
+    uint32_t* readStamps = (uint32_t*)calloc(slotCount, sizeof(uint32_t));
+    uint32_t* writeStamps = (uint32_t*)calloc(slotCount, sizeof(uint32_t));
+    uint32_t* lastWriter = (uint32_t*)malloc(sizeof(uint32_t) * slotCount);
+    uint32_t* readerHead = (uint32_t*)malloc(sizeof(uint32_t) * slotCount);
+    memset(lastWriter, 0xFF, sizeof(uint32_t) * slotCount);
+    memset(readerHead, 0xFF, sizeof(uint32_t) * slotCount);
+    // Regions that read a slot since its last write, as linked lists
+    uint32_t* readerRegion = NULL;
+    uint32_t* readerNext = NULL;
+    uint32_t reader_count = 0, reader_capacity = 0, next_capacity = 0;
+    uint32_t* predStamps = (uint32_t*)calloc(statements + 1, sizeof(uint32_t));
+    uint32_t* preds = (uint32_t*)malloc(sizeof(uint32_t) * (statements + 1));
+    SlotList reads = {NULL, 0, 0}, writes = {NULL, 0, 0}, walk = {NULL, 0, 0};
+
+    schedule->regions = (ExecRegion*)calloc(statements + 1, sizeof(ExecRegion));
+    schedule->outputOf = (int32_t*)malloc(sizeof(int32_t) * (statements + 1));
+    uint32_t outputs = 0;
+    for (uint32_t s = 0; s < statements; s++) {
+        TreeNode* statement = childAt(program, (int)s);
+        uint32_t stamp = s + 1;
+        reads.count = writes.count = 0;
+        int output = collectAccesses(statement, &reads, &writes, readStamps, writeStamps, stamp, &walk);
+        schedule->outputOf[s] = output ? (int32_t)outputs++ : -1;
+        if (statement->type == NODE_DECLARATION) continue;   // does nothing at run time
+
+        uint32_t predCount = 0;
+        for (uint32_t i = 0; i < reads.count; i++) {
+            uint32_t writer = lastWriter[reads.slots[i]];
+            if (writer != UINT32_MAX && predStamps[writer] != stamp) {
+                predStamps[writer] = stamp;
+                preds[predCount++] = writer;
+            }
+        }
+        for (uint32_t i = 0; i < writes.count; i++) {
+            uint32_t slot = writes.slots[i];
+            if (lastWriter[slot] != UINT32_MAX && predStamps[lastWriter[slot]] != stamp) {
+                predStamps[lastWriter[slot]] = stamp;
+                preds[predCount++] = lastWriter[slot];
+            }
+            for (uint32_t r = readerHead[slot]; r != UINT32_MAX; r = readerNext[r]) {
+                if (predStamps[readerRegion[r]] != stamp) {
+                    predStamps[readerRegion[r]] = stamp;
+                    preds[predCount++] = readerRegion[r];
+                }
+            }
+        }
+
+        uint32_t region;
+        if (predCount == 1 && schedule->regions[preds[0]].successor_count == 0) {
+            region = preds[0];
+        } else {
+            region = schedule->region_count++;
+            ExecRegion* created = &schedule->regions[region];
+            created->waiting = (int)predCount;
+            for (uint32_t i = 0; i < predCount; i++) {
+                ExecRegion* pred = &schedule->regions[preds[i]];
+                pred->successors = (uint32_t*)growArray(pred->successors, &pred->successor_capacity,
+                                                        pred->successor_count + 1, sizeof(uint32_t));
+                pred->successors[pred->successor_count++] = region;
+            }
+        }
+        regionAdd(&schedule->regions[region], s);
+
+        for (uint32_t i = 0; i < reads.count; i++) {
+            uint32_t slot = reads.slots[i];
+            readerRegion = (uint32_t*)growArray(readerRegion, &reader_capacity, reader_count + 1, sizeof(uint32_t));
+            readerNext = (uint32_t*)growArray(readerNext, &next_capacity, reader_count + 1, sizeof(uint32_t));
+            readerRegion[reader_count] = region;
+            readerNext[reader_count] = readerHead[slot];
+            readerHead[slot] = reader_count++;
+        }
+        for (uint32_t i = 0; i < writes.count; i++) {
+            lastWriter[writes.slots[i]] = region;
+            readerHead[writes.slots[i]] = UINT32_MAX;
+        }
+    }
+    schedule->outputs = (ExecOutput*)calloc(outputs + 1, sizeof(ExecOutput));
+    for (uint32_t r = 0; r < schedule->region_count; r++) {
+        ExecRegion* region = &schedule->regions[r];
+        for (uint32_t i = 0; i < region->count; i++) {
+            int32_t output = schedule->outputOf[region->statements[i]];
+            if (output >= 0) schedule->outputs[output].region = region;
+        }
+    }
+
+    free(readStamps);
+    free(writeStamps);
+    free(lastWriter);
+    free(readerHead);
+    free(readerRegion);
+    free(readerNext);
+    free(predStamps);
+    free(preds);
+    free(reads.slots);
+    free(writes.slots);
+    free(walk.slots);
+}
+
+// Queues a region that has nothing left to wait for
+static void execEnqueue(ExecSchedule* schedule, uint32_t region) {
+    schedule->regions[region].at = schedule->tail;
+    schedule->queue[schedule->tail++] = region;
+}
+
+// Moves the committer's region to the front of the queue if it is queued
+static void execPrioritize(ExecSchedule* schedule) {
+    ExecRegion* region = schedule->committing;
+    if (!region || region->started || region->waiting > 0 || region->at == schedule->head) return;
+    uint32_t first = schedule->queue[schedule->head];
+    schedule->queue[region->at] = first;
+    schedule->regions[first].at = region->at;
+    schedule->queue[schedule->head] = (uint32_t)(region - schedule->regions);
+    region->at = schedule->head;
+}
+
+// The worker's schedule and the output of the statement it runs
+static THREAD_LOCAL ExecSchedule* exec_schedule = NULL;
+static THREAD_LOCAL ExecOutput* exec_output = NULL;
+
+// Delivery of a worker's output sink
+static void execHandOff(const char* a, size_t aLength, const char* b, size_t bLength) {
+    ExecSchedule* schedule = exec_schedule;
+    ExecOutput* out = exec_output;
+    size_t length = aLength + bLength;
+    if (!out || length == 0) return;
+    pthread_mutex_lock(&schedule->lock);
+    if (out->capacity - out->size < length) {
+        size_t capacity = out->capacity ? out->capacity : SINK_BUFFER_SIZE;
+        while (capacity - out->size < length) capacity *= 2;
+        out->data = (char*)realloc(out->data, capacity);
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, a, aLength);
+    if (bLength) memcpy(out->data + out->size + aLength, b, bLength);
+    out->size += length;
+    out->region->pending += length;
+    pthread_cond_signal(&schedule->written);
+    while (out->region->pending > EXEC_OUTPUT_LIMIT && schedule->committing && schedule->committing->started) {
+        pthread_cond_wait(&schedule->drained, &schedule->lock);
+    }
+    pthread_mutex_unlock(&schedule->lock);
+}
+
+static void* execWorker(void* argument) {
+    ExecSchedule* schedule = (ExecSchedule*)argument;
+    exec_schedule = schedule;
+    ast = schedule->ast;
+    atoms = schedule->atoms;
+    slots = schedule->slots;
+    bigs = schedule->bigs;
+    big_capacity = schedule->big_capacity;
+    sinkRedirect(&programOutput, -1, FLUSH_REGION);
+    for (;;) {
+        pthread_mutex_lock(&schedule->lock);
+        while (schedule->head == schedule->tail && schedule->finished < schedule->region_count) {
+            pthread_cond_wait(&schedule->work, &schedule->lock);
+        }
+        if (schedule->head == schedule->tail) {
+            pthread_mutex_unlock(&schedule->lock);
+            break;
+        }
+        ExecRegion* region = &schedule->regions[schedule->queue[schedule->head++]];
+        region->started = 1;
+        pthread_mutex_unlock(&schedule->lock);
+
+        for (uint32_t i = 0; i < region->count; i++) {
+            uint32_t statement = region->statements[i];
+            int32_t output = schedule->outputOf[statement];
+            exec_output = output >= 0 ? &schedule->outputs[output] : NULL;
+            executeStatement(childAt(schedule->program, (int)statement));
+            if (!exec_output) continue;
+            sinkFlush(&programOutput);
+            pthread_mutex_lock(&schedule->lock);
+            exec_output->ready = 1;
+            pthread_cond_signal(&schedule->written);
+            pthread_mutex_unlock(&schedule->lock);
+        }
+        exec_output = NULL;
+
+        pthread_mutex_lock(&schedule->lock);
+        schedule->finished++;
+        for (uint32_t i = 0; i < region->successor_count; i++) {
+            ExecRegion* next = &schedule->regions[region->successors[i]];
+            if (--next->waiting == 0) execEnqueue(schedule, region->successors[i]);
+        }
+        execPrioritize(schedule);
+        pthread_cond_broadcast(&schedule->work);
+        pthread_mutex_unlock(&schedule->lock);
+    }
+    free(programOutput.data);
+    free(exec_stack);
+    bigScratchRelease();
+    memset(&ast, 0, sizeof(ast));
+    atoms = NULL;
+    slots = NULL;
+    bigs = NULL;
+    pthread_mutex_lock(&schedule->lock);
+    schedule->allocs += alloc_count;
+    schedule->alloc_bytes += alloc_bytes;
+    pthread_mutex_unlock(&schedule->lock);
+    return NULL;
+}
+
+static void executeParallel(TreeNode* program) {
+    ExecSchedule schedule;
+    memset(&schedule, 0, sizeof(schedule));
+    schedule.program = program;
+    planRegions(&schedule);
+    schedule.queue = (uint32_t*)malloc(sizeof(uint32_t) * (schedule.region_count + 1));
+    for (uint32_t r = 0; r < schedule.region_count; r++) {
+        if (schedule.regions[r].waiting == 0) execEnqueue(&schedule, r);
+    }
+    schedule.ast = ast;
+    schedule.atoms = atoms;
+    schedule.slots = slots;
+    // Workers never grow bigs[], every slot has its entry already
+    bigsReserve((uint32_t)symbol_count + 1);
+    schedule.bigs = bigs;
+    schedule.big_capacity = big_capacity;
+    pthread_mutex_init(&schedule.lock, NULL);
+    pthread_cond_init(&schedule.work, NULL);
+    pthread_cond_init(&schedule.written, NULL);
+    pthread_cond_init(&schedule.drained, NULL);
+
+    int threads = execThreads < (int)schedule.region_count ? execThreads : (int)schedule.region_count;
+    pthread_t* workers = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)(threads ? threads : 1));
+    for (int t = 0; t < threads; t++) {
+        if (pthread_create(&workers[t], NULL, execWorker, &schedule) != 0) {
+            fatal("Error: Cannot start worker threads\n");
+        }
+    }
+
+    // Commit every statement's output in program order, as it comes
+    for (int s = 0; s < program->child_count; s++) {
+        int32_t output = schedule.outputOf[s];
+        if (output < 0) continue;
+        ExecOutput* out = &schedule.outputs[output];
+        pthread_mutex_lock(&schedule.lock);
+        if (schedule.committing != out->region) {
+            schedule.committing = out->region;
+            execPrioritize(&schedule);
+            pthread_cond_broadcast(&schedule.drained);
+        }
+        for (;;) {
+            while (out->size == 0 && !out->ready) pthread_cond_wait(&schedule.written, &schedule.lock);
+            if (out->size == 0) break;
+            char* data = out->data;
+            size_t size = out->size;
+            out->data = NULL;
+            out->size = out->capacity = 0;
+            out->region->pending -= size;
+            pthread_cond_broadcast(&schedule.drained);
+            pthread_mutex_unlock(&schedule.lock);
+            sinkWrite(&programOutput, data, size);
+            free(data);
+            pthread_mutex_lock(&schedule.lock);
+        }
+        pthread_mutex_unlock(&schedule.lock);
+    }
+    for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+    alloc_count += schedule.allocs;
+    alloc_bytes += schedule.alloc_bytes;
+
+    for (uint32_t r = 0; r < schedule.region_count; r++) {
+        free(schedule.regions[r].statements);
+        free(schedule.regions[r].successors);
+    }
+    pthread_mutex_destroy(&schedule.lock);
+    pthread_cond_destroy(&schedule.work);
+    pthread_cond_destroy(&schedule.written);
+    pthread_cond_destroy(&schedule.drained);
+    free(workers);
+    free(schedule.regions);
+    free(schedule.outputOf);
+    free(schedule.outputs);
+    free(schedule.queue);
+}
+#endif
+
+static void executeProgram(TreeNode* program) {
+#ifndef _WIN32
+    // The governor's counters are per thread
+    if (execThreads > 1 && jitThreshold == 0 && !governorActive()) {
+        executeParallel(program);
+        return;
+    }
+#endif
+    for (int i = 0; i < program->child_count; i++) {
+        executeStatement(childAt(program, i));
+    }
+}
+
+#ifndef PPP_LIBRARY
+// Line profiler (--profile)
+//
+// executeProfiled() is a separate walk over the tree that counts and times
+// every statement node, so executeStatement() carries no instrumentation.
+// A statement's time includes the statements nested in it; repeat has no
+// calls, so a node's call path is the chain of loops around it. Loops the
+// optimizer turned into closed forms run their body inside the loop's own
+// time, and the JIT is not used while profiling. --profile-generate runs
+// the same walk without the clock. The --max-* limits apply as in the tree
+// walker.
+typedef struct {
+    long long* counts;   // executions per node index
+    uint64_t* nanos;     // inclusive time per node index, NULL when untimed
+    long long* trips;    // iterations per loop node index
+    uint32_t node_count;
+} Profile;
+
+static THREAD_LOCAL Profile profile = {NULL, NULL, NULL, 0};
+
+static uint64_t profileClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void profileStart(int timed) {
+    free(profile.counts);
+    free(profile.nanos);
+    free(profile.trips);
+    profile.node_count = ast.node_count;
+    profile.counts = (long long*)calloc(ast.node_count, sizeof(long long));
+    profile.nanos = timed ? (uint64_t*)calloc(ast.node_count, sizeof(uint64_t)) : NULL;
+    profile.trips = (long long*)calloc(ast.node_count, sizeof(long long));
+    if (!profile.counts || (timed && !profile.nanos) || !profile.trips) {
+        fatal("Error: Out of memory\n");
+    }
+}
+
+// A block or loop being run by executeProfiled()
+typedef struct {
+    TreeNode* node;
+    long long left;      // loop iterations still to start
+    int position;        // next statement of a block
+    uint64_t start;
+} ProfileFrame;
+
+// Runs program like executeProgram(), with the loops and blocks on a heap
+// stack so any nesting depth works
+static void executeProfiled(TreeNode* program) {
+    ProfileFrame* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    TreeNode* node = program;
+    while (node || depth > 0) {
+        if (node) {
+            uint32_t index = (uint32_t)(node - ast.nodes);
+            int nested = node->type == NODE_BLOCK || node->type == NODE_PROGRAM;
+            uint64_t start = profile.nanos && !nested ? profileClock() : 0;
+            if (nested || node->type == NODE_LOOP) {
+                long long count = 0;
+                if (node->type == NODE_LOOP && node->child_count >= 1) {
+                    count = loopCount(childAt(node, 0));
+                    if (count > 0) profile.trips[index] = count > LLONG_MAX - profile.trips[index] ? LLONG_MAX : profile.trips[index] + count;
+                    if (loopInfo(node)->closed) count = runClosedForm(node, count);
+                }
+                stack = (ProfileFrame*)growArray(stack, &capacity, depth + 1, sizeof(ProfileFrame));
+                stack[depth++] = (ProfileFrame){node, count, 0, start};
+            } else {
+                executeStatement(node);
+                profile.counts[index]++;
+                if (profile.nanos) profile.nanos[index] += profileClock() - start;
+            }
+            node = NULL;
+            continue;
+        }
+        ProfileFrame* frame = &stack[depth - 1];
+        if (frame->node->type != NODE_LOOP) {
+            if (frame->position < frame->node->child_count) {
+                node = childAt(frame->node, frame->position++);
+                continue;
+            }
+            depth--;
+            continue;
+        }
+        if (frame->left > 0 && frame->node->child_count > 1) {
+            frame->left--;
+            node = childAt(frame->node, 1);
+            // Charged like execRun() does, so the --max-* limits hold
+            int statements = node->type == NODE_BLOCK ? node->child_count : 1;
+            if (__builtin_expect((governor.fuel -= statements + 1) < 0, 0)) governorTick();
+            continue;
+        }
+        uint32_t index = (uint32_t)(frame->node - ast.nodes);
+        profile.counts[index]++;
+        if (profile.nanos) profile.nanos[index] += profileClock() - frame->start;
+        depth--;
+    }
+    free(stack);
+}
+
+// Inclusive time of the statements directly nested in node
+static uint64_t nestedNanos(const TreeNode* node) {
+    uint64_t total = 0;
+    for (int i = 0; i < node->child_count; i++) {
+        const TreeNode* child = childAt(node, i);
+        if (child->type == NODE_BLOCK) total += nestedNanos(child);
+        else total += profile.nanos[child - ast.nodes];
+    }
+    return total;
+}
+
+static int isStatement(const TreeNode* node) {
+    return node->type >= NODE_DECLARATION && node->type <= NODE_LOOP;
+}
+
+typedef struct {
+    int line;
+    long long executions;
+    uint64_t selfNanos;
+    uint64_t totalNanos;   // statements not nested in another one on the same line
+} LineProfile;
+
+#define PROFILE_MAX_FRAMES 256   // statements in one folded stack
+
+typedef struct {
+    FILE* folded;
+    char* path;            // frames of the enclosing loops, ';' separated
+    uint32_t path_length;
+    uint32_t path_capacity;
+    LineProfile* lines;
+    int line_count;
+} ProfileReport;
+
+static void appendFrame(ProfileReport* report, const char* frame) {
+    uint32_t length = (uint32_t)strlen(frame);
+    report->path = (char*)growArray(report->path, &report->path_capacity, report->path_length + length + 2, 1);
+    report->path[report->path_length++] = ';';
+    memcpy(report->path + report->path_length, frame, length + 1);
+    report->path_length += length;
+}
+
+// A statement to report, or one whose nested statements have been
+typedef struct {
+    const TreeNode* node;
+    int parentLine;
+    int leaving;
+    uint32_t saved;        // path length before its frame
+} ReportFrame;
+
+// Writes one folded stack per executed statement, weighted by its self time
+// in nanoseconds, and sums up the lines. Statements nested more than
+// PROFILE_MAX_FRAMES deep share one stack ending in "...", written when the
+// statement that starts it is done, so the file stays linear in the tree.
+static void reportNodes(ProfileReport* report, const TreeNode* program) {
+    ReportFrame* stack = NULL;
+    uint32_t count = 0, capacity = 0;
+    int level = 0;               // statements on the path
+    uint64_t deep = 0;           // self time of those past the limit
+    stack = (ReportFrame*)growArray(stack, &capacity, (uint32_t)program->child_count + 1, sizeof(ReportFrame));
+    for (int i = program->child_count - 1; i >= 0; i--) stack[count++] = (ReportFrame){childAt(program, i), -1, 0, 0};
+    while (count > 0) {
+        ReportFrame frame = stack[--count];
+        const TreeNode* node = frame.node;
+        if (frame.leaving) {
+            if (level == PROFILE_MAX_FRAMES + 1 && deep > 0) {
+                fprintf(report->folded, "%s %llu\n", report->path, (unsigned long long)deep);
+                deep = 0;
+            }
+            level--;
+            report->path_length = frame.saved;
+            report->path[frame.saved] = '\0';
+            continue;
+        }
+        if (node->type == NODE_BLOCK) {
+            stack = (ReportFrame*)growArray(stack, &capacity, count + (uint32_t)node->child_count, sizeof(ReportFrame));
+            for (int i = node->child_count - 1; i >= 0; i--) {
+                stack[count++] = (ReportFrame){childAt(node, i), frame.parentLine, 0, 0};
+            }
+            continue;
+        }
+        if (!isStatement(node)) continue;
+        uint32_t index = (uint32_t)(node - ast.nodes);
+        if (profile.counts[index] == 0) continue;
+        uint64_t self = profile.nanos[index] - nestedNanos(node);
+        if (self > profile.nanos[index]) self = 0;   // clock granularity
+
+        uint32_t saved = report->path_length;
+        level++;
+        if (level <= PROFILE_MAX_FRAMES) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s:%d", nodeTypeToString(node->type), node->line_number);
+            appendFrame(report, name);
+            if (self > 0) fprintf(report->folded, "%s %llu\n", report->path, (unsigned long long)self);
+        } else {
+            if (level == PROFILE_MAX_FRAMES + 1) appendFrame(report, "...");
+            deep += self;
+        }
+
+        if (node->line_number >= 0 && node->line_number < report->line_count) {
+            LineProfile* line = &report->lines[node->line_number];
+            line->executions += profile.counts[index];
+            line->selfNanos += self;
+            if (node->line_number != frame.parentLine) line->totalNanos += profile.nanos[index];
+        }
+        stack = (ReportFrame*)growArray(stack, &capacity, count + 2, sizeof(ReportFrame));
+        stack[count++] = (ReportFrame){node, frame.parentLine, 1, saved};
+        if (node->type == NODE_LOOP && node->child_count > 1) {
+            stack[count++] = (ReportFrame){childAt(node, 1), node->line_number, 0, 0};
+        }
+    }
+    free(stack);
+}
+
+static int compareLineSelf(const void* a, const void* b) {
+    uint64_t x = ((const LineProfile*)a)->selfNanos, y = ((const LineProfile*)b)->selfNanos;
+    return (x < y) - (x > y);
+}
+
+// Prints the source text of line (1-based) or nothing if it is out of range
+static void printSourceLine(FILE* out, const SourceFile* source, int line) {
+    const char* p = source->data;
+    const char* end = source->data + source->size;
+    for (int current = 1; current < line && p < end; current++) {
+        p = memchr(p, '\n', (size_t)(end - p));
+        if (!p) return;
+        p++;
+    }
+    const char* lineEnd = memchr(p, '\n', (size_t)(end - p));
+    if (!lineEnd) lineEnd = end;
+    while (p < lineEnd && (*p == ' ' || *p == '\t')) p++;
+    while (lineEnd > p && (lineEnd[-1] == '\r' || lineEnd[-1] == ' ')) lineEnd--;
+    int length = (int)(lineEnd - p);
+    fprintf(out, "%.*s%s", length > 60 ? 60 : length, p, length > 60 ? "..." : "");
+}
+
+#define PROFILE_HOT_LINES 20
+
+static int profileReport(TreeNode* program, const char* filename, const char* foldedPath) {
+    ProfileReport report = {NULL, NULL, 0, 0, NULL, 0};
+    report.folded = fopen(foldedPath, "w");
+    if (!report.folded) {
+        fprintf(stderr, "File cannot be created: %s\n", foldedPath);
+        return 0;
+    }
+    int maxLine = 0;
+    for (uint32_t i = 0; i < ast.node_count; i++) {
+        if (ast.nodes[i].line_number > maxLine) maxLine = ast.nodes[i].line_number;
+    }
+    report.line_count = maxLine + 1;
+    report.lines = (LineProfile*)calloc((size_t)report.line_count, sizeof(LineProfile));
+    report.path_length = (uint32_t)strlen(filename);
+    report.path = (char*)growArray(NULL, &report.path_capacity, report.path_length + 1, 1);
+    memcpy(report.path, filename, report.path_length + 1);
+    reportNodes(&report, program);
+    fclose(report.folded);
+
+    // Executed lines, hottest first
+    uint64_t totalSelf = 0;
+    int hot = 0;
+    for (int line = 0; line < report.line_count; line++) {
+        totalSelf += report.lines[line].selfNanos;
+        if (report.lines[line].executions > 0) {
+            report.lines[hot] = report.lines[line];
+            report.lines[hot++].line = line;
+        }
+    }
+    qsort(report.lines, (size_t)hot, sizeof(LineProfile), compareLineSelf);
+
+    SourceFile source;
+    int haveSource = loadSource(filename, &source);
+    fprintf(stderr, "=== PROFILE: %s (folded stacks in %s) ===\n", filename, foldedPath);
+    fprintf(stderr, "%6s %14s %11s %7s %11s  %s\n", "line", "executions", "self ms", "self%", "total ms", "source");
+    for (int i = 0; i < hot && i < PROFILE_HOT_LINES; i++) {
+        const LineProfile* line = &report.lines[i];
+        fprintf(stderr, "%6d %14lld %11.3f %6.1f%% %11.3f  ", line->line, line->executions, line->selfNanos * 1e-6,
+                totalSelf ? 100.0 * (double)line->selfNanos / (double)totalSelf : 0.0, line->totalNanos * 1e-6);
+        if (haveSource) printSourceLine(stderr, &source, line->line);
+        fputc('\n', stderr);
+    }
+    if (hot > PROFILE_HOT_LINES) fprintf(stderr, "(%d more lines)\n", hot - PROFILE_HOT_LINES);
+    if (haveSource) unloadSource(&source);
+    free(report.lines);
+    free(report.path);
+    return 1;
+}
+
+// Profile feedback (--profile-generate, --profile-use)
+//
+// A training run under executeProfiled() saves how often each executed
+// statement ran and how many iterations each loop ran, keyed by source line
+// and shape. The shape hashes the node's type and its direct operands and
+// statements, variables by name but literals only by kind, so a later
+// build finds a statement again after edits around it or to its constants:
+// an entry matches the nearest statement with the same shape within
+// PGO_LINE_SLACK lines. Build with the same -O level as the training run,
+// as the optimizer changes shapes. From the loops' counts --profile-use
+//   - drops closed forms of loops that ran about as few iterations as the
+//     closed form itself costs,
+//   - has the JIT compile hot loops on entry and cold ones only after 2^30
+//     iterations; when the profile turns the JIT on for the tree walker,
+//     loops it does not know count as cold,
+//   - unrolls hot loops with a constant count and a straight-line body
+//     PGO_UNROLL times in the VM.
+// Layout:
+//   PgoHeader
+//   PgoEntry entries[count], statements in tree order
+#define PGO_MAGIC "PPGO"
+#define PGO_FORMAT 1
+#define PGO_LINE_SLACK 32
+#define PGO_HOT_TRIPS 10000   // iterations over the whole run
+#define PGO_UNROLL 4
+#define PGO_COLD_HITS (-(1 << 30))
+
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint32_t count;
+    uint32_t reserved;
+} PgoHeader;
+
+typedef struct {
+    int32_t line;
+    uint32_t shape;
+    uint64_t executions;
+    uint64_t trips;      // loops only
+} PgoEntry;
+
+typedef struct {
+    PgoEntry* entries;   // by shape, then line
+    uint32_t count;
+    int loops;
+    int matched;
+    int hot;
+    int unrolled;
+    int opened;          // closed forms dropped
+} PgoProfile;
+
+static uint32_t shapeMix(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619u;
+}
+
+static uint32_t operandShape(uint32_t hash, const TreeNode* node) {
+    hash = shapeMix(hash, (uint32_t)node->type);
+    if (node->type == NODE_VARIABLE) hash = shapeMix(hash, hashText(atomText(node->atom), (int)atomLength(node->atom)));
+    return hash;
+}
+
+static uint32_t statementShape(uint32_t hash, const TreeNode* node) {
+    hash = operandShape(hash, node);
+    hash = shapeMix(hash, (uint32_t)node->child_count);
+    for (int i = 0; i < node->child_count; i++) hash = operandShape(hash, childAt(node, i));
+    return hash;
+}
+
+// One level of the tree below the node, two for a loop's body
+static uint32_t nodeShape(const TreeNode* node) {
+    uint32_t hash = statementShape(2166136261u, node);
+    if (node->type == NODE_LOOP && node->child_count >= 2) {
+        const TreeNode* body = childAt(node, 1);
+        if (body->type != NODE_BLOCK) return statementShape(hash, body);
+        for (int i = 0; i < body->child_count; i++) hash = statementShape(hash, childAt(body, i));
+    }
+    return hash;
+}
+
+static int pgoWrite(const char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "File cannot be created: %s\n", path);
+        return 0;
+    }
+    PgoHeader header = {{'P', 'P', 'G', 'O'}, PGO_FORMAT, 0, 0};
+    for (uint32_t i = 0; i < profile.node_count; i++) {
+        if (profile.counts[i] > 0 && isStatement(&ast.nodes[i])) header.count++;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint32_t i = 0; i < profile.node_count; i++) {
+        const TreeNode* node = &ast.nodes[i];
+        if (profile.counts[i] == 0 || !isStatement(node)) continue;
+        PgoEntry entry = {node->line_number, nodeShape(node), (uint64_t)profile.counts[i], (uint64_t)profile.trips[i]};
+        fwrite(&entry, sizeof(entry), 1, out);
+    }
+    int ok = !ferror(out);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "File cannot be written: %s\n", path);
+    return ok;
+}
+
+static int comparePgoEntries(const void* a, const void* b) {
+    const PgoEntry* x = (const PgoEntry*)a;
+    const PgoEntry* y = (const PgoEntry*)b;
+    if (x->shape != y->shape) return x->shape < y->shape ? -1 : 1;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+// A missing or damaged profile only loses the feedback, so this warns
+static int pgoRead(PgoProfile* pgo, const char* path) {
+    memset(pgo, 0, sizeof(*pgo));
+    FILE* in = fopen(path, "rb");
+    PgoHeader header;
+    if (!in || fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, PGO_MAGIC, 4) != 0 || header.format != PGO_FORMAT) {
+        fprintf(stderr, "Warning: no usable profile in %s\n", path);
+        if (in) fclose(in);
+        return 0;
+    }
+    pgo->entries = (PgoEntry*)malloc(sizeof(PgoEntry) * (header.count ? header.count : 1));
+    if (!pgo->entries) fatal("Error: Out of memory\n");
+    pgo->count = (uint32_t)fread(pgo->entries, sizeof(PgoEntry), header.count, in);
+    fclose(in);
+    if (pgo->count != header.count) fprintf(stderr, "Warning: profile %s is cut short\n", path);
+    qsort(pgo->entries, pgo->count, sizeof(PgoEntry), comparePgoEntries);
+    return 1;
+}
+
+// The entry for node: same shape, nearest line within the slack
+static const PgoEntry* pgoFind(const PgoProfile* pgo, const TreeNode* node) {
+    uint32_t shape = nodeShape(node);
+    uint32_t low = 0, high = pgo->count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (pgo->entries[middle].shape < shape) low = middle + 1;
+        else high = middle;
+    }
+    const PgoEntry* best = NULL;
+    int bestDistance = PGO_LINE_SLACK + 1;
+    for (uint32_t i = low; i < pgo->count && pgo->entries[i].shape == shape; i++) {
+        int distance = abs(pgo->entries[i].line - node->line_number);
+        if (distance < bestDistance) {
+            best = &pgo->entries[i];
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+// Statements of a VM loop body that unrolling can copy: no nested loops
+static int straightLine(const TreeNode* body) {
+    if (body->type == NODE_LOOP) return 0;
+    if (body->type != NODE_BLOCK) return 1;
+    for (int i = 0; i < body->child_count; i++) {
+        const TreeNode* child = childAt(body, i);
+        if (child->type == NODE_LOOP || child->type == NODE_BLOCK) return 0;
+    }
+    return 1;
+}
+
+// Puts the profile's decisions on the loops of the optimized tree;
+// treeWalker allows turning the JIT on
+static void pgoApply(PgoProfile* pgo, int treeWalker) {
+    int requested = jitThreshold > 0;
+    for (uint32_t i = 0; i < ast.node_count; i++) {
+        TreeNode* node = &ast.nodes[i];
+        if (node->type != NODE_LOOP || node->child_count < 2) continue;
+        LoopInfo* info = loopInfo(node);
+        const PgoEntry* entry = pgoFind(pgo, node);
+        pgo->loops++;
+        if (!entry) {
+            if (!requested) info->hits = PGO_COLD_HITS;
+            continue;
+        }
+        pgo->matched++;
+        uint64_t average = entry->executions ? entry->trips / entry->executions : 0;
+        if (info->closed && average <= (uint64_t)info->closed->degree + 1) {
+            free(info->closed);
+            info->closed = NULL;
+            pgo->opened++;
+        }
+        if (entry->trips < PGO_HOT_TRIPS) {
+            info->hits = PGO_COLD_HITS;
+            continue;
+        }
+        pgo->hot++;
+        info->hits = jitThreshold > 0 ? jitThreshold - 1 : JIT_DEFAULT_THRESHOLD - 1;
+        TreeNode* count = childAt(node, 0);
+        if (!info->closed && average >= PGO_UNROLL * 4 && count->type == NODE_NUMBER &&
+            isSmall(count->number) && count->number >= PGO_UNROLL && straightLine(childAt(node, 1))) {
+            info->unroll = PGO_UNROLL;
+            pgo->unrolled++;
+        }
+    }
+    if (treeWalker && !requested && pgo->hot > 0) jitThreshold = JIT_DEFAULT_THRESHOLD;
+}
+#endif
+
+// JIT compiler (--jit)
+//
+// executeStatement() counts the iterations of every repeat loop. Once a loop
+// passes jitThreshold its body is compiled to x86-64 machine code in mmap'd
+// memory and the remaining iterations run there. Compiled code reads and
+// writes slots[] directly, so the interpreter always sees current values.
+// Statements the compiler does not handle (write, loops nested deeper than
+// the counter registers) are compiled as calls back into executeStatement().
+typedef void (*JitFunction)(long long* slots, long long count);
+
+typedef struct JitCode {
+    JitFunction entry;   // NULL when the loop could not be compiled
+    size_t size;
+    struct JitCode* next;
+} JitCode;
+
+// Out-of-line code for a statement whose operands or result do not fit a
+// long long: it runs the statement in the interpreter and jumps back
+typedef struct {
+    TreeNode* node;
+    size_t resume;
+    size_t jumps[4];   // rel32 fields of the jumps into the stub
+    int jump_count;
+} JitStub;
+
+typedef struct {
+    unsigned char* code;
+    size_t size;
+    size_t capacity;
+    int ok;
+    JitStub* stubs;
+    int stub_count;
+    int stub_capacity;
+} JitBuffer;
+
+static JitCode jitUnsupported = {NULL, 0, NULL};
+static THREAD_LOCAL JitCode* jitBlocks = NULL;
+static THREAD_LOCAL int jit_nesting = 0;
+static THREAD_LOCAL int jit_loops_compiled = 0;
+static THREAD_LOCAL size_t jit_code_bytes = 0;
+static THREAD_LOCAL double jitCompileSeconds = 0;
+
+#define JIT_COUNTER_REGISTERS 4   // r12 (compiled loop), r13-r15 (nested loops)
+#define JIT_MAX_NESTING 64        // compiled loops running inside each other
+#define JIT_MAX_SLOT 0x0FFFFFFF   // slot * 8 has to fit a disp32
+
+static void jitByte(JitBuffer* b, unsigned char value) {
+    if (b->size == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 256;
+        b->code = (unsigned char*)realloc(b->code, b->capacity);
+    }
+    b->code[b->size++] = value;
+}
+
+static void jitU32(JitBuffer* b, uint32_t value) {
+    for (int i = 0; i < 4; i++) jitByte(b, (unsigned char)(value >> (8 * i)));
+}
+
+static void jitU64(JitBuffer* b, uint64_t value) {
+    for (int i = 0; i < 8; i++) jitByte(b, (unsigned char)(value >> (8 * i)));
+}
+
+static void jitPatch32(JitBuffer* b, size_t at, int32_t value) {
+    for (int i = 0; i < 4; i++) b->code[at + i] = (unsigned char)((uint32_t)value >> (8 * i));
+}
+
+// <REX.W|rex> opcode /reg, [rbx + 8*slot]
+static void jitSlotOp(JitBuffer* b, int rex, int opcode, int reg, int slot) {
+    if (slot < 0 || slot > JIT_MAX_SLOT) {
+        b->ok = 0;
+        return;
+    }
+    jitByte(b, (unsigned char)(0x48 | rex));
+    jitByte(b, (unsigned char)opcode);
+    jitByte(b, (unsigned char)(0x80 | ((reg & 7) << 3) | 3));
+    jitU32(b, (uint32_t)slot * 8);
+}
+
+// <REX.W+B> opcode /ext, reg (r8-r15)
+static void jitRegOp(JitBuffer* b, int opcode, int ext, int reg) {
+    jitByte(b, 0x49);
+    jitByte(b, (unsigned char)opcode);
+    jitByte(b, (unsigned char)(0xC0 | (ext << 3) | (reg & 7)));
+}
+
+// Operands that are neither numbers nor variables read as 0, like getValue()
+static int jitConstant(TreeNode* value, long long* constant) {
+    if (value->type == NODE_VARIABLE) return 0;
+    *constant = value->type == NODE_NUMBER ? value->number : 0;
+    return 1;
+}
+
+// mov reg, imm64 (rax or rcx)
+static void jitLoadImm(JitBuffer* b, int reg, long long constant) {
+    jitByte(b, 0x48);
+    jitByte(b, (unsigned char)(0xB8 | reg));
+    jitU64(b, (uint64_t)constant);
+}
+
+// jo to stub, patched by jitStubs()
+static void jitOverflowJump(JitBuffer* b, JitStub* stub) {
+    jitByte(b, 0x0F);
+    jitByte(b, 0x80);
+    stub->jumps[stub->jump_count++] = b->size;
+    jitU32(b, 0);
+}
+
+// cmp reg, 1 overflows only for LLONG_MIN, so this leaves for BIG_TAG
+// (rax or rcx)
+static void jitTagCheck(JitBuffer* b, int reg, JitStub* stub) {
+    jitByte(b, (unsigned char)(0x48 | (reg >> 3)));
+    jitByte(b, 0x83);
+    jitByte(b, (unsigned char)(0xF8 | (reg & 7)));
+    jitByte(b, 1);
+    jitOverflowJump(b, stub);
+}
+
+static void jitAddStub(JitBuffer* b, JitStub* stub) {
+    stub->resume = b->size;
+    if (b->stub_count == b->stub_capacity) {
+        b->stub_capacity = b->stub_capacity ? b->stub_capacity * 2 : 16;
+        b->stubs = (JitStub*)realloc(b->stubs, sizeof(JitStub) * (size_t)b->stub_capacity);
+    }
+    b->stubs[b->stub_count++] = *stub;
+}
+
+static void jitCallInterpreter(JitBuffer* b, TreeNode* node);
+
+// Emits the stubs after the function and points their jumps at them
+static void jitStubs(JitBuffer* b) {
+    for (int i = 0; i < b->stub_count; i++) {
+        JitStub* stub = &b->stubs[i];
+        for (int j = 0; j < stub->jump_count; j++) {
+            jitPatch32(b, stub->jumps[j], (int32_t)(b->size - (stub->jumps[j] + 4)));
+        }
+        jitCallInterpreter(b, stub->node);
+        jitByte(b, 0xE9);  // jmp resume
+        jitU32(b, (uint32_t)(int32_t)(stub->resume - (b->size + 4)));
+    }
+}
+
+// slots[target] = / += / -= value in rax, with rcx for the operand. Big
+// operands and results that are not small go to the interpreter.
+static void jitUpdate(JitBuffer* b, TreeNode* node) {
+    if (node->child_count < 2) return;
+    int target = childAt(node, 0)->slot;
+    TreeNode* value = childAt(node, 1);
+    long long constant;
+    int isConstant = jitConstant(value, &constant);
+    if (isConstant && !isSmall(constant)) {
+        jitCallInterpreter(b, node);
+        return;
+    }
+    if (node->type == NODE_ASSIGNMENT && isConstant) {
+        if (constant >= INT32_MIN && constant <= INT32_MAX) {
+            jitSlotOp(b, 0, 0xC7, 0, target);  // mov qword [slot], imm32
+            jitU32(b, (uint32_t)constant);
+        } else {
+            jitLoadImm(b, 0, constant);
+            jitSlotOp(b, 0, 0x89, 0, target);  // mov [slot], rax
+        }
+        return;
+    }
+    JitStub stub = {node, 0, {0}, 0};
+    if (node->type == NODE_ASSIGNMENT) {
+        jitSlotOp(b, 0, 0x8B, 0, value->slot);  // mov rax, [value]
+        jitTagCheck(b, 0, &stub);
+    } else {
+        int subtract = node->type == NODE_DECREMENT;
+        jitSlotOp(b, 0, 0x8B, 0, target);       // mov rax, [target]
+        if (isConstant && constant >= INT32_MIN && constant <= INT32_MAX) {
+            jitByte(b, 0x48);                   // add/sub rax, imm32
+            jitByte(b, subtract ? 0x2D : 0x05);
+            jitU32(b, (uint32_t)constant);
+        } else {
+            if (isConstant) {
+                jitLoadImm(b, 1, constant);
+            } else {
+                jitSlotOp(b, 0, 0x8B, 1, value->slot);  // mov rcx, [value]
+                jitTagCheck(b, 1, &stub);
+            }
+            jitByte(b, 0x48);                   // add/sub rax, rcx
+            jitByte(b, subtract ? 0x29 : 0x01);
+            jitByte(b, 0xC8);
+        }
+        // A small operand cannot take BIG_TAG back into the small range, so
+        // checking the result also covers a big target: rax + rax overflows
+        // exactly when rax is not small
+        jitByte(b, 0x48);                       // mov rdx, rax
+        jitByte(b, 0x89);
+        jitByte(b, 0xC2);
+        jitByte(b, 0x48);                       // add rdx, rdx
+        jitByte(b, 0x01);
+        jitByte(b, 0xD2);
+        jitOverflowJump(b, &stub);
+    }
+    jitSlotOp(b, 0, 0x89, 0, target);           // mov [target], rax
+    jitAddStub(b, &stub);
+}
+
+// executeStatement(node) from compiled code. The counters live in
+// callee-saved registers and the stack is 16-byte aligned at every statement.
+static void jitCallInterpreter(JitBuffer* b, TreeNode* node) {
+    jitByte(b, 0x48);  // mov rdi, node
+    jitByte(b, 0xBF);
+    jitU64(b, (uint64_t)(uintptr_t)node);
+    jitByte(b, 0x48);  // mov rax, executeStatement
+    jitByte(b, 0xB8);
+    jitU64(b, (uint64_t)(uintptr_t)&executeStatement);
+    jitByte(b, 0xFF);  // call rax
+    jitByte(b, 0xD0);
+}
+
+// Counted loop on r12+depth: test/jle guard, body, dec/jnz back edge
+static void jitCountedLoop(JitBuffer* b, TreeNode* body, int reg, int checkCount, int depth);
+
+static void jitStatement(JitBuffer* b, TreeNode* node, int depth) {
+    if (!node || !b->ok) return;
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+        case NODE_INCREMENT:
+        case NODE_DECREMENT:
+            jitUpdate(b, node);
+            break;
+        case NODE_BLOCK:
+            for (int i = 0; i < node->child_count; i++) {
+                jitStatement(b, childAt(node, i), depth);
+            }
+            break;
+        case NODE_LOOP: {
+            if (node->child_count < 1) break;
+            // The interpreter evaluates closed forms in constant time
+            if (depth + 1 >= JIT_COUNTER_REGISTERS || loopInfo(node)->closed) {
+                jitCallInterpreter(b, node);
+                break;
+            }
+            int reg = 12 + depth + 1;
+            TreeNode* body = node->child_count > 1 ? childAt(node, 1) : NULL;
+            long long constant;
+            if (jitConstant(childAt(node, 0), &constant)) {
+                if (constant == BIG_TAG) {
+                    jitCallInterpreter(b, node);
+                    break;
+                }
+                if (constant <= 0) break;
+                if (constant <= INT32_MAX) {
+                    jitRegOp(b, 0xC7, 0, reg);  // mov reg, imm32
+                    jitU32(b, (uint32_t)constant);
+                } else {
+                    jitByte(b, 0x49);           // mov reg, imm64
+                    jitByte(b, (unsigned char)(0xB8 | (reg & 7)));
+                    jitU64(b, (uint64_t)constant);
+                }
+                jitCountedLoop(b, body, reg, 0, depth + 1);
+            } else {
+                JitStub stub = {node, 0, {0}, 0};
+                jitSlotOp(b, 0x04, 0x8B, reg, childAt(node, 0)->slot);  // mov reg, [slot]
+                jitTagCheck(b, reg, &stub);
+                jitCountedLoop(b, body, reg, 1, depth + 1);
+                jitAddStub(b, &stub);
+            }
+            break;
+        }
+        case NODE_WRITE:
+            jitCallInterpreter(b, node);
+            break;
+        default:
+            // Declarations are no-ops, other nodes are never statements
+            break;
+    }
+}
+
+static void jitCountedLoop(JitBuffer* b, TreeNode* body, int reg, int checkCount, int depth) {
+    size_t guard = 0;
+    if (checkCount) {
+        jitByte(b, 0x4D);  // test reg, reg
+        jitByte(b, 0x85);
+        jitByte(b, (unsigned char)(0xC0 | ((reg & 7) << 3) | (reg & 7)));
+        jitByte(b, 0x0F);  // jle rel32
+        jitByte(b, 0x8E);
+        guard = b->size;
+        jitU32(b, 0);
+    }
+    size_t top = b->size;
+    jitStatement(b, body, depth);
+    jitRegOp(b, 0xFF, 1, reg);  // dec reg
+    jitByte(b, 0x0F);           // jnz top
+    jitByte(b, 0x85);
+    jitU32(b, (uint32_t)(int32_t)(top - (b->size + 4)));
+    if (checkCount) jitPatch32(b, guard, (int32_t)(b->size - (guard + 4)));
+}
+
+// void loop(long long* slots, long long count): runs the loop body count times
+static JitCode* jitCompile(TreeNode* loop) {
+#if defined(__x86_64__) && !defined(_WIN32)
+    double start = nowSeconds();
+    JitBuffer b = {NULL, 0, 0, 1, NULL, 0, 0};
+    static const unsigned char prologue[] = {
+        0x53,              // push rbx
+        0x41, 0x54,        // push r12
+        0x41, 0x55,        // push r13
+        0x41, 0x56,        // push r14
+        0x41, 0x57,        // push r15
+        0x48, 0x89, 0xFB,  // mov rbx, rdi
+        0x49, 0x89, 0xF4   // mov r12, rsi
+    };
+    static const unsigned char epilogue[] = {
+        0x41, 0x5F,        // pop r15
+        0x41, 0x5E,        // pop r14
+        0x41, 0x5D,        // pop r13
+        0x41, 0x5C,        // pop r12
+        0x5B,              // pop rbx
+        0xC3               // ret
+    };
+    for (size_t i = 0; i < sizeof(prologue); i++) jitByte(&b, prologue[i]);
+    jitCountedLoop(&b, loop->child_count > 1 ? childAt(loop, 1) : NULL, 12, 1, 0);
+    for (size_t i = 0; i < sizeof(epilogue); i++) jitByte(&b, epilogue[i]);
+    jitStubs(&b);
+
+    JitCode* code = &jitUnsupported;
+    if (b.ok) {
+        // W^X: filled in while writable, then switched to read+execute
+        void* memory = mmap(NULL, b.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            memcpy(memory, b.code, b.size);
+            if (mprotect(memory, b.size, PROT_READ | PROT_EXEC) == 0) {
+                code = (JitCode*)malloc(sizeof(JitCode));
+                code->entry = (JitFunction)memory;
+                code->size = b.size;
+                code->next = jitBlocks;
+                jitBlocks = code;
+                jit_loops_compiled++;
+                jit_code_bytes += b.size;
+            } else {
+                munmap(memory, b.size);
+            }
+        }
+    }
+    free(b.code);
+    free(b.stubs);
+    jitCompileSeconds += nowSeconds() - start;
+    return code;
+#else
+    (void)loop;
+    return &jitUnsupported;
+#endif
+}
+
+// Called by executeStatement() once a loop is hot: runs its remaining
+// iterations in compiled code. Returns 0 if the loop has to stay interpreted.
+// A loop nested deeper than the counter registers calls back into the
+// interpreter, which may enter compiled code again, each time on the C
+// stack; past JIT_MAX_NESTING of those the loops stay interpreted.
+static int jitEnter(TreeNode* loop, long long remaining) {
+    if (jit_nesting >= JIT_MAX_NESTING) return 0;
+    LoopInfo* info = loopInfo(loop);
+    if (!info->jit) info->jit = jitCompile(loop);
+    if (!info->jit->entry) {
+        info->hits = 0;
+        return 0;
+    }
+    jit_nesting++;
+    info->jit->entry(slots, remaining);
+    jit_nesting--;
+    return 1;
+}
+
+#ifndef PPP_LIBRARY
+// Drops all compiled code and iteration counts
+static void jitReset() {
+    jit_nesting = 0;
+    for (uint32_t i = 0; i < ast.loop_count; i++) {
+        ast.loops[i].hits = 0;
+        ast.loops[i].jit = NULL;
+    }
+}
+#endif
+
+static void jitRelease() {
+    while (jitBlocks) {
+        JitCode* next = jitBlocks->next;
+#ifndef _WIN32
+        munmap((void*)jitBlocks->entry, jitBlocks->size);
+#endif
+        free(jitBlocks);
+        jitBlocks = next;
+    }
+    jit_loops_compiled = 0;
+    jit_code_bytes = 0;
+    jitCompileSeconds = 0;
+}
+
+// Bytecode compiler
+//
+// Lowers the resolved parse tree to a linear instruction array. Operands are
+// loaded into an accumulator; emit() fuses a load with the instruction that
+// consumes it, so "x += 5;" becomes a single OP_ADD_CONST.
+static int emit(Chunk* chunk, OpCode op, int a, long long b) {
+    if (chunk->count > 0) {
+        Instr* prev = &chunk->code[chunk->count - 1];
+        int fromConst = prev->op == OP_LOAD_CONST;
+        if (fromConst || prev->op == OP_LOAD_SLOT) {
+            OpCode fused = OP_HALT;
+            if (op == OP_STORE) fused = fromConst ? OP_SET_CONST : OP_SET_SLOT;
+            else if (op == OP_ADD_TO_SLOT) fused = fromConst ? OP_ADD_CONST : OP_ADD_SLOT;
+            else if (op == OP_SUB_FROM_SLOT) fused = fromConst ? OP_SUB_CONST : OP_SUB_SLOT;
+            if (fused != OP_HALT) {
+                prev->op = fused;
+                prev->a = a;
+                return chunk->count - 1;
+            }
+        }
+    }
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+        chunk->code = (Instr*)realloc(chunk->code, sizeof(Instr) * (size_t)chunk->capacity);
+    }
+    Instr* instr = &chunk->code[chunk->count];
+    instr->op = op;
+    instr->a = a;
+    instr->b = b;
+    return chunk->count++;
+}
+
+// Only loop counts are loaded on their own, so a big number is loaded as
+// its iteration count
+static void emitLoad(Chunk* chunk, TreeNode* node) {
+    if (node->type == NODE_NUMBER) {
+        emit(chunk, OP_LOAD_CONST, 0, node->number == BIG_TAG ? loopCount(node) : node->number);
+    } else {
+        emit(chunk, OP_LOAD_SLOT, 0, node->slot);
+    }
+}
+
+// A statement without a nested statement
+static void compileFlat(Chunk* chunk, TreeNode* node) {
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count >= 2) {
+                OpCode op = node->type == NODE_ASSIGNMENT ? OP_STORE :
+                            node->type == NODE_INCREMENT ? OP_ADD_TO_SLOT : OP_SUB_FROM_SLOT;
+                // Constants are immediates, so big ones are left to the tree walker
+                TreeNode* value = childAt(node, 1);
+                if (value->type == NODE_NUMBER && !isSmall(value->number)) {
+                    emit(chunk, OP_TREE, 0, (long long)(intptr_t)node);
+                    break;
+                }
+                emitLoad(chunk, value);
+                emit(chunk, op, childAt(node, 0)->slot, 0);
+            }
+            break;
+        }
+        case NODE_WRITE: {
+            for (int i = 0; i < node->child_count; i++) {
+                TreeNode* child = childAt(node, i);
+                if (child->type == NODE_STRING) {
+                    emit(chunk, OP_WRITE_STR, 0, child->atom);
+                } else if (child->type == NODE_VARIABLE) {
+                    emit(chunk, OP_WRITE_INT, child->slot, 0);
+                } else if (child->type == NODE_NEWLINE) {
+                    emit(chunk, OP_NEWLINE, 0, 0);
+                }
+            }
+            break;
+        }
+        default:
+            // Declarations need no code, slots start at 0
+            break;
+    }
+}
+
+// Loop bodies straightLine() accepts
+static void compileStraight(Chunk* chunk, TreeNode* body) {
+    if (body->type != NODE_BLOCK) {
+        compileFlat(chunk, body);
+        return;
+    }
+    for (int i = 0; i < body->child_count; i++) compileFlat(chunk, childAt(body, i));
+}
+
+// A statement list being compiled: the children of list from position on,
+// inside a loop whose OP_LOOP_BEGIN is begin (-1 for none). A loop's own
+// frame covers its body, child 1, when that is not a block.
+typedef struct {
+    TreeNode* list;
+    int position;
+    int depth;
+    int begin;
+    int bodyStart;
+} CompileFrame;
+
+// Loops and blocks go on a heap stack, so any nesting depth works
+static void compileStatement(Chunk* chunk, TreeNode* node, int depth) {
+    CompileFrame* stack = NULL;
+    uint32_t top = 0, capacity = 0;
+    while (node || top > 0) {
+        if (node) {
+            if (node->type == NODE_LOOP) {
+                // A loop without a body has nothing to run
+                if (node->child_count >= 2) {
+                    if (depth + 1 > chunk->counter_count) chunk->counter_count = depth + 1;
+                    int unroll = loopInfo(node)->unroll;
+                    if (unroll > 1) {
+                        // --profile-use: a constant count, so the leftover copies follow the loop
+                        long long count = childAt(node, 0)->number;
+                        emit(chunk, OP_LOAD_CONST, 0, count / unroll);
+                        int begin = emit(chunk, OP_LOOP_BEGIN, depth, 0);
+                        int bodyStart = chunk->count;
+                        for (int i = 0; i < unroll; i++) compileStraight(chunk, childAt(node, 1));
+                        emit(chunk, OP_LOOP_END, depth, bodyStart);
+                        chunk->code[begin].b = chunk->count;
+                        for (long long i = 0; i < count % unroll; i++) compileStraight(chunk, childAt(node, 1));
+                    } else {
+                        emitLoad(chunk, childAt(node, 0));
+                        if (loopInfo(node)->closed) emit(chunk, OP_CLOSED_FORM, 0, (long long)(intptr_t)node);
+                        int begin = emit(chunk, OP_LOOP_BEGIN, depth, 0);
+                        TreeNode* body = childAt(node, 1);
+                        stack = (CompileFrame*)growArray(stack, &capacity, top + 1, sizeof(CompileFrame));
+                        stack[top++] = body->type == NODE_BLOCK ? (CompileFrame){body, 0, depth + 1, begin, chunk->count}
+                                                                : (CompileFrame){node, 1, depth + 1, begin, chunk->count};
+                    }
+                }
+            } else if (node->type == NODE_BLOCK) {
+                stack = (CompileFrame*)growArray(stack, &capacity, top + 1, sizeof(CompileFrame));
+                stack[top++] = (CompileFrame){node, 0, depth, -1, 0};
+            } else {
+                compileFlat(chunk, node);
+            }
+            node = NULL;
+            continue;
+        }
+        CompileFrame* frame = &stack[top - 1];
+        if (frame->position < frame->list->child_count) {
+            node = childAt(frame->list, frame->position++);
+            depth = frame->depth;
+            continue;
+        }
+        if (frame->begin >= 0) {
+            emit(chunk, OP_LOOP_END, frame->depth - 1, frame->bodyStart);
+            chunk->code[frame->begin].b = chunk->count;
+        }
+        top--;
+    }
+    free(stack);
+}
+
+static Chunk compileProgram(TreeNode* program) {
+    Chunk chunk = {NULL, 0, 0, 0};
+    for (int i = 0; i < program->child_count; i++) {
+        compileStatement(&chunk, childAt(program, i), 0);
+    }
+    emit(&chunk, OP_HALT, 0, 0);
+    return chunk;
+}
+
+static void freeChunk(Chunk* chunk) {
+    free(chunk->code);
+    chunk->code = NULL;
+    chunk->count = chunk->capacity = 0;
+}
+
+// Bytecode VM
+//
+// Threaded dispatch with computed goto where the compiler supports it,
+// a switch loop otherwise.
+#ifdef __GNUC__
+#define VM_OP(op) label_##op
+#define VM_DISPATCH() do { executed++; goto *labels[ip->op]; } while (0)
+#else
+#define VM_OP(op) case op
+#define VM_DISPATCH() do { executed++; goto dispatch; } while (0)
+#endif
+
+// slots[ip->a] op= value for a small value, or big_update when the slot or
+// the result is not small
+#define VM_UPDATE(subtract) do { \
+    if (__builtin_expect(!smallAdd(slots[ip->a], value, subtract, &sum), 0)) goto big_update; \
+    slots[ip->a] = sum; \
+    ip++; \
+    VM_DISPATCH(); \
+} while (0)
+
+static void vmStart(VmState* state, const Chunk* chunk) {
+    state->ip = chunk->code;
+    state->acc = 0;
+    state->counters = (long long*)calloc((size_t)chunk->counter_count + 1, sizeof(long long));
+    state->executed = 0;
+}
+
+// Where executed reaches the end of the governor's fuel
+static inline long long vmCheckAt(long long executed) {
+    return governor.fuel > LLONG_MAX - executed ? LLONG_MAX : executed + governor.fuel;
+}
+
+// Runs from state until OP_HALT (returns 1) or, when suspendable, until a
+// governor slice ends at a loop back edge (returns 0). The fuel lives in
+// checkAt while the VM runs and goes back to the governor around calls
+// into the tree walker.
+static int runChunkSlice(const Chunk* chunk, VmState* state, int suspendable) {
+    const Instr* code = chunk->code;
+    const Instr* ip = state->ip;
+    long long acc = state->acc;
+    long long sum, value;
+    long long executed = state->executed;
+    long long* counters = state->counters;
+    long long checkAt = vmCheckAt(executed);
+
+#ifdef __GNUC__
+    void* const labels[] = {
+        &&label_OP_LOAD_CONST, &&label_OP_LOAD_SLOT, &&label_OP_STORE, &&label_OP_ADD_TO_SLOT,
+        &&label_OP_SUB_FROM_SLOT, &&label_OP_WRITE_INT, &&label_OP_WRITE_STR, &&label_OP_NEWLINE,
+        &&label_OP_CLOSED_FORM, &&label_OP_LOOP_BEGIN, &&label_OP_LOOP_END, &&label_OP_SET_CONST, &&label_OP_SET_SLOT,
+        &&label_OP_ADD_CONST, &&label_OP_ADD_SLOT, &&label_OP_SUB_CONST, &&label_OP_SUB_SLOT,
+        &&label_OP_TREE, &&label_OP_HALT
+    };
+    VM_DISPATCH();
+#else
+    executed++;
+dispatch:
+    switch (ip->op) {
+#endif
+
+    VM_OP(OP_LOAD_CONST):
+        acc = ip->b;
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_LOAD_SLOT):
+        acc = slots[ip->b];
+        if (acc == BIG_TAG) acc = bigCount(&bigs[ip->b]);
+        ip++;
+        VM_DISPATCH();
+    // acc is never BIG_TAG
+    VM_OP(OP_STORE):
+        slots[ip->a] = acc;
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_ADD_TO_SLOT):
+        value = acc;
+        if (!isSmall(value)) goto big_update;
+        VM_UPDATE(0);
+    VM_OP(OP_SUB_FROM_SLOT):
+        value = acc;
+        if (!isSmall(value)) goto big_update;
+        VM_UPDATE(1);
+    VM_OP(OP_WRITE_INT):
+        sinkWriteSlot(&programOutput, ip->a);
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_WRITE_STR):
+        sinkWrite(&programOutput, atomText((uint32_t)ip->b), atomLength((uint32_t)ip->b));
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_NEWLINE):
+        sinkPutc(&programOutput, '\n');
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_CLOSED_FORM):
+        governor.fuel = checkAt - executed;
+        acc = runClosedForm((TreeNode*)(intptr_t)ip->b, acc);
+        checkAt = vmCheckAt(executed);
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_LOOP_BEGIN):
+        counters[ip->a] = acc;
+        ip = counters[ip->a] > 0 ? ip + 1 : code + ip->b;
+        VM_DISPATCH();
+    VM_OP(OP_LOOP_END):
+        ip = --counters[ip->a] > 0 ? code + ip->b : ip + 1;
+        if (__builtin_expect(executed >= checkAt, 0)) goto governor_tick;
+        VM_DISPATCH();
+    VM_OP(OP_SET_CONST):
+        slots[ip->a] = ip->b;
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_SET_SLOT):
+        if (slots[ip->b] != BIG_TAG) slots[ip->a] = slots[ip->b];
+        else bigAssign(ip->a, &bigs[ip->b]);
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_ADD_CONST):
+        value = ip->b;
+        VM_UPDATE(0);
+    VM_OP(OP_ADD_SLOT):
+        value = slots[ip->b];
+        if (__builtin_expect(value == BIG_TAG, 0)) goto big_update;
+        VM_UPDATE(0);
+    VM_OP(OP_SUB_CONST):
+        value = ip->b;
+        VM_UPDATE(1);
+    VM_OP(OP_SUB_SLOT):
+        value = slots[ip->b];
+        if (__builtin_expect(value == BIG_TAG, 0)) goto big_update;
+        VM_UPDATE(1);
+    VM_OP(OP_TREE):
+        governor.fuel = checkAt - executed;
+        executeStatement((TreeNode*)(intptr_t)ip->b);
+        checkAt = vmCheckAt(executed);
+        ip++;
+        VM_DISPATCH();
+    governor_tick:
+        governor.fuel = checkAt - executed;
+        if (governorTick() && suspendable) {
+            state->ip = ip;
+            state->acc = acc;
+            state->executed = executed;
+            return 0;
+        }
+        checkAt = vmCheckAt(executed);
+        VM_DISPATCH();
+    big_update:
+        // Out of line, so the fast paths keep their own dispatch
+        bigUpdate(ip->a, value, value == BIG_TAG ? &bigs[ip->b] : NULL,
+                  ip->op == OP_SUB_FROM_SLOT || ip->op == OP_SUB_CONST || ip->op == OP_SUB_SLOT);
+        ip++;
+        VM_DISPATCH();
+    VM_OP(OP_HALT):
+#ifndef __GNUC__
+        break;
+    }
+#endif
+    governor.fuel = checkAt - executed;
+    state->ip = ip;
+    state->executed = executed;
+    return 1;
+}
+
+#ifndef PPP_LIBRARY
+// Runs a whole chunk, returns the number of instructions executed
+static long long runChunk(const Chunk* chunk) {
+    VmState state;
+    vmStart(&state, chunk);
+    runChunkSlice(chunk, &state, 0);
+    free(state.counters);
+    return state.executed;
+}
+#endif
+
+#undef VM_OP
+#undef VM_DISPATCH
+#undef VM_UPDATE
+
+// Compiled programs (--cache, --serve)
+//
+// After a successful front end the resolved and optimized tree can be
+// serialized into one flat, position independent image. Installing an image
+// uses it in place: nodes and children are not copied, atoms point into its
+// text. --cache keeps images in <dir>/<key>.ppc, where key hashes the source,
+// the optimization level and the compiler build, and maps them on later runs.
+// Programs take no input, so with --cache-output the output of the first run
+// is kept in <dir>/<key>.out and replayed. --serve keeps images in memory.
+//
+// Layout, all sections 8-byte aligned:
+//   CacheHeader
+//   TreeNode nodes[node_count]
+//   uint32_t children[child_count]
+//   uint32_t atom_lengths[atom_count], then the atom texts, each NUL-terminated
+//   closed forms: {int32 loop, degree, count, slots[count]} x closed_count
+#define CACHE_MAGIC "PPPC"
+#define CACHE_FORMAT 1
+#define CACHE_OUTPUT_LIMIT (64u << 20)   // larger outputs are not cached
+
+// Cached artifacts are only valid for the exact build that wrote them
+static const char compilerId[] = "ppp " __DATE__ " " __TIME__;
+
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    uint64_t key;
+    uint64_t source_size;
+    uint64_t source_check;   // second hash of the source, guards against key collisions
+    int32_t opt_level;
+    int32_t symbol_count;
+    uint32_t root;           // index of the program node
+    uint32_t node_count;
+    uint32_t child_count;
+    uint32_t loop_count;
+    uint32_t atom_count;
+    uint32_t closed_count;
+    uint64_t nodes_offset;
+    uint64_t children_offset;
+    uint64_t atoms_offset;
+    uint64_t closed_offset;
+    uint64_t file_size;
+    uint64_t payload_check;  // hash of everything after the header
+} CacheHeader;
+
+// What an image is compiled from
+typedef struct {
+    uint64_t key;
+    uint64_t check;
+    size_t source_size;
+    int opt_level;
+} ProgramKey;
+
+typedef struct {
+    char path[4096];          // <dir>/<key>.ppc
+    char outputPath[4096];    // <dir>/<key>.out
+    ProgramKey id;
+    SourceFile file;          // the mapped image after a hit
+} ProgramCache;
+
+// 64-bit hash of a byte range, 8 bytes per step
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ULL);
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h ^= word * 0xBF58476D1CE4E5B9ULL;
+        h = (h << 27 | h >> 37) * 0x94D049BB133111EBULL;
+        p += 8;
+        size -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    h ^= tail * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+static void programKey(ProgramKey* id, const char* source, size_t size, int optLevel) {
+    uint64_t seed = hashBytes(compilerId, sizeof(compilerId), CACHE_FORMAT) ^ (uint64_t)(optLevel + 1);
+    id->key = hashBytes(source, size, seed);
+    id->check = hashBytes(source, size, ~seed);
+    id->source_size = size;
+    id->opt_level = optLevel;
+}
+
+static uint64_t alignCacheOffset(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Serializes the current program into a malloc'd image
+static char* serializeProgram(const ProgramKey* id, TreeNode* program, size_t* size) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.format = CACHE_FORMAT;
+    header.key = id->key;
+    header.source_size = id->source_size;
+    header.source_check = id->check;
+    header.opt_level = id->opt_level;
+    header.symbol_count = symbol_count;
+    header.root = (uint32_t)(program - ast.nodes);
+    header.node_count = ast.node_count;
+    header.child_count = ast.child_count;
+    header.loop_count = ast.loop_count;
+    header.atom_count = atom_count;
+
+    uint64_t offset = alignCacheOffset(sizeof(CacheHeader));
+    header.nodes_offset = offset;
+    offset = alignCacheOffset(offset + sizeof(TreeNode) * (uint64_t)ast.node_count);
+    header.children_offset = offset;
+    offset = alignCacheOffset(offset + sizeof(uint32_t) * (uint64_t)ast.child_count);
+    header.atoms_offset = offset;
+    offset += sizeof(uint32_t) * (uint64_t)atom_count;
+    for (uint32_t i = 0; i < atom_count; i++) offset += atoms[i].length + 1;
+    offset = alignCacheOffset(offset);
+    header.closed_offset = offset;
+    for (uint32_t i = 0; i < ast.loop_count; i++) {
+        const ClosedForm* form = ast.loops[i].closed;
+        if (!form) continue;
+        header.closed_count++;
+        offset += sizeof(int32_t) * (3 + (uint64_t)form->count);
+    }
+    header.file_size = offset;
+
+    char* image = (char*)calloc(1, (size_t)offset);
+    if (!image) fatal("Error: Out of memory\n");
+    memcpy(image + header.nodes_offset, ast.nodes, sizeof(TreeNode) * ast.node_count);
+    memcpy(image + header.children_offset, ast.children, sizeof(uint32_t) * ast.child_count);
+    uint32_t* lengths = (uint32_t*)(image + header.atoms_offset);
+    char* text = (char*)(lengths + atom_count);
+    for (uint32_t i = 0; i < atom_count; i++) {
+        lengths[i] = atoms[i].length;
+        memcpy(text, atoms[i].text, atoms[i].length + 1);
+        text += atoms[i].length + 1;
+    }
+    int32_t* closed = (int32_t*)(image + header.closed_offset);
+    for (uint32_t i = 0; i < ast.loop_count; i++) {
+        const ClosedForm* form = ast.loops[i].closed;
+        if (!form) continue;
+        closed[0] = (int32_t)i;
+        closed[1] = form->degree;
+        closed[2] = form->count;
+        memcpy(closed + 3, form->slots, sizeof(int) * (size_t)form->count);
+        closed += 3 + form->count;
+    }
+    header.payload_check = hashBytes(image + sizeof(CacheHeader), (size_t)offset - sizeof(CacheHeader), id->key);
+    memcpy(image, &header, sizeof(header));
+    *size = (size_t)offset;
+    return image;
+}
+
+#ifndef PPP_LIBRARY
+static int validCacheRange(const CacheHeader* header, uint64_t offset, uint64_t bytes) {
+    return offset <= header->file_size && bytes <= header->file_size - offset && offset % 8 == 0;
+}
+
+// Checks an image read from disk before it is trusted: header, payload
+// hash and every index in it
+static int validImage(const ProgramKey* id, const char* image, size_t size) {
+    const CacheHeader* header = (const CacheHeader*)image;
+    if (size < sizeof(CacheHeader) || memcmp(header->magic, CACHE_MAGIC, 4) != 0 ||
+        header->format != CACHE_FORMAT || header->key != id->key || header->source_check != id->check ||
+        header->source_size != id->source_size || header->opt_level != id->opt_level ||
+        header->file_size != size || header->symbol_count < 0 ||
+        !validCacheRange(header, header->nodes_offset, (uint64_t)header->node_count * sizeof(TreeNode)) ||
+        !validCacheRange(header, header->children_offset, (uint64_t)header->child_count * sizeof(uint32_t)) ||
+        !validCacheRange(header, header->atoms_offset, (uint64_t)header->atom_count * sizeof(uint32_t)) ||
+        !validCacheRange(header, header->closed_offset, 0) ||
+        hashBytes(image + sizeof(CacheHeader), size - sizeof(CacheHeader), id->key) != header->payload_check) {
+        return 0;
+    }
+
+    const TreeNode* nodes = (const TreeNode*)(image + header->nodes_offset);
+    const uint32_t* children = (const uint32_t*)(image + header->children_offset);
+    for (uint32_t i = 0; i < header->node_count; i++) {
+        const TreeNode* node = &nodes[i];
+        if ((unsigned)node->type > NODE_NEWLINE || node->atom >= header->atom_count) return 0;
+        if (node->child_count < 0 || node->first_child > header->child_count ||
+            (uint32_t)node->child_count > header->child_count - node->first_child) return 0;
+        if (node->type == NODE_VARIABLE && (node->slot < 0 || node->slot > header->symbol_count)) return 0;
+        if (node->type == NODE_LOOP && node->loop >= header->loop_count) return 0;
+    }
+    for (uint32_t i = 0; i < header->child_count; i++) {
+        if (children[i] >= header->node_count) return 0;
+    }
+    if (header->root >= header->node_count || nodes[header->root].type != NODE_PROGRAM) return 0;
+
+    const uint32_t* lengths = (const uint32_t*)(image + header->atoms_offset);
+    const char* text = (const char*)(lengths + header->atom_count);
+    const char* textEnd = image + header->closed_offset;
+    for (uint32_t i = 0; i < header->atom_count; i++) {
+        if (lengths[i] >= (size_t)(textEnd - text) || text[lengths[i]] != '\0') return 0;
+        text += lengths[i] + 1;
+    }
+
+    const int32_t* closed = (const int32_t*)(image + header->closed_offset);
+    const int32_t* closedEnd = (const int32_t*)(image + size);
+    for (uint32_t i = 0; i < header->closed_count; i++) {
+        if (closedEnd - closed < 3 || closed[0] < 0 || (uint32_t)closed[0] >= header->loop_count ||
+            closed[2] < 0 || closed[2] > closedEnd - closed - 3) return 0;
+        for (int s = 0; s < closed[2]; s++) {
+            if (closed[3 + s] < 0 || closed[3 + s] > header->symbol_count) return 0;
+        }
+        closed += 3 + closed[2];
+    }
+    return 1;
+}
+#endif
+
+// Makes a valid image the current program. The image has to outlive it; the
+// arena's own arrays are dropped, so a thread that parses again afterwards
+// has to restore them first (see serveRequest).
+static TreeNode* installProgram(const char* image) {
+    const CacheHeader* header = (const CacheHeader*)image;
+    const uint32_t* lengths = (const uint32_t*)(image + header->atoms_offset);
+    const char* text = (const char*)(lengths + header->atom_count);
+    atoms = (Atom*)growArray(atoms, &atom_capacity, header->atom_count, sizeof(Atom));
+    for (uint32_t i = 0; i < header->atom_count; i++) {
+        atoms[i].text = text;
+        atoms[i].length = lengths[i];
+        atoms[i].hash = 0;
+        text += lengths[i] + 1;
+    }
+    atom_count = header->atom_count;
+
+    // Nothing adds nodes after the optimizer, so the image is used as is
+    ast.nodes = (TreeNode*)(image + header->nodes_offset);
+    ast.node_count = ast.node_capacity = header->node_count;
+    ast.children = (uint32_t*)(image + header->children_offset);
+    ast.child_count = ast.child_capacity = header->child_count;
+    ast.pending_count = 0;
+    ast.loops = (LoopInfo*)calloc(header->loop_count ? header->loop_count : 1, sizeof(LoopInfo));
+    ast.loop_count = ast.loop_capacity = header->loop_count;
+
+    const int32_t* closed = (const int32_t*)(image + header->closed_offset);
+    for (uint32_t i = 0; i < header->closed_count; i++) {
+        ClosedForm* form = (ClosedForm*)malloc(sizeof(ClosedForm) + sizeof(int) * (size_t)closed[2]);
+        form->degree = closed[1];
+        form->count = closed[2];
+        memcpy(form->slots, closed + 3, sizeof(int) * (size_t)form->count);
+        ast.loops[closed[0]].closed = form;
+        closed += 3 + form->count;
+    }
+    symbol_count = header->symbol_count;
+    return &ast.nodes[header->root];
+}
+
+#ifndef PPP_LIBRARY
+// Cache directory: --cache=dir, $PPP_CACHE_DIR, $XDG_CACHE_HOME/ppp or ~/.cache/ppp
+static void defaultCacheDir(char* dir, size_t size) {
+    const char* env = getenv("PPP_CACHE_DIR");
+    if (env && *env) {
+        snprintf(dir, size, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        snprintf(dir, size, "%s/ppp", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        snprintf(dir, size, "%s/.cache/ppp", env);
+    } else {
+        snprintf(dir, size, ".ppp-cache");
+    }
+}
+
+static void makeDirectories(const char* path) {
+#ifndef _WIN32
+    char partial[4096];
+    snprintf(partial, sizeof(partial), "%s", path);
+    for (char* p = partial + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(partial, 0755);
+        *p = '/';
+    }
+    mkdir(partial, 0755);
+#else
+    (void)path;
+#endif
+}
+
+static void cacheOpen(ProgramCache* cache, const char* dir, const SourceFile* source, int optLevel) {
+    programKey(&cache->id, source->data, source->size, optLevel);
+    cache->file.data = NULL;
+    cache->file.size = 0;
+    snprintf(cache->path, sizeof(cache->path), "%s/%016llx.ppc", dir, (unsigned long long)cache->id.key);
+    snprintf(cache->outputPath, sizeof(cache->outputPath), "%s/%016llx.out", dir, (unsigned long long)cache->id.key);
+}
+
+// Maps the image and installs it. NULL on a miss or when the file is stale
+// or damaged.
+static TreeNode* cacheLoad(ProgramCache* cache) {
+    if (!loadSource(cache->path, &cache->file)) return NULL;
+    if (!validImage(&cache->id, cache->file.data, cache->file.size)) {
+        unloadSource(&cache->file);
+        return NULL;
+    }
+    return installProgram(cache->file.data);
+}
+
+// Writes the image under a temporary name and renames it into place, so
+// readers never see a partial file. Failures only cost the cache.
+static void cacheStore(ProgramCache* cache, TreeNode* program) {
+    size_t size;
+    char* image = serializeProgram(&cache->id, program, &size);
+    char temp[4096 + 32];
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", cache->path, (long)getpid());
+    FILE* out = fopen(temp, "wb");
+    if (out) {
+        size_t written = fwrite(image, 1, size, out);
+        if (fclose(out) != 0 || written != size || rename(temp, cache->path) != 0) remove(temp);
+    }
+    free(image);
+}
+
+// --cache-output: replays a stored output. 0 if there is none.
+static int cacheReplayOutput(ProgramCache* cache) {
+    SourceFile output;
+    if (!loadSource(cache->outputPath, &output)) return 0;
+    sinkWrite(&programOutput, output.data, output.size);
+    sinkFlush(&programOutput);
+    unloadSource(&output);
+    return 1;
+}
+
+// Starts copying program output into a temporary file, returns its fd
+static int cacheCaptureOutput(ProgramCache* cache, char* temp, size_t size) {
+#ifndef _WIN32
+    snprintf(temp, size, "%s.%ld.tmp", cache->outputPath, (long)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    programOutput.copy_fd = fd;
+    programOutput.copy_room = CACHE_OUTPUT_LIMIT;
+    return fd;
+#else
+    (void)cache;
+    (void)temp;
+    (void)size;
+    return -1;
+#endif
+}
+
+// Keeps the copy if the whole output made it in
+static void cacheFinishOutput(ProgramCache* cache, int fd, const char* temp) {
+    sinkFlush(&programOutput);
+    int complete = programOutput.copy_fd == fd;
+    programOutput.copy_fd = -1;
+#ifndef _WIN32
+    if (close(fd) != 0 || !complete || rename(temp, cache->outputPath) != 0) remove(temp);
+#endif
+}
+#endif
+
+// Clears the per-thread front end state before lexing another source
+static void resetLexerState() {
+    token_count = 0;
+    current_token_index = 0;
+    blockCount = 0;
+    brace_count = 0;
+    brace_open = NO_BRACE;
+    resetSymbols();
+    poolReset();
+    initAtoms();
+}
+
+// Embedding API (ppp.h)
+//
+// ppp_compile() runs the front end on the calling thread's state and keeps
+// only the serialized image, which nothing writes to afterwards. A run
+// installs the image in state of its own (PppRun), which ppp_resume() swaps
+// with the calling thread's for the length of a slice, so the same program
+// can run on many threads at once and a run can move between threads.
+struct PppProgram {
+    ProgramKey id;
+    char* image;
+    size_t size;
+};
+
+struct PppContext {
+    PppOptions options;
+    char error[256];
+    char* output;
+    size_t output_size;
+};
+
+PppContext* ppp_context_new(const PppOptions* options) {
+    PppContext* context = (PppContext*)calloc(1, sizeof(PppContext));
+    if (!context) return NULL;
+    if (options) context->options = *options;
+    return context;
+}
+
+void ppp_context_free(PppContext* context) {
+    if (!context) return;
+    free(context->output);
+    free(context);
+}
+
+const char* ppp_error(const PppContext* context) {
+    return context->error;
+}
+
+const char* ppp_output(const PppContext* context, size_t* size) {
+    *size = context->output_size;
+    return context->output ? context->output : "";
+}
+
+// Front end under an error trap, for a source whose key is known
+static PppProgram* pppCompileKeyed(PppContext* context, const ProgramKey* id, const char* source, size_t length) {
+    ErrorTrap trap;
+    error_trap = &trap;
+    if (setjmp(trap.jump)) {
+        error_trap = NULL;
+        snprintf(context->error, sizeof(context->error), "%s", trap.message);
+        return NULL;
+    }
+    resetLexerState();
+    lexBuffer(source, length);
+    if (blockCount > 0) fatal("Error: Unclosed block opened on line %d\n", blockLine);
+    TreeNode* root = parseProgram();
+    resolveSymbols(root);
+    optimizeProgram(root, id->opt_level, 0);
+    PppProgram* program = (PppProgram*)malloc(sizeof(PppProgram));
+    if (!program) fatal("Error: Out of memory\n");
+    program->id = *id;
+    program->image = serializeProgram(id, root, &program->size);
+    error_trap = NULL;
+    context->error[0] = '\0';
+    return program;
+}
+
+PppProgram* ppp_compile(PppContext* context, const char* source, size_t length) {
+    ProgramKey id;
+    programKey(&id, source, length, context->options.opt_level);
+    return pppCompileKeyed(context, &id, source, length);
+}
+
+struct PppRun {
+    int engine;
+    int fd;
+    TreeNode* root;
+    int next;          // top-level statement, tree walker
+    Chunk chunk;       // VM
+    VmState vm;
+    // The run's thread-local state while it is not on a thread
+    Ast ast;
+    Atom* atoms;
+    uint32_t atom_count;
+    uint32_t atom_capacity;
+    long long* slots;
+    int symbol_count;
+    BigNum* bigs;
+    uint32_t big_capacity;
+    ExecFrame* exec_stack;
+    uint32_t exec_depth;
+    uint32_t exec_capacity;
+    OutputSink output;
+    Governor governor;
+    int jit_threshold;
+    JitCode* jit_blocks;
+};
+
+#define SWAP(type, a, b) do { type swapped = (a); (a) = (b); (b) = swapped; } while (0)
+
+static void pppSwap(PppRun* run) {
+    SWAP(Ast, ast, run->ast);
+    SWAP(Atom*, atoms, run->atoms);
+    SWAP(uint32_t, atom_count, run->atom_count);
+    SWAP(uint32_t, atom_capacity, run->atom_capacity);
+    SWAP(long long*, slots, run->slots);
+    SWAP(int, symbol_count, run->symbol_count);
+    SWAP(BigNum*, bigs, run->bigs);
+    SWAP(uint32_t, big_capacity, run->big_capacity);
+    SWAP(ExecFrame*, exec_stack, run->exec_stack);
+    SWAP(uint32_t, exec_depth, run->exec_depth);
+    SWAP(uint32_t, exec_capacity, run->exec_capacity);
+    SWAP(OutputSink, programOutput, run->output);
+    SWAP(Governor, governor, run->governor);
+    SWAP(int, jitThreshold, run->jit_threshold);
+    SWAP(JitCode*, jitBlocks, run->jit_blocks);
+}
+
+#undef SWAP
+
+static PppRun* pppStart(PppContext* context, const PppProgram* program, int fd, int preempt) {
+    PppRun* run = (PppRun*)calloc(1, sizeof(PppRun));
+    if (!run) return NULL;
+    run->engine = context->options.engine;
+    run->fd = fd;
+    // Captured output is the sink's buffer, grown and never flushed
+    OutputSink output = {fd, fd >= 0 ? FLUSH_BLOCK : FLUSH_EXIT, NULL, 0, 0, -1, 0, 0, 0, 0};
+    run->output = output;
+    pppSwap(run);
+    run->root = installProgram(program->image);
+    slots = (long long*)calloc((size_t)symbol_count + 1, sizeof(long long));
+    governorStart(&context->options, preempt);
+    jitThreshold = run->engine == PPP_ENGINE_TREE && !governorActive() ? context->options.jit_threshold : 0;
+    if (run->engine == PPP_ENGINE_VM) {
+        run->chunk = compileProgram(run->root);
+        vmStart(&run->vm, &run->chunk);
+    }
+    pppSwap(run);
+    return run;
+}
+
+PppRun* ppp_start(PppContext* context, const PppProgram* program, int fd) {
+    return pppStart(context, program, fd, 1);
+}
+
+// Frees what the run holds while it is swapped out
+static void pppFree(PppRun* run) {
+    for (uint32_t i = 0; i < run->ast.loop_count; i++) free(run->ast.loops[i].closed);
+    free(run->ast.loops);
+    free(run->atoms);
+    free(run->slots);
+    for (uint32_t i = 0; i < run->big_capacity; i++) free(run->bigs[i].limbs);
+    free(run->bigs);
+    free(run->exec_stack);
+    free(run->output.data);
+    freeChunk(&run->chunk);
+    free(run->vm.counters);
+    free(run);
+}
+
+int ppp_resume(PppContext* context, PppRun* run) {
+    ErrorTrap* outer = error_trap;
+    ErrorTrap trap;
+    int status;
+    pppSwap(run);
+    error_trap = &trap;
+    if (setjmp(trap.jump)) {
+        snprintf(context->error, sizeof(context->error), "%s", trap.message);
+        status = -1;
+    } else if (run->engine == PPP_ENGINE_VM) {
+        status = runChunkSlice(&run->chunk, &run->vm, governor.preempt) ? 0 : 1;
+    } else if (!governor.preempt) {
+        executeProgram(run->root);
+        status = 0;
+    } else {
+        status = executeSlice(run->root, &run->next) ? 0 : 1;
+    }
+    error_trap = outer;
+    if (status != 1) {
+        free(context->output);
+        context->output = NULL;
+        context->output_size = 0;
+        if (run->fd < 0) {
+            context->output = programOutput.data;
+            context->output_size = programOutput.used;
+            programOutput.data = NULL;
+        } else {
+            sinkFlush(&programOutput);
+        }
+        if (status == 0) context->error[0] = '\0';
+        jitRelease();
+    }
+    pppSwap(run);
+    if (status != 1) pppFree(run);
+    return status;
+}
+
+void ppp_cancel(PppRun* run) {
+    if (run) pppFree(run);
+}
+
+int ppp_run(PppContext* context, const PppProgram* program, int fd) {
+    PppRun* run = pppStart(context, program, fd, 0);
+    if (!run) return -1;
+    int status;
+    while ((status = ppp_resume(context, run)) == 1) {
+    }
+    return status;
+}
+
+void ppp_free(PppProgram* program) {
+    if (!program) return;
+    free(program->image);
+    free(program);
+}
+
+// The tooling below allocates outside the phases --stats counts
+#undef malloc
+#undef calloc
+#undef realloc
+
+// Benchmark helpers
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Everything below is the command line tool: benchmarks, --serve, --batch,
+// --stream, native code and the driver
+#ifndef PPP_LIBRARY
+static int sameTokens(const Token* a, const Atom* atomsA, size_t countA,
+               const Token* b, const Atom* atomsB, size_t countB) {
+    if (countA != countB) {
+        printf("Token count differs: %zu vs %zu\n", countA, countB);
+        return 0;
+    }
+    for (size_t i = 0; i < countA; i++) {
+        const Atom* textA = &atomsA[a[i].atom];
+        const Atom* textB = &atomsB[b[i].atom];
+        if (a[i].type != b[i].type || a[i].line_number != b[i].line_number ||
+            textA->length != textB->length || memcmp(textA->text, textB->text, textA->length) != 0) {
+            printf("Token %zu differs on line %d: '%s' vs '%s'\n", i, a[i].line_number,
+                   textA->text, textB->text);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// --bench-lex: lexer throughput in MB/s, legacy fgets/strtok path vs the
+// single-pass lexer over the mapped file, and that lexer split over up to
+// --lex-threads threads. Also checks all token streams match.
+static int benchLexer(const char* filename, int runs) {
+    SourceFile source;
+    if (!loadSource(filename, &source)) {
+        printf("File cannot be opened: %s\n", filename);
+        return 1;
+    }
+    double megabytes = (double)source.size / (1024.0 * 1024.0);
+
+    double legacyBest = 0;
+    for (int r = 0; r < runs; r++) {
+        resetLexerState();
+        double start = nowSeconds();
+        FILE* dosya = fopen(filename, "r");
+        if (!dosya) {
+            printf("File cannot be opened: %s\n", filename);
+            return 1;
+        }
+        lexFileLegacy(dosya);
+        fclose(dosya);
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < legacyBest) legacyBest = elapsed;
+    }
+    // Keep the legacy stream and its atoms (text lives in the pool) for the comparison
+    Token* legacyTokens = tokens;
+    size_t legacyCount = token_count;
+    Atom* legacyAtoms = atoms;
+    PoolChunk* legacyPool = stringPool;
+    tokens = NULL;
+    token_capacity = 0;
+    atoms = NULL;
+    atom_capacity = 0;
+    stringPool = NULL;
+
+    double mappedBest = 0;
+    for (int r = 0; r < runs; r++) {
+        resetLexerState();
+        double start = nowSeconds();
+        lexBuffer(source.data, source.size);
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < mappedBest) mappedBest = elapsed;
+    }
+
+    int same = sameTokens(legacyTokens, legacyAtoms, legacyCount, tokens, atoms, token_count);
+    printf("file: %s (%.2f MB), best of %d runs\n", filename, megabytes, runs);
+    printf("legacy lexer: %10.2f MB/s\n", megabytes / legacyBest);
+    printf("mmap lexer:   %10.2f MB/s\n", megabytes / mappedBest);
+    printf("speedup:      %10.2fx\n", legacyBest / mappedBest);
+    printf("token stream: %s\n", same ? "identical" : "DIFFERENT");
+
+#ifndef _WIN32
+    // --lex-threads: 2, 4, ... threads, which must give the very same stream
+    size_t mappedCount = token_count;
+    uint32_t mappedAtoms = atom_count;
+    int mappedSymbols = symbol_count;
+    Token* mappedTokens = (Token*)malloc(sizeof(Token) * (mappedCount ? mappedCount : 1));
+    memcpy(mappedTokens, tokens, sizeof(Token) * mappedCount);
+    for (int threads = 2; threads <= lexThreads; threads = threads < lexThreads && threads * 2 > lexThreads ? lexThreads : threads * 2) {
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            resetLexerState();
+            double start = nowSeconds();
+            lexParallel(source.data, source.size, threads);
+            double elapsed = nowSeconds() - start;
+            if (r == 0 || elapsed < best) best = elapsed;
+        }
+        int identical = token_count == mappedCount && atom_count == mappedAtoms && symbol_count == mappedSymbols &&
+                        memcmp(tokens, mappedTokens, sizeof(Token) * mappedCount) == 0;
+        printf("%2d threads:   %10.2f MB/s  %5.2fx  %s\n", threads, megabytes / best, mappedBest / best,
+               identical ? "identical" : "DIFFERENT");
+        same &= identical;
+    }
+    free(mappedTokens);
+#endif
+
+    free(legacyTokens);
+    free(legacyAtoms);
+    resetLexerState();
+    stringPool = legacyPool;
+    poolReset();
+    unloadSource(&source);
+    return same ? 0 : 1;
+}
+
+// Visits every node the way the engines walk the tree
+// Pre-order on a heap stack, like resolveSymbols()
+static long long countNodes(const TreeNode* root) {
+    long long count = 0;
+    uint32_t* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (uint32_t*)growArray(stack, &capacity, 1, sizeof(uint32_t));
+    stack[depth++] = (uint32_t)(root - ast.nodes);
+    while (depth > 0) {
+        const TreeNode* node = &ast.nodes[stack[--depth]];
+        count++;
+        stack = (uint32_t*)growArray(stack, &capacity, depth + (uint32_t)node->child_count, sizeof(uint32_t));
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[depth++] = ast.children[node->first_child + (uint32_t)i];
+        }
+    }
+    free(stack);
+    return count;
+}
+
+// --bench-parse: token stream and tree footprint, parse and traversal time
+static int benchParser(const char* filename, int runs) {
+    SourceFile source;
+    if (!loadSource(filename, &source)) {
+        printf("File cannot be opened: %s\n", filename);
+        return 1;
+    }
+
+    double start = nowSeconds();
+    lexBuffer(source.data, source.size);
+    double lexTime = nowSeconds() - start;
+
+    size_t atomBytes = sizeof(Atom) * atom_capacity + sizeof(uint32_t) * (atomTableMask + 1);
+    for (uint32_t i = 0; i < atom_count; i++) atomBytes += atoms[i].length + 1;
+
+    double parseBest = 0, walkBest = 0;
+    TreeNode* tree = NULL;
+    int threads = parseThreads;
+    parseThreads = 1;
+    for (int r = 0; r < runs; r++) {
+        current_token_index = 0;
+        start = nowSeconds();
+        tree = parseProgram();
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < parseBest) parseBest = elapsed;
+    }
+
+    // --parse-threads: 2, 4, ... threads, which must lay out the same arena
+    int same = 1;
+    char parallelReport[1024] = "";
+    size_t reportLength = 0;
+#ifndef _WIN32
+    Ast sequential = ast;
+    memset(&ast, 0, sizeof(ast));
+    for (parseThreads = 2; parseThreads <= threads;
+         parseThreads = parseThreads < threads && parseThreads * 2 > threads ? threads : parseThreads * 2) {
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            current_token_index = 0;
+            start = nowSeconds();
+            parseProgram();
+            double elapsed = nowSeconds() - start;
+            if (r == 0 || elapsed < best) best = elapsed;
+        }
+        int identical = ast.node_count == sequential.node_count && ast.child_count == sequential.child_count &&
+                        ast.loop_count == sequential.loop_count &&
+                        memcmp(ast.nodes, sequential.nodes, sizeof(TreeNode) * ast.node_count) == 0 &&
+                        memcmp(ast.children, sequential.children, sizeof(uint32_t) * ast.child_count) == 0;
+        same &= identical;
+        if (reportLength < sizeof(parallelReport)) {
+            reportLength += (size_t)snprintf(parallelReport + reportLength, sizeof(parallelReport) - reportLength,
+                                             "  %2d threads:    %.3f s (%.2fx) %s\n", parseThreads, best,
+                                             parseBest / best, identical ? "identical" : "DIFFERENT");
+        }
+    }
+    free(ast.nodes);
+    free(ast.children);
+    free(ast.pending);
+    free(ast.loops);
+    ast = sequential;
+#endif
+    parseThreads = threads;
+    long long visited = 0;
+    for (int r = 0; r < runs; r++) {
+        start = nowSeconds();
+        visited = countNodes(tree);
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < walkBest) walkBest = elapsed;
+    }
+    size_t treeBytes = sizeof(TreeNode) * ast.node_capacity + sizeof(uint32_t) * ast.child_capacity +
+                       sizeof(LoopInfo) * ast.loop_capacity;
+
+    printf("file: %s (%.2f MB)\n", filename, (double)source.size / (1024.0 * 1024.0));
+    printf("tokens:          %zu\n", token_count);
+    printf("bytes per token: %zu\n", sizeof(Token));
+    printf("token buffer:    %.2f MB\n", (double)(sizeof(Token) * token_capacity) / (1024.0 * 1024.0));
+    printf("atoms:           %u (%.2f MB with table)\n", atom_count, (double)atomBytes / (1024.0 * 1024.0));
+    printf("lex time:        %.3f s\n", lexTime);
+    printf("parse time:      %.3f s (%.1f ns/token, best of %d)\n", parseBest,
+           parseBest * 1e9 / (double)(token_count ? token_count : 1), runs);
+    fputs(parallelReport, stdout);
+    printf("nodes:           %u (%lld reachable)\n", ast.node_count, visited);
+    printf("bytes per node:  %zu (+%zu per child index)\n", sizeof(TreeNode), sizeof(uint32_t));
+    printf("tree arena:      %.2f MB\n", (double)treeBytes / (1024.0 * 1024.0));
+    printf("traversal time:  %.3f ms (%.2f ns/node, best of %d)\n", walkBest * 1e3,
+           walkBest * 1e9 / (double)(visited ? visited : 1), runs);
+
+    unloadSource(&source);
+    return same ? 0 : 1;
+}
+
+// Synthetic workload generator (--gen=spec)
+//
+// Writes a random but reproducible program shaped by a comma separated spec,
+// e.g. "lines=50000,depth=3,vars=16,writes=20,strlen=12,comments=10". The
+// repeat counts are fixed (trips), so the executed work stays predictable:
+// a statement at depth d runs trips^d times.
+typedef struct {
+    long long lines;        // approximate number of source lines
+    int depth;              // deepest repeat nesting
+    int vars;               // declared variables
+    int writes;             // % of statements that are writes
+    int stringLength;       // length of each string literal
+    int comments;           // % of lines with a trailing comment
+    int trips;              // repeat count of every loop
+    unsigned long long seed;
+} GenParams;
+
+#define GEN_MAX_DEPTH 1000000
+#define GEN_MAX_INDENT 99   // deeper lines are indented as this level
+
+static const GenParams genDefaults = {10000, 3, 16, 20, 12, 10, 3, 1};
+
+// Fills params from a spec, unknown keys are an error
+static int parseGenSpec(const char* spec, GenParams* params) {
+    *params = genDefaults;
+    while (*spec) {
+        const char* eq = strchr(spec, '=');
+        if (!eq) return 0;
+        size_t keyLength = (size_t)(eq - spec);
+        long long value = strtoll(eq + 1, NULL, 10);
+        if (value < 0) return 0;
+#define GEN_KEY(key) (keyLength == sizeof(key) - 1 && memcmp(spec, key, keyLength) == 0)
+        if (GEN_KEY("lines")) params->lines = value;
+        else if (GEN_KEY("depth")) params->depth = value > GEN_MAX_DEPTH ? GEN_MAX_DEPTH : (int)value;
+        else if (GEN_KEY("vars")) params->vars = value < 1 ? 1 : (int)value;
+        else if (GEN_KEY("writes")) params->writes = value > 100 ? 100 : (int)value;
+        else if (GEN_KEY("strlen")) params->stringLength = value > 4096 ? 4096 : (int)value;
+        else if (GEN_KEY("comments")) params->comments = value > 100 ? 100 : (int)value;
+        else if (GEN_KEY("trips")) params->trips = value > 1000 ? 1000 : (int)value;
+        else if (GEN_KEY("seed")) params->seed = (unsigned long long)value;
+        else return 0;
+#undef GEN_KEY
+        const char* comma = strchr(eq, ',');
+        if (!comma) break;
+        spec = comma + 1;
+    }
+    return 1;
+}
+
+static unsigned long long genNext(unsigned long long* state) {
+    // xorshift64*
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int genPercent(unsigned long long* state, int percent) {
+    return (int)(genNext(state) % 100) < percent;
+}
+
+// Lowercase words separated by single spaces, length letters in total
+static void genText(FILE* out, unsigned long long* state, int length) {
+    int space = 1;
+    for (int i = 0; i < length; i++) {
+        space = !space && i < length - 1 && genNext(state) % 6 == 0;
+        fputc(space ? ' ' : 'a' + (int)(genNext(state) % 26), out);
+    }
+}
+
+static void genStatement(FILE* out, unsigned long long* state, const GenParams* params) {
+    int target = (int)(genNext(state) % (unsigned)params->vars);
+    if (genPercent(state, params->writes)) {
+        fputs("write ", out);
+        int parts = 1 + (int)(genNext(state) % 3);
+        for (int i = 0; i < parts; i++) {
+            if (i > 0) fputs(" and ", out);
+            if (genNext(state) % 2 == 0) {
+                fputc('"', out);
+                genText(out, state, params->stringLength);
+                fputc('"', out);
+            } else {
+                fprintf(out, "v%d", (int)(genNext(state) % (unsigned)params->vars));
+            }
+        }
+        fputs(" and newline;", out);
+        return;
+    }
+    static const char* operators[] = {":=", "+=", "-="};
+    const char* op = operators[genNext(state) % 3];
+    if (genNext(state) % 2 == 0) {
+        fprintf(out, "v%d %s %d;", target, op, (int)(genNext(state) % 100));
+    } else {
+        fprintf(out, "v%d %s v%d;", target, op, (int)(genNext(state) % (unsigned)params->vars));
+    }
+}
+
+static void genLineEnd(FILE* out, unsigned long long* state, const GenParams* params) {
+    if (genPercent(state, params->comments)) {
+        fputs(" *", out);
+        genText(out, state, 8 + (int)(genNext(state) % 24));
+        fputc('*', out);
+    }
+    fputc('\n', out);
+}
+
+static int genIndent(int depth) {
+    return (depth < GEN_MAX_INDENT ? depth : GEN_MAX_INDENT) * 2;
+}
+
+// Returns the number of lines written
+static long long generateProgram(FILE* out, const GenParams* params) {
+    unsigned long long state = params->seed * 0x9E3779B97F4A7C15ULL + 1;
+    long long lines = 0;
+    for (int i = 0; i < params->vars; i++, lines++) {
+        fprintf(out, "number v%d;", i);
+        genLineEnd(out, &state, params);
+    }
+    int depth = 0;
+    int inBlock = 0;    // statements in the innermost open block
+    while (lines + depth < params->lines) {
+        unsigned roll = (unsigned)(genNext(&state) % 8);
+        if (depth > 0 && inBlock > 0 && roll == 0) {
+            depth--;
+            fprintf(out, "%*s}", genIndent(depth), "");
+            inBlock = 1;
+        } else if (depth < params->depth && roll == 1) {
+            fprintf(out, "%*srepeat %d times {", genIndent(depth), "", params->trips);
+            depth++;
+            inBlock = 0;
+        } else {
+            fprintf(out, "%*s", genIndent(depth), "");
+            genStatement(out, &state, params);
+            inBlock++;
+        }
+        genLineEnd(out, &state, params);
+        lines++;
+    }
+    while (depth > 0) {
+        depth--;
+        fprintf(out, "%*s}\n", genIndent(depth), "");
+        lines++;
+    }
+    return lines;
+}
+
+static int writeGenerated(const char* filename, const GenParams* params) {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        printf("File cannot be created: %s\n", filename);
+        return 0;
+    }
+    long long lines = generateProgram(out, params);
+    long size = ftell(out);
+    fclose(out);
+    fprintf(stderr, "generated %s: %lld lines, %ld bytes\n", filename, lines, size);
+    return 1;
+}
+
+// Benchmark suite (--bench-suite)
+//
+// Runs lex, parse, optimize and execute as separate timed phases, each run
+// starting from a clean state, and reports the distribution as JSON or CSV.
+// Without a file it runs a fixed matrix of generated corpora. Program output
+// goes to /dev/null; with --engine=vm the execute phase includes compiling
+// the bytecode.
+typedef enum {
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_OPTIMIZE,
+    PHASE_EXECUTE,
+    PHASE_COUNT
+} BenchPhase;
+
+static const char* phaseNames[PHASE_COUNT] = {"lex", "parse", "optimize", "execute"};
+
+typedef struct {
+    double min, median, mean, p90, p99, max;
+} PhaseStats;
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles over samples, which get sorted
+static PhaseStats phaseStats(double* samples, int count) {
+    qsort(samples, (size_t)count, sizeof(double), compareDoubles);
+    PhaseStats stats;
+    double sum = 0;
+    for (int i = 0; i < count; i++) sum += samples[i];
+    stats.min = samples[0];
+    stats.max = samples[count - 1];
+    stats.mean = sum / count;
+    stats.median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stats.p90 = samples[(count * 90 + 99) / 100 - 1];
+    stats.p99 = samples[(count * 99 + 99) / 100 - 1];
+    return stats;
+}
+
+typedef enum {
+    FORMAT_JSON,
+    FORMAT_CSV
+} BenchFormat;
+
+typedef struct {
+    int runs;
+    int optLevel;
+    int useVM;
+    BenchFormat format;
+    int results;    // records printed so far
+} BenchSuite;
+
+static void printJsonString(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 32) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// Times every phase of one file and prints its record
+static int benchCorpus(BenchSuite* suite, const char* label, const char* filename) {
+    SourceFile source;
+    if (!loadSource(filename, &source)) {
+        printf("File cannot be opened: %s\n", filename);
+        return 1;
+    }
+    double* samples = (double*)malloc(sizeof(double) * PHASE_COUNT * (size_t)suite->runs);
+    FILE* devNull = fopen("/dev/null", "w");
+    if (!samples || !devNull) {
+        fatal("Error: Out of memory\n");
+    }
+    sinkRedirect(&programOutput, fileno(devNull), FLUSH_BLOCK);
+
+    long long executed = 0;
+    for (int r = 0; r < suite->runs; r++) {
+        double* run = samples + (size_t)r * PHASE_COUNT;
+        jitRelease();
+        resetLexerState();
+        double start = nowSeconds();
+        lexBuffer(source.data, source.size);
+        run[PHASE_LEX] = nowSeconds() - start;
+        if (blockCount > 0) {
+            fatal("Error: Unclosed block opened on line %d\n", blockLine);
+        }
+
+        start = nowSeconds();
+        TreeNode* program = parseProgram();
+        resolveSymbols(program);
+        run[PHASE_PARSE] = nowSeconds() - start;
+
+        start = nowSeconds();
+        optimizeProgram(program, suite->optLevel, 0);
+        run[PHASE_OPTIMIZE] = nowSeconds() - start;
+
+        free(slots);
+        slots = (long long*)calloc((size_t)symbol_count + 1, sizeof(long long));
+        start = nowSeconds();
+        if (suite->useVM) {
+            Chunk chunk = compileProgram(program);
+            executed = runChunk(&chunk);
+            freeChunk(&chunk);
+        } else {
+            executeProgram(program);
+        }
+        sinkFlush(&programOutput);
+        run[PHASE_EXECUTE] = nowSeconds() - start;
+    }
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    fclose(devNull);
+
+    PhaseStats stats[PHASE_COUNT];
+    double* column = (double*)malloc(sizeof(double) * (size_t)suite->runs);
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        for (int r = 0; r < suite->runs; r++) column[r] = samples[(size_t)r * PHASE_COUNT + phase];
+        stats[phase] = phaseStats(column, suite->runs);
+    }
+    free(column);
+    free(samples);
+
+    const char* engine = suite->useVM ? "vm" : (jitThreshold > 0 ? "jit" : "tree");
+    if (suite->format == FORMAT_CSV) {
+        if (suite->results == 0) {
+            printf("corpus,engine,opt,runs,bytes,tokens,nodes,phase,min_ms,median_ms,mean_ms,p90_ms,p99_ms,max_ms\n");
+        }
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const PhaseStats* s = &stats[phase];
+            printf("\"%s\",%s,%d,%d,%zu,%zu,%u,%s,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", label, engine,
+                   suite->optLevel, suite->runs, source.size, token_count, ast.node_count, phaseNames[phase],
+                   s->min * 1e3, s->median * 1e3, s->mean * 1e3, s->p90 * 1e3, s->p99 * 1e3, s->max * 1e3);
+        }
+    } else {
+        printf("%s\n    {\"corpus\": ", suite->results == 0 ? "" : ",");
+        printJsonString(stdout, label);
+        printf(", \"engine\": \"%s\", \"opt\": %d, \"runs\": %d,\n", engine, suite->optLevel, suite->runs);
+        printf("     \"bytes\": %zu, \"tokens\": %zu, \"nodes\": %u", source.size, token_count, ast.node_count);
+        if (suite->useVM) printf(", \"ops\": %lld", executed);
+        printf(",\n     \"phases\": {");
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const PhaseStats* s = &stats[phase];
+            printf("%s\n       \"%s\": {\"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f, "
+                   "\"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}",
+                   phase == 0 ? "" : ",", phaseNames[phase], s->min * 1e3, s->median * 1e3, s->mean * 1e3,
+                   s->p90 * 1e3, s->p99 * 1e3, s->max * 1e3);
+        }
+        printf("}}");
+    }
+    suite->results++;
+    unloadSource(&source);
+    return 0;
+}
+
+// Corpora of the default matrix, each varies one dimension of the baseline
+static const char* suiteSpecs[] = {
+    "lines=20000,depth=0,writes=20",
+    "lines=20000,depth=3,trips=3",
+    "lines=20000,depth=6,trips=2",
+    "lines=20000,writes=80,strlen=32",
+    "lines=20000,vars=1000",
+    "lines=20000,comments=90",
+    "lines=200000,depth=2,trips=2",
+};
+
+static int benchSuite(BenchSuite* suite, const char* filename) {
+    int status = 0;
+    if (suite->format == FORMAT_JSON) printf("{\"results\": [");
+    if (filename) {
+        status = benchCorpus(suite, filename, filename);
+    } else {
+        char path[] = "/tmp/ppp-bench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            printf("Cannot create temporary files\n");
+            return 1;
+        }
+        close(fd);
+        for (size_t i = 0; i < sizeof(suiteSpecs) / sizeof(suiteSpecs[0]) && status == 0; i++) {
+            GenParams params;
+            parseGenSpec(suiteSpecs[i], &params);
+            if (!writeGenerated(path, &params)) {
+                status = 1;
+                break;
+            }
+            status = benchCorpus(suite, suiteSpecs[i], path);
+        }
+        unlink(path);
+    }
+    if (suite->format == FORMAT_JSON) printf("\n]}\n");
+    return status;
+}
+
+// --bench-cache: process startup to exit, without the cache, with an empty
+// cache (parse and store), with a warm cache and with cached output. Runs
+// this binary on the file with its output going to /dev/null.
+#ifndef _WIN32
+static double timeProcess(char* const* args) {
+    double start = nowSeconds();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, 1);
+        dup2(devNull, 2);
+        execv(args[0], args);
+        _exit(127);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    return nowSeconds() - start;
+}
+
+static int benchCache(const char* self, const char* name, const char* filename, int runs, int optLevel, int useVM) {
+    SourceFile source;
+    if (!loadSource(filename, &source)) {
+        printf("File cannot be opened: %s\n", filename);
+        return 1;
+    }
+    char dir[] = "/tmp/ppp-cache-XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("Cannot create temporary files\n");
+        return 1;
+    }
+    ProgramCache cache;
+    cacheOpen(&cache, dir, &source, optLevel);
+    unloadSource(&source);
+
+    char optFlag[8], cacheFlag[64];
+    snprintf(optFlag, sizeof(optFlag), "-O%d", optLevel);
+    snprintf(cacheFlag, sizeof(cacheFlag), "--cache=%s", dir);
+    char* engineFlag = useVM ? "--engine=vm" : "--engine=tree";
+    char* plain[] = {(char*)self, optFlag, engineFlag, (char*)name, NULL};
+    char* cached[] = {(char*)self, optFlag, engineFlag, cacheFlag, (char*)name, NULL};
+    char* output[] = {(char*)self, optFlag, engineFlag, cacheFlag, "--cache-output", (char*)name, NULL};
+    const char* labels[4] = {"no cache", "cold cache", "warm cache", "warm + output"};
+    char** variants[4] = {plain, cached, cached, output};
+
+    double* samples = (double*)malloc(sizeof(double) * (size_t)runs);
+    int status = 0;
+    printf("file: %s, %d runs per variant, startup to exit\n", filename, runs);
+    printf("%-14s %10s %10s %10s\n", "", "min ms", "median ms", "p90 ms");
+    for (int v = 0; v < 4 && status == 0; v++) {
+        if (v == 3 && timeProcess(output) < 0) status = 1;   // stores the output
+        for (int r = 0; r < runs && status == 0; r++) {
+            if (v == 1) remove(cache.path);
+            samples[r] = timeProcess(variants[v]);
+            if (samples[r] < 0) status = 1;
+        }
+        if (status != 0) break;
+        PhaseStats stats = phaseStats(samples, runs);
+        printf("%-14s %10.3f %10.3f %10.3f\n", labels[v], stats.min * 1e3, stats.median * 1e3, stats.p90 * 1e3);
+    }
+    if (status != 0) printf("Benchmark run failed\n");
+    free(samples);
+    remove(cache.path);
+    remove(cache.outputPath);
+    rmdir(dir);
+    return status;
+}
+#endif
+
+// Run statistics (--stats)
+//
+// Wall and CPU time, peak RSS and allocations per phase, plus cycles,
+// instructions and cache misses from perf_event_open where the kernel
+// allows it. Printed on stderr, or written as JSON with --stats=file.
+typedef enum {
+    STATS_READ,
+    STATS_CACHE,
+    STATS_LEX,
+    STATS_PARSE,
+    STATS_OPTIMIZE,
+    STATS_PRINT,
+    STATS_EXECUTE,
+    STATS_PHASES
+} StatsPhase;
+
+static const char* statsPhaseNames[STATS_PHASES] = {"read", "cache", "lex", "parse", "optimize", "print-tree", "execute"};
+
+#define STATS_COUNTERS 3
+static const char* statsCounterNames[STATS_COUNTERS] = {"cycles", "instructions", "cache_misses"};
+
+typedef struct {
+    int ran;
+    double wall, cpu;
+    long peakRssKb;
+    unsigned long long allocs, allocBytes;
+    unsigned long long counters[STATS_COUNTERS];
+} PhaseRecord;
+
+typedef struct {
+    int enabled;
+    const char* jsonPath;           // NULL: report on stderr
+    int counterFds[STATS_COUNTERS]; // -1 when unavailable
+    PhaseRecord phases[STATS_PHASES];
+    // Values at statsBegin()
+    double wallStart, cpuStart;
+    unsigned long long allocStart, allocBytesStart;
+    unsigned long long counterStart[STATS_COUNTERS];
+} RunStats;
+
+static THREAD_LOCAL RunStats run_stats = {0, NULL, {-1, -1, -1}, {{0}}, 0, 0, 0, 0, {0}};
+
+static double cpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static long peakRssKb() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+static unsigned long long readCounter(int fd) {
+    unsigned long long value = 0;
+    if (fd >= 0 && read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) value = 0;
+    return value;
+}
+
+static void statsOpen(const char* jsonPath) {
+    run_stats.enabled = 1;
+    run_stats.jsonPath = jsonPath;
+#ifdef __linux__
+    static const unsigned long long configs[STATS_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        run_stats.counterFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static void statsBegin() {
+    if (!run_stats.enabled) return;
+    for (int i = 0; i < STATS_COUNTERS; i++) run_stats.counterStart[i] = readCounter(run_stats.counterFds[i]);
+    run_stats.allocStart = alloc_count;
+    run_stats.allocBytesStart = alloc_bytes;
+    run_stats.cpuStart = cpuSeconds();
+    run_stats.wallStart = nowSeconds();
+}
+
+// Adds everything since statsBegin() to phase
+static void statsEnd(StatsPhase phase) {
+    if (!run_stats.enabled) return;
+    double wall = nowSeconds();
+    double cpu = cpuSeconds();
+    PhaseRecord* record = &run_stats.phases[phase];
+    record->ran = 1;
+    record->wall += wall - run_stats.wallStart;
+    record->cpu += cpu - run_stats.cpuStart;
+    record->allocs += alloc_count - run_stats.allocStart;
+    record->allocBytes += alloc_bytes - run_stats.allocBytesStart;
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        record->counters[i] += readCounter(run_stats.counterFds[i]) - run_stats.counterStart[i];
+    }
+    record->peakRssKb = peakRssKb();
+}
+
+static long long countStatements(const TreeNode* root) {
+    long long count = 0;
+    uint32_t* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (uint32_t*)growArray(stack, &capacity, 1, sizeof(uint32_t));
+    stack[depth++] = (uint32_t)(root - ast.nodes);
+    while (depth > 0) {
+        const TreeNode* node = &ast.nodes[stack[--depth]];
+        count += node->type >= NODE_DECLARATION && node->type <= NODE_LOOP;
+        stack = (uint32_t*)growArray(stack, &capacity, depth + (uint32_t)node->child_count, sizeof(uint32_t));
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[depth++] = ast.children[node->first_child + (uint32_t)i];
+        }
+    }
+    free(stack);
+    return count;
+}
+
+static void statsReport(const char* filename, TreeNode* program, const char* engine) {
+    if (!run_stats.enabled) return;
+    long long statements = program ? countStatements(program) : 0;
+    int haveCounters = 0;
+    for (int i = 0; i < STATS_COUNTERS; i++) haveCounters |= run_stats.counterFds[i] >= 0;
+    PhaseRecord total;
+    memset(&total, 0, sizeof(total));
+    for (int p = 0; p < STATS_PHASES; p++) {
+        const PhaseRecord* record = &run_stats.phases[p];
+        total.wall += record->wall;
+        total.cpu += record->cpu;
+        total.allocs += record->allocs;
+        total.allocBytes += record->allocBytes;
+        for (int i = 0; i < STATS_COUNTERS; i++) total.counters[i] += record->counters[i];
+    }
+    total.peakRssKb = peakRssKb();
+
+    FILE* out = stderr;
+    if (run_stats.jsonPath) {
+        out = fopen(run_stats.jsonPath, "w");
+        if (!out) {
+            fprintf(stderr, "File cannot be created: %s\n", run_stats.jsonPath);
+            return;
+        }
+        fprintf(out, "{\"file\": ");
+        printJsonString(out, filename);
+        fprintf(out, ", \"engine\": \"%s\",\n", engine);
+        fprintf(out, " \"tokens\": %zu, \"atoms\": %u, \"nodes\": %u, \"statements\": %lld, \"variables\": %d,\n",
+                token_count, atom_count, ast.node_count, statements, symbol_count);
+        fprintf(out, " \"phases\": {");
+        const char* separator = "";
+        for (int p = 0; p <= STATS_PHASES; p++) {
+            const PhaseRecord* record = p < STATS_PHASES ? &run_stats.phases[p] : &total;
+            if (p < STATS_PHASES && !record->ran) continue;
+            fprintf(out, "%s\n  \"%s\": {\"wall_ms\": %.4f, \"cpu_ms\": %.4f, \"peak_rss_kb\": %ld, "
+                    "\"allocs\": %llu, \"alloc_bytes\": %llu",
+                    separator, p < STATS_PHASES ? statsPhaseNames[p] : "total", record->wall * 1e3,
+                    record->cpu * 1e3, record->peakRssKb, record->allocs, record->allocBytes);
+            for (int i = 0; i < STATS_COUNTERS; i++) {
+                if (run_stats.counterFds[i] >= 0) fprintf(out, ", \"%s\": %llu", statsCounterNames[i], record->counters[i]);
+                else fprintf(out, ", \"%s\": null", statsCounterNames[i]);
+            }
+            fprintf(out, "}");
+            separator = ",";
+        }
+        fprintf(out, "}}\n");
+        fclose(out);
+        return;
+    }
+
+    fprintf(out, "=== STATS: %s (%s) ===\n", filename, engine);
+    fprintf(out, "tokens %zu, atoms %u, nodes %u, statements %lld, variables %d\n", token_count, atom_count,
+            ast.node_count, statements, symbol_count);
+    fprintf(out, "%-11s %10s %10s %10s %9s %12s", "phase", "wall ms", "cpu ms", "rss KB", "allocs", "alloc bytes");
+    if (haveCounters) fprintf(out, " %14s %14s %12s", "cycles", "instructions", "cache misses");
+    fputc('\n', out);
+    for (int p = 0; p <= STATS_PHASES; p++) {
+        const PhaseRecord* record = p < STATS_PHASES ? &run_stats.phases[p] : &total;
+        if (p < STATS_PHASES && !record->ran) continue;
+        fprintf(out, "%-11s %10.3f %10.3f %10ld %9llu %12llu", p < STATS_PHASES ? statsPhaseNames[p] : "total",
+                record->wall * 1e3, record->cpu * 1e3, record->peakRssKb, record->allocs, record->allocBytes);
+        for (int i = 0; i < STATS_COUNTERS && haveCounters; i++) {
+            if (run_stats.counterFds[i] >= 0) fprintf(out, " %*llu", i == 2 ? 12 : 14, record->counters[i]);
+            else fprintf(out, " %*s", i == 2 ? 12 : 14, "-");
+        }
+        fputc('\n', out);
+    }
+    if (!haveCounters) fprintf(out, "hardware counters: unavailable\n");
+}
+
+// Nesting benchmark (--bench-depth): lexes, parses and runs programs of
+// 1000, 10000, ... nested one-trip loops around a single statement, up to
+// maxDepth. The tokens are parsed again for each of the -O0 tree walker,
+// -O1, -O2 and the VM; their columns are optimize (or compile) plus run
+// time. Time and memory per level should stay flat.
+static const char* benchDepthModes[] = {"O0 ms", "O1 ms", "O2 ms", "vm ms"};
+#define BENCH_DEPTH_MODES 4
+
+static int benchDepth(int maxDepth) {
+    printf("%10s %10s %10s", "depth", "lex ms", "parse ms");
+    for (int m = 0; m < BENCH_DEPTH_MODES; m++) printf(" %10s", benchDepthModes[m]);
+    printf(" %12s %12s %12s\n", "ns/level", "peak RSS MB", "bytes/level");
+    int ok = 1;
+    for (long long depth = 1000; depth <= maxDepth; depth = depth * 10 > maxDepth && depth < maxDepth ? maxDepth : depth * 10) {
+        static const char open[] = "repeat 1 times {\n";
+        size_t size = sizeof("number x;\n") - 1 + (size_t)depth * (sizeof(open) - 1 + 2) + sizeof("x += 1;\nwrite x;\n");
+        char* source = (char*)malloc(size);
+        char* p = source;
+        p += sprintf(p, "number x;\n");
+        for (long long i = 0; i < depth; i++, p += sizeof(open) - 1) memcpy(p, open, sizeof(open) - 1);
+        p += sprintf(p, "x += 1;\n");
+        for (long long i = 0; i < depth; i++, p += 2) memcpy(p, "}\n", 2);
+        p += sprintf(p, "write x;\n");
+
+        resetLexerState();
+        double start = nowSeconds();
+        lexBuffer(source, (size_t)(p - source));
+        double lexTime = nowSeconds() - start;
+        double parseTime = 0, runTime[BENCH_DEPTH_MODES];
+        for (int m = 0; m < BENCH_DEPTH_MODES; m++) {
+            current_token_index = 0;
+            start = nowSeconds();
+            TreeNode* program = parseProgram();
+            resolveSymbols(program);
+            if (m == 0) parseTime = nowSeconds() - start;
+            free(slots);
+            slots = (long long*)calloc((size_t)symbol_count + 1, sizeof(long long));
+            sinkRedirect(&programOutput, -1, FLUSH_EXIT);
+            start = nowSeconds();
+            if (m == 1 || m == 2) optimizeProgram(program, m, 0);
+            if (m == 3) {
+                Chunk chunk = compileProgram(program);
+                runChunk(&chunk);
+                freeChunk(&chunk);
+            } else {
+                executeProgram(program);
+            }
+            runTime[m] = nowSeconds() - start;
+            if (programOutput.used != 1 || programOutput.data[0] != '1') ok = 0;
+            programOutput.used = 0;
+        }
+
+        size_t bytes = sizeof(Token) * token_capacity + sizeof(TreeNode) * ast.node_capacity +
+                       sizeof(uint32_t) * (ast.child_capacity + ast.pending_capacity) + sizeof(LoopInfo) * ast.loop_capacity +
+                       sizeof(BracePair) * brace_capacity + sizeof(ParseFrame) * parse_capacity +
+                       sizeof(ExecFrame) * exec_capacity;
+        printf("%10lld %10.1f %10.1f", depth, lexTime * 1e3, parseTime * 1e3);
+        for (int m = 0; m < BENCH_DEPTH_MODES; m++) printf(" %10.1f", runTime[m] * 1e3);
+        printf(" %12.1f %12.1f %12.1f\n", (lexTime + parseTime + runTime[0]) * 1e9 / (double)depth,
+               (double)peakRssKb() / 1024.0, (double)bytes / (double)depth);
+        free(source);
+    }
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    printf("output:     %s\n", ok ? "correct" : "WRONG");
+    return ok ? 0 : 1;
+}
+
+// Server mode (--serve)
+//
+// A daemon on a Unix-domain socket, one request per connection:
+//   "RUN <path>\n"             runs the script at path
+//   "SRC <length>\n<source>"   runs the source that follows
+// The reply is "ERR <message>" when the script does not compile, else "OK\n"
+// and the program output as it is produced, in "D <length>\n<bytes>"
+// frames. The last frame is "END\n" when the program ran to the end and
+// "STOP <message>\n" when a --max-* limit stopped it. The accepting thread
+// queues connections for a pool of workers. Every worker compiles and runs
+// on its own thread-local interpreter state; compiled images live in a
+// store shared by all of them, keyed like --cache by the source contents,
+// and are installed without copying the tree.
+#ifndef _WIN32
+#define SERVE_MAX_SOURCE (64u << 20)
+#define SERVE_BUCKETS 1024
+
+typedef struct ServedProgram {
+    PppProgram* program;
+    int users;                       // requests running it right now
+    struct ServedProgram* newer;     // LRU list
+    struct ServedProgram* older;
+    struct ServedProgram* bucket_next;
+} ServedProgram;
+
+typedef struct {
+    pthread_mutex_t lock;
+    ServedProgram* buckets[SERVE_BUCKETS];
+    ServedProgram* newest;
+    ServedProgram* oldest;
+    size_t bytes;
+    size_t limit;                    // idle images are dropped past this
+    unsigned long long hits, misses;
+} ProgramStore;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int* fds;
+    int head, count, capacity;
+} ConnectionQueue;
+
+typedef struct {
+    ProgramStore store;
+    ConnectionQueue queue;
+    PppOptions options;
+} Server;
+
+static int sameProgramKey(const ProgramKey* a, const ProgramKey* b) {
+    return a->key == b->key && a->check == b->check && a->source_size == b->source_size &&
+           a->opt_level == b->opt_level;
+}
+
+static void storeUnlink(ProgramStore* store, ServedProgram* entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else store->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else store->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void storePushNewest(ProgramStore* store, ServedProgram* entry) {
+    entry->older = store->newest;
+    entry->newer = NULL;
+    if (store->newest) store->newest->newer = entry;
+    store->newest = entry;
+    if (!store->oldest) store->oldest = entry;
+}
+
+// Drops idle images, least recently used first, until the store fits
+static void storeEvict(ProgramStore* store) {
+    ServedProgram* entry = store->oldest;
+    while (entry && store->bytes > store->limit) {
+        ServedProgram* newer = entry->newer;
+        if (entry->users == 0) {
+            ServedProgram** link = &store->buckets[entry->program->id.key % SERVE_BUCKETS];
+            while (*link != entry) link = &(*link)->bucket_next;
+            *link = entry->bucket_next;
+            storeUnlink(store, entry);
+            store->bytes -= entry->program->size;
+            ppp_free(entry->program);
+            free(entry);
+        }
+        entry = newer;
+    }
+}
+
+// Returns the image compiled from id, held until storeRelease(), or NULL
+static ServedProgram* storeAcquire(ProgramStore* store, const ProgramKey* id) {
+    pthread_mutex_lock(&store->lock);
+    ServedProgram* entry = store->buckets[id->key % SERVE_BUCKETS];
+    while (entry && !sameProgramKey(&entry->program->id, id)) entry = entry->bucket_next;
+    if (entry) {
+        entry->users++;
+        storeUnlink(store, entry);
+        storePushNewest(store, entry);
+        store->hits++;
+    } else {
+        store->misses++;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return entry;
+}
+
+// Adds a freshly compiled program and holds it. If another worker compiled
+// the same source meanwhile, that one is kept and program is freed.
+static ServedProgram* storeInsert(ProgramStore* store, PppProgram* program) {
+    pthread_mutex_lock(&store->lock);
+    ServedProgram** bucket = &store->buckets[program->id.key % SERVE_BUCKETS];
+    ServedProgram* entry = *bucket;
+    while (entry && !sameProgramKey(&entry->program->id, &program->id)) entry = entry->bucket_next;
+    if (entry) {
+        ppp_free(program);
+    } else {
+        entry = (ServedProgram*)calloc(1, sizeof(ServedProgram));
+        entry->program = program;
+        entry->bucket_next = *bucket;
+        *bucket = entry;
+        storePushNewest(store, entry);
+        store->bytes += program->size;
+    }
+    entry->users++;
+    pthread_mutex_unlock(&store->lock);
+    return entry;
+}
+
+static void storeRelease(ProgramStore* store, ServedProgram* entry) {
+    pthread_mutex_lock(&store->lock);
+    entry->users--;
+    storeEvict(store);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// Sends all of text, 0 if the peer went away
+static int sendAll(int fd, const char* text, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, text, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        text += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+
+// Reads a request. For RUN the path is returned in *path; for SRC the
+// source in *source. Both are malloc'd. 0 on a malformed request.
+static int readRequest(int fd, char** path, char** source, size_t* sourceSize) {
+    size_t capacity = 4096, used = 0;
+    char* buffer = (char*)malloc(capacity);
+    char* newline = NULL;
+    while (!newline) {
+        if (used == capacity) break;
+        ssize_t n = read(fd, buffer + used, capacity - used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        newline = (char*)memchr(buffer + used, '\n', (size_t)n);
+        used += (size_t)n;
+    }
+    if (!newline) {
+        free(buffer);
+        return 0;
+    }
+    *newline = '\0';
+    size_t rest = used - (size_t)(newline + 1 - buffer);
+    if (strncmp(buffer, "RUN ", 4) == 0) {
+        *path = strdup(buffer + 4);
+        free(buffer);
+        return 1;
+    }
+    // The line ends at the terminator put over its newline, so the prefix
+    // check cannot read past it and strtoull() only sees the line
+    if (strncmp(buffer, "SRC ", 4) != 0 || !isdigit((unsigned char)buffer[4])) {
+        free(buffer);
+        return 0;
+    }
+    char* end;
+    unsigned long long length = strtoull(buffer + 4, &end, 10);
+    if (*end != '\0' || length > SERVE_MAX_SOURCE || rest > length) {
+        free(buffer);
+        return 0;
+    }
+    char* text = (char*)malloc(length ? (size_t)length : 1);
+    memcpy(text, newline + 1, rest);
+    free(buffer);
+    while (rest < length) {
+        ssize_t n = read(fd, text + rest, (size_t)length - rest);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            free(text);
+            return 0;
+        }
+        rest += (size_t)n;
+    }
+    *source = text;
+    *sourceSize = (size_t)length;
+    return 1;
+}
+
+// ppp_run() with the output in frames
+static int serveRun(PppContext* context, const PppProgram* program, int fd) {
+    PppRun* run = pppStart(context, program, fd, 0);
+    if (!run) {
+        snprintf(context->error, sizeof(context->error), "Error: Out of memory\n");
+        return -1;
+    }
+    run->output.framed = 1;
+    int status;
+    while ((status = ppp_resume(context, run)) == 1) {
+    }
+    return status;
+}
+
+static void serveRequest(Server* server, PppContext* context, int fd) {
+    char* path = NULL;
+    char* inlineSource = NULL;
+    SourceFile source = {NULL, 0, 0};
+    if (!readRequest(fd, &path, &inlineSource, &source.size)) {
+        sendAll(fd, "ERR Malformed request\n", 22);
+        return;
+    }
+    if (path) {
+        if (!loadSource(path, &source)) {
+            char message[4200];
+            int length = snprintf(message, sizeof(message), "ERR File cannot be opened: %s\n", path);
+            sendAll(fd, message, (size_t)length < sizeof(message) ? (size_t)length : sizeof(message) - 1);
+            free(path);
+            return;
+        }
+        free(path);
+    } else {
+        source.data = inlineSource;
+    }
+
+    ProgramKey id;
+    programKey(&id, source.data, source.size, server->options.opt_level);
+    ServedProgram* entry = storeAcquire(&server->store, &id);
+    if (!entry) {
+        PppProgram* program = pppCompileKeyed(context, &id, source.data, source.size);
+        if (!program) {
+            sendAll(fd, "ERR ", 4);
+            sendAll(fd, ppp_error(context), strlen(ppp_error(context)));
+            unloadSource(&source);
+            return;
+        }
+        entry = storeInsert(&server->store, program);
+    }
+    unloadSource(&source);
+    if (sendAll(fd, "OK\n", 3)) {
+        if (serveRun(context, entry->program, fd) == 0) {
+            sendAll(fd, "END\n", 4);
+        } else {
+            const char* message = ppp_error(context);
+            size_t length = strlen(message);
+            if (length > 0 && message[length - 1] == '\n') length--;
+            if (sendAll(fd, "STOP ", 5) && sendAll(fd, message, length)) sendAll(fd, "\n", 1);
+        }
+    }
+    storeRelease(&server->store, entry);
+}
+
+static void* serveWorker(void* argument) {
+    Server* server = (Server*)argument;
+    ConnectionQueue* queue = &server->queue;
+    PppContext* context = ppp_context_new(&server->options);
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == 0) pthread_cond_wait(&queue->ready, &queue->lock);
+        int fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_mutex_unlock(&queue->lock);
+        serveRequest(server, context, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void queuePush(ConnectionQueue* queue, int fd) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity) {
+        // Unwrap into a larger ring
+        int capacity = queue->capacity ? queue->capacity * 2 : 64;
+        int* fds = (int*)malloc(sizeof(int) * (size_t)capacity);
+        for (int i = 0; i < queue->count; i++) fds[i] = queue->fds[(queue->head + i) % queue->capacity];
+        free(queue->fds);
+        queue->fds = fds;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->fds[(queue->head + queue->count) % queue->capacity] = fd;
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static char serve_socket_path[108];
+
+static void serveStop(int signalNumber) {
+    (void)signalNumber;
+    unlink(serve_socket_path);
+    _exit(0);
+}
+
+static int socketAddress(struct sockaddr_un* address, const char* path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        printf("Socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+static int serve(const char* socketPath, int workers, size_t cacheLimit, const PppOptions* options) {
+    struct sockaddr_un address;
+    if (!socketAddress(&address, socketPath)) return 1;
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 256) != 0) {
+        printf("Cannot listen on %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+    snprintf(serve_socket_path, sizeof(serve_socket_path), "%s", socketPath);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, serveStop);
+    signal(SIGTERM, serveStop);
+
+    static Server server;
+    pthread_mutex_init(&server.store.lock, NULL);
+    pthread_mutex_init(&server.queue.lock, NULL);
+    pthread_cond_init(&server.queue.ready, NULL);
+    server.store.limit = cacheLimit;
+    server.options = *options;
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serveWorker, &server) != 0) {
+            printf("Cannot start worker threads\n");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    fprintf(stderr, "serving on %s with %d workers\n", socketPath, workers);
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+            printf("accept: %s\n", strerror(errno));
+            return 1;
+        }
+        queuePush(&server.queue, fd);
+    }
+}
+
+// Client side (--client): sends one request, returns the connected socket
+static int sendRequest(const char* socketPath, const char* header, size_t headerLength,
+                       const char* source, size_t sourceSize) {
+    struct sockaddr_un address;
+    if (!socketAddress(&address, socketPath)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        !sendAll(fd, header, headerLength) || (source && !sendAll(fd, source, sourceSize))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+typedef struct {
+    const char* socketPath;
+    const char* header;
+    size_t headerLength;
+    const char* source;
+    size_t sourceSize;
+    int requests;
+    double* latencies;
+    unsigned long long bytes;
+    int failures;
+} ClientLoad;
+
+// Buffered reader for a server reply
+typedef struct {
+    int fd;
+    size_t position;
+    size_t length;
+    char data[65536];
+} ReplyReader;
+
+static int replyFill(ReplyReader* reader) {
+    ssize_t n;
+    while ((n = read(reader->fd, reader->data, sizeof(reader->data))) < 0 && errno == EINTR) {
+    }
+    reader->position = 0;
+    reader->length = n > 0 ? (size_t)n : 0;
+    return n > 0;
+}
+
+// The next line without its newline; a last line may lack it. 0 at the
+// end of the reply or when the line does not fit.
+static int replyLine(ReplyReader* reader, char* line, size_t size) {
+    size_t used = 0;
+    for (;;) {
+        if (reader->position == reader->length && !replyFill(reader)) {
+            if (used == 0) return 0;
+            break;
+        }
+        char c = reader->data[reader->position++];
+        if (c == '\n') break;
+        if (used + 1 == size) return 0;
+        line[used++] = c;
+    }
+    line[used] = '\0';
+    return 1;
+}
+
+// Reads a whole reply. The output, and the message of an error or a limit
+// stop, go to out unless it is NULL. Returns 1 when the program ran to the
+// end.
+static int readReply(int fd, FILE* out, unsigned long long* bytes) {
+    ReplyReader reader;
+    char line[4400];
+    reader.fd = fd;
+    reader.position = reader.length = 0;
+    if (!replyLine(&reader, line, sizeof(line))) return 0;
+    if (strcmp(line, "OK") != 0) {
+        if (out) fprintf(out, "%s\n", line);
+        return 0;
+    }
+    while (replyLine(&reader, line, sizeof(line))) {
+        if (strcmp(line, "END") == 0) return 1;
+        if (strncmp(line, "STOP ", 5) == 0) {
+            if (out) fprintf(out, "%s\n", line + 5);
+            return 0;
+        }
+        char* end;
+        unsigned long long length = strtoull(line + 2, &end, 10);
+        if (strncmp(line, "D ", 2) != 0 || *end != '\0') return 0;
+        while (length > 0) {
+            if (reader.position == reader.length && !replyFill(&reader)) return 0;
+            size_t n = reader.length - reader.position;
+            if (n > length) n = (size_t)length;
+            if (out) fwrite(reader.data + reader.position, 1, n, out);
+            reader.position += n;
+            length -= n;
+            *bytes += n;
+        }
+    }
+    return 0;   // cut off
+}
+
+// One connection of the load generator: its share of the requests, back to
+// back. A request fails unless its program ran to the end.
+static void* clientLoadThread(void* argument) {
+    ClientLoad* load = (ClientLoad*)argument;
+    for (int r = 0; r < load->requests; r++) {
+        double start = nowSeconds();
+        int fd = sendRequest(load->socketPath, load->header, load->headerLength, load->source, load->sourceSize);
+        if (fd < 0 || !readReply(fd, NULL, &load->bytes)) load->failures++;
+        if (fd >= 0) close(fd);
+        load->latencies[r] = nowSeconds() - start;
+    }
+    return NULL;
+}
+
+// --client: sends name.ppp (by path, or inline with --inline) to a server.
+// A single request prints the output and exits non-zero unless the program
+// ran to the end; with --requests/--concurrency it is a load generator
+// reporting throughput and latency.
+static int runClient(const char* socketPath, const char* filename, int inlineSource, int requests, int concurrency) {
+    char header[4200];
+    int headerLength;
+    SourceFile source = {NULL, 0, 0};
+    if (inlineSource) {
+        if (!loadSource(filename, &source)) {
+            printf("File cannot be opened: %s\n", filename);
+            return 1;
+        }
+        headerLength = snprintf(header, sizeof(header), "SRC %zu\n", source.size);
+    } else {
+        char full[4096];
+        if (!realpath(filename, full)) {
+            printf("File cannot be opened: %s\n", filename);
+            return 1;
+        }
+        headerLength = snprintf(header, sizeof(header), "RUN %s\n", full);
+    }
+
+    if (requests <= 1) {
+        int fd = sendRequest(socketPath, header, (size_t)headerLength, source.data, source.size);
+        if (fd < 0) {
+            printf("Cannot connect to %s\n", socketPath);
+            return 1;
+        }
+        unsigned long long bytes = 0;
+        int ok = readReply(fd, stdout, &bytes);
+        close(fd);
+        unloadSource(&source);
+        return !ok;
+    }
+
+    if (concurrency < 1) concurrency = 1;
+    if (concurrency > requests) concurrency = requests;
+    ClientLoad* loads = (ClientLoad*)calloc((size_t)concurrency, sizeof(ClientLoad));
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)concurrency);
+    double* latencies = (double*)malloc(sizeof(double) * (size_t)requests);
+    int assigned = 0;
+    for (int i = 0; i < concurrency; i++) {
+        ClientLoad* load = &loads[i];
+        load->socketPath = socketPath;
+        load->header = header;
+        load->headerLength = (size_t)headerLength;
+        load->source = source.data;
+        load->sourceSize = source.size;
+        load->requests = requests / concurrency + (i < requests % concurrency);
+        load->latencies = latencies + assigned;
+        assigned += load->requests;
+    }
+    double start = nowSeconds();
+    for (int i = 0; i < concurrency; i++) pthread_create(&threads[i], NULL, clientLoadThread, &loads[i]);
+    int failures = 0;
+    unsigned long long bytes = 0;
+    for (int i = 0; i < concurrency; i++) {
+        pthread_join(threads[i], NULL);
+        failures += loads[i].failures;
+        bytes += loads[i].bytes;
+    }
+    double elapsed = nowSeconds() - start;
+    PhaseStats stats = phaseStats(latencies, requests);
+    printf("requests:     %d (%d failed), %d connections, %s\n", requests, failures, concurrency,
+           inlineSource ? "inline source" : "by path");
+    printf("throughput:   %.0f requests/s, %.2f MB/s of output\n", requests / elapsed,
+           (double)bytes / elapsed / (1024.0 * 1024.0));
+    printf("latency ms:   min %.3f  median %.3f  p90 %.3f  p99 %.3f  max %.3f\n", stats.min * 1e3,
+           stats.median * 1e3, stats.p90 * 1e3, stats.p99 * 1e3, stats.max * 1e3);
+    free(latencies);
+    free(threads);
+    free(loads);
+    unloadSource(&source);
+    return failures != 0;
+}
+
+// Batch mode (--batch dir -j N)
+//
+// Runs every .ppp script of a directory through the embedding API on a pool
+// of threads. Scripts are dealt round-robin onto per-thread deques; a thread
+// takes from the front of its own and, once that is empty, steals from the
+// back of the others, which holds the scripts needed last. Each script's
+// output is collected in its own buffer, so workers never share a sink, and
+// the main thread prints the buffers in name order as they complete. With
+// --slice a thread runs a script for one slice and puts it back at the end
+// of its deque, so long scripts take turns instead of holding threads.
+typedef struct {
+    char* name;
+    char* output;
+    size_t size;
+    char* error;
+    PppProgram* program;   // --slice: between slices
+    PppRun* run;
+    int done;
+} BatchScript;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int* tasks;        // ring of capacity entries, head and tail only grow
+    int capacity;
+    int head;
+    int tail;
+} TaskDeque;
+
+typedef struct {
+    const char* directory;
+    BatchScript* scripts;
+    TaskDeque* deques;
+    int threads;
+    PppOptions options;
+    pthread_mutex_t lock;   // guards done, for the printer
+    pthread_cond_t finished;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int index;
+    int steals;
+} BatchWorker;
+
+static int compareNames(const void* a, const void* b) {
+    return strcmp(((const BatchScript*)a)->name, ((const BatchScript*)b)->name);
+}
+
+// Next script for worker self: its own oldest, else another one's newest
+static int batchNext(Batch* batch, int self, int* stolen) {
+    for (int k = 0; k < batch->threads; k++) {
+        TaskDeque* deque = &batch->deques[(self + k) % batch->threads];
+        int task = -1;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->head < deque->tail) {
+            int at = k == 0 ? deque->head++ : --deque->tail;
+            task = deque->tasks[at % deque->capacity];
+        }
+        pthread_mutex_unlock(&deque->lock);
+        if (task >= 0) {
+            *stolen = k != 0;
+            return task;
+        }
+    }
+    return -1;
+}
+
+static void batchRequeue(Batch* batch, int self, int task) {
+    TaskDeque* deque = &batch->deques[self];
+    pthread_mutex_lock(&deque->lock);
+    deque->tasks[deque->tail++ % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static void* batchWorker(void* argument) {
+    BatchWorker* worker = (BatchWorker*)argument;
+    Batch* batch = worker->batch;
+    PppContext* context = ppp_context_new(&batch->options);
+    int stolen;
+    int task;
+    while ((task = batchNext(batch, worker->index, &stolen)) >= 0) {
+        BatchScript* script = &batch->scripts[task];
+        worker->steals += stolen;
+        if (!script->program) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", batch->directory, script->name);
+            SourceFile source = {NULL, 0, 0};
+            if (!loadSource(path, &source)) {
+                char message[4200];
+                snprintf(message, sizeof(message), "File cannot be opened: %s\n", path);
+                script->error = strdup(message);
+            } else {
+                script->program = ppp_compile(context, source.data, source.size);
+                unloadSource(&source);
+                if (!script->program) script->error = strdup(ppp_error(context));
+            }
+            if (script->program && batch->options.slice_steps > 0) {
+                script->run = ppp_start(context, script->program, -1);
+            }
+        }
+        if (script->program) {
+            int status;
+            if (script->run) {
+                status = ppp_resume(context, script->run);
+                if (status == 1) {
+                    batchRequeue(batch, worker->index, task);
+                    continue;
+                }
+                script->run = NULL;
+            } else {
+                status = ppp_run(context, script->program, -1);
+            }
+            ppp_free(script->program);
+            script->program = NULL;
+            script->output = context->output;
+            script->size = context->output_size;
+            context->output = NULL;
+            context->output_size = 0;
+            if (status < 0) script->error = strdup(ppp_error(context));
+        }
+        pthread_mutex_lock(&batch->lock);
+        script->done = 1;
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
+    }
+    ppp_context_free(context);
+    return NULL;
+}
+
+static int runBatch(const char* directory, int threads, const PppOptions* options) {
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        printf("Directory cannot be opened: %s\n", directory);
+        return 1;
+    }
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    int count = 0;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || strcmp(entry->d_name + length - 4, ".ppp") != 0) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch.scripts = (BatchScript*)realloc(batch.scripts, sizeof(BatchScript) * (size_t)capacity);
+        }
+        memset(&batch.scripts[count], 0, sizeof(BatchScript));
+        batch.scripts[count++].name = strdup(entry->d_name);
+    }
+    closedir(dir);
+    if (count > 0) qsort(batch.scripts, (size_t)count, sizeof(BatchScript), compareNames);
+
+    if (threads > count) threads = count > 0 ? count : 1;
+    batch.directory = directory;
+    batch.threads = threads;
+    batch.options = *options;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+    batch.deques = (TaskDeque*)calloc((size_t)threads, sizeof(TaskDeque));
+    for (int t = 0; t < threads; t++) {
+        TaskDeque* deque = &batch.deques[t];
+        pthread_mutex_init(&deque->lock, NULL);
+        // With --slice, scripts go back to the deque of whoever ran them last
+        deque->capacity = options->slice_steps > 0 ? count : count / threads + 1;
+        deque->tasks = (int*)malloc(sizeof(int) * (size_t)deque->capacity);
+        for (int i = t; i < count; i += threads) deque->tasks[deque->tail++] = i;
+    }
+
+    double start = nowSeconds();
+    BatchWorker* workers = (BatchWorker*)calloc((size_t)threads, sizeof(BatchWorker));
+    pthread_t* handles = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)threads);
+    for (int t = 0; t < threads; t++) {
+        workers[t].batch = &batch;
+        workers[t].index = t;
+        if (pthread_create(&handles[t], NULL, batchWorker, &workers[t]) != 0) {
+            printf("Cannot start worker threads\n");
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        BatchScript* script = &batch.scripts[i];
+        pthread_mutex_lock(&batch.lock);
+        while (!script->done) pthread_cond_wait(&batch.finished, &batch.lock);
+        pthread_mutex_unlock(&batch.lock);
+        printf("==> %s <==\n", script->name);
+        // A script stopped by a limit has both
+        if (script->output) fwrite(script->output, 1, script->size, stdout);
+        if (script->error) {
+            fputs(script->error, stdout);
+            failures++;
+        }
+        free(script->output);
+        free(script->error);
+        free(script->name);
+    }
+    fflush(stdout);
+
+    int steals = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(handles[t], NULL);
+        steals += workers[t].steals;
+        free(batch.deques[t].tasks);
+    }
+    double elapsed = nowSeconds() - start;
+    fprintf(stderr, "batch: %d scripts (%d failed) on %d threads in %.3f s, %.0f scripts/s, %d stolen\n",
+            count, failures, threads, elapsed, elapsed > 0 ? count / elapsed : 0.0, steals);
+    free(handles);
+    free(workers);
+    free(batch.deques);
+    free(batch.scripts);
+    return failures != 0;
+}
+#endif
+
+// Native code generation (--emit, -o)
+//
+// Two backends translate the resolved parse tree ahead of time:
+//  - x86-64 Linux assembly with its own syscall-based buffered writer, linked
+//    into a static executable that needs no libc,
+//  - portable C with the same buffered writer on top of stdio, for other
+//    platforms or when asked for with --emit=c.
+// The emitted program prints exactly what executeProgram() would, as long
+// as the numbers fit 64 bits. Literals that do not are refused at build
+// time; an addition or subtraction that leaves the range flushes the output
+// and stops the program with an error, where the interpreter would switch
+// to arbitrary precision.
+typedef enum {
+    BACKEND_ASM,
+    BACKEND_C
+} Backend;
+
+#if defined(__x86_64__) && defined(__linux__)
+#define DEFAULT_BACKEND BACKEND_ASM
+#else
+#define DEFAULT_BACKEND BACKEND_C
+#endif
+
+// Line of the first literal that native code cannot hold, or -1
+static int nativeBigLiteral(TreeNode* root) {
+    int line = -1;
+    uint32_t* stack = NULL;
+    uint32_t depth = 0, capacity = 0;
+    stack = (uint32_t*)growArray(stack, &capacity, 1, sizeof(uint32_t));
+    stack[depth++] = (uint32_t)(root - ast.nodes);
+    while (depth > 0 && line < 0) {
+        TreeNode* node = &ast.nodes[stack[--depth]];
+        if (node->type == NODE_NUMBER && node->number == BIG_TAG) {
+            // LLONG_MIN itself is tagged too, but native code holds it
+            errno = 0;
+            strtoll(atomText(node->atom), NULL, 10);
+            if (errno == ERANGE) line = node->line_number;
+        }
+        stack = (uint32_t*)growArray(stack, &capacity, depth + (uint32_t)node->child_count, sizeof(uint32_t));
+        for (int i = node->child_count - 1; i >= 0; i--) {
+            stack[depth++] = ast.children[node->first_child + (uint32_t)i];
+        }
+    }
+    free(stack);
+    return line;
+}
+
+// Writes a string literal's bytes in an assembler/C friendly escaped form
+static void emitEscaped(FILE* out, const char* text) {
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 32 || *p >= 127) fprintf(out, "\\%03o", *p);
+        else fputc(*p, out);
+    }
+}
+
+// Register allocation: every variable and loop counter gets a weight of
+// 16^depth per use, the heaviest ones live in callee-saved registers so the
+// write runtime calls do not clobber them.
+#define NATIVE_REGISTERS 5
+static const char* nativeRegisters[NATIVE_REGISTERS] = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+static const char* nativeRegisters32[NATIVE_REGISTERS] = {"%ebx", "%r12d", "%r13d", "%r14d", "%r15d"};
+
+typedef struct {
+    double* slotWeight;
+    double* counterWeight;
+    int counterCount;
+    int* slotRegister;     // register index or -1
+    int* counterRegister;  // register index or -1
+    int labelCount;
+    int stringCount;
+} NativeContext;
+
+// Walk state of the native backend: the loop depth a node sits at, and
+// for the emitters the label of a loop whose closing code is still due
+typedef struct {
+    uint32_t node;
+    int depth;
+    int label;     // >= 0: close loop .Lloop<label>, node is that loop
+    double weight;
+} NativeFrame;
+
+static NativeFrame* pushNativeChildren(NativeFrame* stack, uint32_t* top, uint32_t* capacity,
+                                       const TreeNode* node, int depth, double weight) {
+    stack = (NativeFrame*)growArray(stack, capacity, *top + (uint32_t)node->child_count, sizeof(NativeFrame));
+    for (int i = node->child_count - 1; i >= 0; i--) {
+        stack[(*top)++] = (NativeFrame){ast.children[node->first_child + (uint32_t)i], depth, -1, weight};
+    }
+    return stack;
+}
+
+static void weighUses(NativeContext* ctx, TreeNode* program) {
+    NativeFrame* stack = NULL;
+    uint32_t top = 0, capacity = 0;
+    stack = pushNativeChildren(stack, &top, &capacity, program, 0, 1.0);
+    while (top > 0) {
+        NativeFrame frame = stack[--top];
+        TreeNode* node = &ast.nodes[frame.node];
+        if (node->type == NODE_VARIABLE) {
+            ctx->slotWeight[node->slot] += frame.weight;
+        } else if (node->type == NODE_LOOP) {
+            int depth = frame.depth;
+            if (depth + 1 > ctx->counterCount) ctx->counterCount = depth + 1;
+            ctx->counterWeight[depth] += frame.weight * 16;
+            stack = (NativeFrame*)growArray(stack, &capacity, top + 2, sizeof(NativeFrame));
+            if (node->child_count > 1) stack[top++] = (NativeFrame){ast.children[node->first_child + 1], depth + 1, -1, frame.weight * 16};
+            if (node->child_count > 0) stack[top++] = (NativeFrame){ast.children[node->first_child], depth, -1, frame.weight};
+        } else {
+            stack = pushNativeChildren(stack, &top, &capacity, node, frame.depth, frame.weight);
+        }
+    }
+    free(stack);
+}
+
+static int maxLoopDepth(TreeNode* program) {
+    int deepest = 0;
+    NativeFrame* stack = NULL;
+    uint32_t top = 0, capacity = 0;
+    stack = pushNativeChildren(stack, &top, &capacity, program, 0, 0);
+    while (top > 0) {
+        NativeFrame frame = stack[--top];
+        TreeNode* node = &ast.nodes[frame.node];
+        int depth = frame.depth + (node->type == NODE_LOOP);
+        if (depth > deepest) deepest = depth;
+        stack = pushNativeChildren(stack, &top, &capacity, node, depth, 0);
+    }
+    free(stack);
+    return deepest;
+}
+
+static void allocateRegisters(NativeContext* ctx, TreeNode* program) {
+    int depth = maxLoopDepth(program);
+    ctx->slotWeight = (double*)calloc((size_t)symbol_count + 1, sizeof(double));
+    ctx->counterWeight = (double*)calloc((size_t)depth + 1, sizeof(double));
+    ctx->slotRegister = (int*)malloc(sizeof(int) * ((size_t)symbol_count + 1));
+    ctx->counterRegister = (int*)malloc(sizeof(int) * ((size_t)depth + 1));
+    ctx->counterCount = 0;
+    ctx->labelCount = 0;
+    ctx->stringCount = 0;
+    weighUses(ctx, program);
+
+    for (int i = 0; i < symbol_count; i++) ctx->slotRegister[i] = -1;
+    for (int i = 0; i < ctx->counterCount; i++) ctx->counterRegister[i] = -1;
+    for (int r = 0; r < NATIVE_REGISTERS; r++) {
+        double best = 0;
+        int bestSlot = -1, bestCounter = -1;
+        for (int i = 0; i < symbol_count; i++) {
+            if (ctx->slotRegister[i] < 0 && ctx->slotWeight[i] > best) {
+                best = ctx->slotWeight[i];
+                bestSlot = i;
+                bestCounter = -1;
+            }
+        }
+        for (int i = 0; i < ctx->counterCount; i++) {
+            if (ctx->counterRegister[i] < 0 && ctx->counterWeight[i] > best) {
+                best = ctx->counterWeight[i];
+                bestCounter = i;
+                bestSlot = -1;
+            }
+        }
+        if (bestSlot >= 0) ctx->slotRegister[bestSlot] = r;
+        else if (bestCounter >= 0) ctx->counterRegister[bestCounter] = r;
+        else break;
+    }
+}
+
+static void freeNativeContext(NativeContext* ctx) {
+    free(ctx->slotWeight);
+    free(ctx->counterWeight);
+    free(ctx->slotRegister);
+    free(ctx->counterRegister);
+}
+
+// Operand text for a variable: its register or its .bss slot
+static void asmSlot(NativeContext* ctx, int slot, char* buf, size_t size) {
+    if (ctx->slotRegister[slot] >= 0) {
+        snprintf(buf, size, "%s", nativeRegisters[ctx->slotRegister[slot]]);
+    } else {
+        snprintf(buf, size, "ppp_slots+%d(%%rip)", slot * 8);
+    }
+}
+
+static void asmCounter(NativeContext* ctx, int depth, char* buf, size_t size) {
+    if (ctx->counterRegister[depth] >= 0) {
+        snprintf(buf, size, "%s", nativeRegisters[ctx->counterRegister[depth]]);
+    } else {
+        snprintf(buf, size, "%d(%%rbp)", -48 - depth * 8);
+    }
+}
+
+static int fitsImm32(long long value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Loads a number or variable into %rax
+static void asmLoadRax(FILE* out, NativeContext* ctx, TreeNode* value) {
+    char operand[64];
+    if (value->type == NODE_NUMBER) {
+        if (value->number == 0) fprintf(out, "\txorl %%eax, %%eax\n");
+        else if (fitsImm32(value->number)) fprintf(out, "\tmovq $%lld, %%rax\n", value->number);
+        else fprintf(out, "\tmovabsq $%lld, %%rax\n", value->number);
+    } else {
+        asmSlot(ctx, value->slot, operand, sizeof(operand));
+        fprintf(out, "\tmovq %s, %%rax\n", operand);
+    }
+}
+
+// Assignments and writes
+static void asmFlat(FILE* out, NativeContext* ctx, TreeNode* node, FILE* strings) {
+    char target[64], operand[64];
+
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count < 2) break;
+            const char* op = node->type == NODE_ASSIGNMENT ? "movq" :
+                             node->type == NODE_INCREMENT ? "addq" : "subq";
+            TreeNode* value = childAt(node, 1);
+            asmSlot(ctx, childAt(node, 0)->slot, target, sizeof(target));
+            int targetInRegister = ctx->slotRegister[childAt(node, 0)->slot] >= 0;
+            if (value->type == NODE_NUMBER && fitsImm32(value->number)) {
+                fprintf(out, "\t%s $%lld, %s\n", op, value->number, target);
+            } else if (value->type == NODE_VARIABLE && (targetInRegister || ctx->slotRegister[value->slot] >= 0)) {
+                asmSlot(ctx, value->slot, operand, sizeof(operand));
+                fprintf(out, "\t%s %s, %s\n", op, operand, target);
+            } else {
+                asmLoadRax(out, ctx, value);
+                fprintf(out, "\t%s %%rax, %s\n", op, target);
+            }
+            if (node->type != NODE_ASSIGNMENT) fprintf(out, "\tjo ppp_overflow\n");
+            break;
+        }
+        case NODE_WRITE: {
+            for (int i = 0; i < node->child_count; i++) {
+                TreeNode* child = childAt(node, i);
+                if (child->type == NODE_STRING) {
+                    int id = ctx->stringCount++;
+                    fprintf(strings, ".Lstr%d:\n\t.ascii \"", id);
+                    emitEscaped(strings, atomText(child->atom));
+                    fprintf(strings, "\"\n");
+                    fprintf(out, "\tleaq .Lstr%d(%%rip), %%rsi\n", id);
+                    fprintf(out, "\tmovl $%zu, %%edx\n", (size_t)atomLength(child->atom));
+                    fprintf(out, "\tcall ppp_write_str\n");
+                } else if (child->type == NODE_VARIABLE) {
+                    asmSlot(ctx, child->slot, operand, sizeof(operand));
+                    fprintf(out, "\tmovq %s, %%rdi\n", operand);
+                    fprintf(out, "\tcall ppp_write_int\n");
+                } else if (child->type == NODE_NEWLINE) {
+                    fprintf(out, "\tcall ppp_newline\n");
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void asmStatements(FILE* out, NativeContext* ctx, TreeNode* program, FILE* strings) {
+    char operand[64];
+    NativeFrame* stack = NULL;
+    uint32_t top = 0, capacity = 0;
+    stack = pushNativeChildren(stack, &top, &capacity, program, 0, 0);
+    while (top > 0) {
+        NativeFrame frame = stack[--top];
+        TreeNode* node = &ast.nodes[frame.node];
+        if (frame.label >= 0) {
+            asmCounter(ctx, frame.depth, operand, sizeof(operand));
+            fprintf(out, "\tdecq %s\n", operand);
+            fprintf(out, "\tjnz .Lloop%d\n", frame.label);
+            fprintf(out, ".Lend%d:\n", frame.label);
+            continue;
+        }
+        if (node->type == NODE_BLOCK) {
+            stack = pushNativeChildren(stack, &top, &capacity, node, frame.depth, 0);
+            continue;
+        }
+        if (node->type != NODE_LOOP) {
+            asmFlat(out, ctx, node, strings);
+            continue;
+        }
+        if (node->child_count < 2) continue;
+        int label = ctx->labelCount++;
+        TreeNode* count = childAt(node, 0);
+        asmCounter(ctx, frame.depth, operand, sizeof(operand));
+        if (count->type == NODE_NUMBER) {
+            if (count->number <= 0) continue;
+            if (fitsImm32(count->number)) {
+                fprintf(out, "\tmovq $%lld, %s\n", count->number, operand);
+            } else {
+                asmLoadRax(out, ctx, count);
+                fprintf(out, "\tmovq %%rax, %s\n", operand);
+            }
+        } else {
+            asmLoadRax(out, ctx, count);
+            fprintf(out, "\ttestq %%rax, %%rax\n");
+            fprintf(out, "\tjle .Lend%d\n", label);
+            fprintf(out, "\tmovq %%rax, %s\n", operand);
+        }
+        fprintf(out, ".Lloop%d:\n", label);
+        stack = (NativeFrame*)growArray(stack, &capacity, top + 2, sizeof(NativeFrame));
+        stack[top++] = (NativeFrame){frame.node, frame.depth, label, 0};
+        stack[top++] = (NativeFrame){ast.children[node->first_child + 1], frame.depth + 1, -1, 0};
+    }
+    free(stack);
+}
+
+// Buffered writer for the assembly backend, straight on top of write(2)
+static const char* asmRuntime =
+    "\t.bss\n"
+    "\t.p2align 4\n"
+    "ppp_buf:\n\t.zero 65536\n"
+    "ppp_len:\n\t.zero 8\n"
+    "\t.text\n"
+    "# write(1, rsi, rdx) until everything is out\n"
+    "ppp_write_all:\n"
+    "1:\ttestq %rdx, %rdx\n\tjz 2f\n"
+    "\tmovl $1, %eax\n\tmovl $1, %edi\n\tsyscall\n"
+    "\ttestq %rax, %rax\n\tjle 2f\n"
+    "\taddq %rax, %rsi\n\tsubq %rax, %rdx\n\tjmp 1b\n"
+    "2:\tret\n"
+    "ppp_flush:\n"
+    "\tleaq ppp_buf(%rip), %rsi\n\tmovq ppp_len(%rip), %rdx\n"
+    "\tcall ppp_write_all\n"
+    "\tmovq $0, ppp_len(%rip)\n\tret\n"
+    "# rsi = text, rdx = length; long strings bypass the buffer\n"
+    "ppp_write_str:\n"
+    "\tmovq ppp_len(%rip), %rax\n\tleaq (%rax,%rdx), %rcx\n"
+    "\tcmpq $65536, %rcx\n\tjbe 1f\n"
+    "\tpushq %rsi\n\tpushq %rdx\n\tcall ppp_flush\n\tpopq %rdx\n\tpopq %rsi\n"
+    "\tcmpq $65536, %rdx\n\tjae ppp_write_all\n"
+    "1:\tmovq ppp_len(%rip), %rax\n\tleaq ppp_buf(%rip), %rdi\n\taddq %rax, %rdi\n"
+    "\taddq %rdx, %rax\n\tmovq %rax, ppp_len(%rip)\n"
+    "\tmovq %rdx, %rcx\n\trep movsb\n\tret\n"
+    "ppp_newline:\n"
+    "\tmovq ppp_len(%rip), %rax\n\tcmpq $65536, %rax\n\tjb 1f\n"
+    "\tcall ppp_flush\n\txorl %eax, %eax\n"
+    "1:\tleaq ppp_buf(%rip), %rcx\n\tmovb $10, (%rcx,%rax)\n"
+    "\tincq %rax\n\tmovq %rax, ppp_len(%rip)\n\tret\n"
+    "# rdi = value, printed in decimal\n"
+    "ppp_write_int:\n"
+    "\tsubq $32, %rsp\n\tleaq 32(%rsp), %rsi\n"
+    "\tmovq %rdi, %rax\n\tmovq %rdi, %r8\n"
+    "\ttestq %rax, %rax\n\tjns 1f\n\tnegq %rax\n"
+    "1:\tmovl $10, %ecx\n"
+    "2:\txorl %edx, %edx\n\tdivq %rcx\n\taddb $48, %dl\n"
+    "\tdecq %rsi\n\tmovb %dl, (%rsi)\n\ttestq %rax, %rax\n\tjnz 2b\n"
+    "\ttestq %r8, %r8\n\tjns 3f\n\tdecq %rsi\n\tmovb $45, (%rsi)\n"
+    "3:\tleaq 32(%rsp), %rdx\n\tsubq %rsi, %rdx\n"
+    "\tcall ppp_write_str\n\taddq $32, %rsp\n\tret\n"
+    "# an addition or subtraction left 64 bits: the output so far, the error, exit(1)\n"
+    "ppp_overflow:\n"
+    "\tcall ppp_flush\n"
+    "\tleaq ppp_overflow_message(%rip), %rsi\n\tmovl $ppp_overflow_length, %edx\n"
+    "\tcall ppp_write_all\n"
+    "\tmovl $60, %eax\n\tmovl $1, %edi\n\tsyscall\n"
+    "\t.section .rodata\n"
+    "ppp_overflow_message:\n\t.ascii \"Error: Number exceeds 64 bits in native code\\n\"\n"
+    "\t.set ppp_overflow_length, . - ppp_overflow_message\n";
+
+static void emitAssembly(TreeNode* program, FILE* out, const char* sourceName) {
+    NativeContext ctx;
+    allocateRegisters(&ctx, program);
+    FILE* strings = tmpfile();
+
+    fprintf(out, "# Generated by ppp from %s\n", sourceName);
+    fprintf(out, "\t.text\n\t.globl _start\n");
+    fprintf(out, "_start:\n\tcall ppp_main\n\tcall ppp_flush\n");
+    fprintf(out, "\tmovl $60, %%eax\n\txorl %%edi, %%edi\n\tsyscall\n");
+    fprintf(out, "ppp_main:\n\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n");
+    for (int r = 0; r < NATIVE_REGISTERS; r++) {
+        fprintf(out, "\tpushq %s\n", nativeRegisters[r]);
+    }
+    int frame = ((ctx.counterCount * 8) + 15) & ~15;
+    if (frame) fprintf(out, "\tsubq $%d, %%rsp\n", frame);
+    for (int i = 0; i < symbol_count; i++) {
+        if (ctx.slotRegister[i] >= 0) {
+            const char* reg = nativeRegisters32[ctx.slotRegister[i]];
+            fprintf(out, "\txorl %s, %s\n", reg, reg);
+        }
+    }
+
+    asmStatements(out, &ctx, program, strings);
+
+    if (frame) fprintf(out, "\taddq $%d, %%rsp\n", frame);
+    for (int r = NATIVE_REGISTERS - 1; r >= 0; r--) {
+        fprintf(out, "\tpopq %s\n", nativeRegisters[r]);
+    }
+    fprintf(out, "\tpopq %%rbp\n\tret\n");
+    fputs(asmRuntime, out);
+
+    fprintf(out, "\t.bss\n\t.p2align 3\nppp_slots:\n\t.zero %d\n", (symbol_count + 1) * 8);
+    fprintf(out, "\t.section .rodata\n");
+    rewind(strings);
+    int c;
+    while ((c = fgetc(strings)) != EOF) fputc(c, out);
+    fclose(strings);
+    fprintf(out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+    freeNativeContext(&ctx);
+}
+
+// Buffered writer for the C backend
+static const char* cRuntime =
+    "#include <limits.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static char ppp_buf[65536];\n"
+    "static size_t ppp_len;\n"
+    "\n"
+    "static void ppp_flush(void) {\n"
+    "    fwrite(ppp_buf, 1, ppp_len, stdout);\n"
+    "    ppp_len = 0;\n"
+    "}\n"
+    "\n"
+    "static void ppp_write_str(const char* text, size_t length) {\n"
+    "    if (ppp_len + length > sizeof(ppp_buf)) {\n"
+    "        ppp_flush();\n"
+    "        if (length >= sizeof(ppp_buf)) {\n"
+    "            fwrite(text, 1, length, stdout);\n"
+    "            return;\n"
+    "        }\n"
+    "    }\n"
+    "    memcpy(ppp_buf + ppp_len, text, length);\n"
+    "    ppp_len += length;\n"
+    "}\n"
+    "\n"
+    "static void ppp_write_int(long long value) {\n"
+    "    char digits[24];\n"
+    "    char* p = digits + sizeof(digits);\n"
+    "    unsigned long long u = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;\n"
+    "    do {\n"
+    "        *--p = (char)('0' + u % 10);\n"
+    "        u /= 10;\n"
+    "    } while (u);\n"
+    "    if (value < 0) *--p = '-';\n"
+    "    ppp_write_str(p, (size_t)(digits + sizeof(digits) - p));\n"
+    "}\n"
+    "\n"
+    "/* An addition or subtraction left 64 bits */\n"
+    "static void ppp_overflow(void) {\n"
+    "    ppp_flush();\n"
+    "    fputs(\"Error: Number exceeds 64 bits in native code\\n\", stdout);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "static long long ppp_add(long long a, long long b) {\n"
+    "#ifdef __GNUC__\n"
+    "    long long sum;\n"
+    "    if (__builtin_add_overflow(a, b, &sum)) ppp_overflow();\n"
+    "    return sum;\n"
+    "#else\n"
+    "    if (b > 0 ? a > LLONG_MAX - b : a < LLONG_MIN - b) ppp_overflow();\n"
+    "    return a + b;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "static long long ppp_sub(long long a, long long b) {\n"
+    "#ifdef __GNUC__\n"
+    "    long long difference;\n"
+    "    if (__builtin_sub_overflow(a, b, &difference)) ppp_overflow();\n"
+    "    return difference;\n"
+    "#else\n"
+    "    if (b < 0 ? a > LLONG_MAX + b : a < LLONG_MIN + b) ppp_overflow();\n"
+    "    return a - b;\n"
+    "#endif\n"
+    "}\n";
+
+static void cValue(TreeNode* value, char* buf, size_t size) {
+    if (value->type == NODE_NUMBER) {
+        if (value->number == LLONG_MIN) snprintf(buf, size, "(-%lldLL - 1)", LLONG_MAX);
+        else snprintf(buf, size, "%lldLL", value->number);
+    } else {
+        snprintf(buf, size, "v%d", value->slot);
+    }
+}
+
+// Indentation stops growing past C_MAX_INDENT levels, otherwise deep
+// nesting would make the generated source quadratic in the depth
+#define C_MAX_INDENT 32
+
+static void cIndent(FILE* out, int level) {
+    if (level > C_MAX_INDENT) level = C_MAX_INDENT;
+    for (int i = 0; i < level; i++) fputs("    ", out);
+}
+
+// Assignments and writes
+static void cFlat(FILE* out, TreeNode* node, int level) {
+    char value[64];
+
+    switch (node->type) {
+        case NODE_ASSIGNMENT:
+        case NODE_INCREMENT:
+        case NODE_DECREMENT: {
+            if (node->child_count < 2) break;
+            int slot = childAt(node, 0)->slot;
+            cValue(childAt(node, 1), value, sizeof(value));
+            cIndent(out, level);
+            if (node->type == NODE_ASSIGNMENT) fprintf(out, "v%d = %s;\n", slot, value);
+            else fprintf(out, "v%d = ppp_%s(v%d, %s);\n", slot,
+                         node->type == NODE_INCREMENT ? "add" : "sub", slot, value);
+            break;
+        }
+        case NODE_WRITE: {
+            for (int i = 0; i < node->child_count; i++) {
+                TreeNode* child = childAt(node, i);
+                cIndent(out, level);
+                if (child->type == NODE_STRING) {
+                    fputs("ppp_write_str(\"", out);
+                    emitEscaped(out, atomText(child->atom));
+                    fprintf(out, "\", %zu);\n", (size_t)atomLength(child->atom));
+                } else if (child->type == NODE_VARIABLE) {
+                    fprintf(out, "ppp_write_int(v%d);\n", child->slot);
+                } else if (child->type == NODE_NEWLINE) {
+                    fputs("ppp_write_str(\"\\n\", 1);\n", out);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Loop counters are named after their depth, the body sits one level in
+static void cStatements(FILE* out, TreeNode* program) {
+    char value[64];
+    NativeFrame* stack = NULL;
+    uint32_t top = 0, capacity = 0;
+    stack = pushNativeChildren(stack, &top, &capacity, program, 0, 0);
+    while (top > 0) {
+        NativeFrame frame = stack[--top];
+        TreeNode* node = &ast.nodes[frame.node];
+        if (frame.label >= 0) {
+            cIndent(out, frame.depth + 1);
+            fputs("}\n", out);
+        } else if (node->type == NODE_BLOCK) {
+            stack = pushNativeChildren(stack, &top, &capacity, node, frame.depth, 0);
+        } else if (node->type != NODE_LOOP) {
+            cFlat(out, node, frame.depth + 1);
+        } else if (node->child_count >= 2) {
+            int depth = frame.depth;
+            cValue(childAt(node, 0), value, sizeof(value));
+            cIndent(out, depth + 1);
+            fprintf(out, "for (long long c%d = %s; c%d > 0; c%d--) {\n", depth, value, depth, depth);
+            stack = (NativeFrame*)growArray(stack, &capacity, top + 2, sizeof(NativeFrame));
+            stack[top++] = (NativeFrame){frame.node, depth, depth, 0};
+            stack[top++] = (NativeFrame){ast.children[node->first_child + 1], depth + 1, -1, 0};
+        }
+    }
+    free(stack);
+}
+
+static void emitC(TreeNode* program, FILE* out, const char* sourceName) {
+    fprintf(out, "/* Generated by ppp from %s */\n", sourceName);
+    fputs(cRuntime, out);
+    fputs("\nint main(void) {\n", out);
+    for (int i = 0; i < symbol_count; i++) {
+        fprintf(out, "    long long v%d = 0;\n", i);
+    }
+    cStatements(out, program);
+    fputs("    ppp_flush();\n    return 0;\n}\n", out);
+}
+
+// Generates code with the chosen backend and builds it with the local
+// toolchain ($CC, default cc) into a standalone executable.
+static int buildExecutable(TreeNode* program, Backend backend, const char* sourceName, const char* output) {
+#ifdef _WIN32
+    char sourcePath[512];
+    snprintf(sourcePath, sizeof(sourcePath), "%s%s", output, backend == BACKEND_ASM ? ".s" : ".c");
+    FILE* out = fopen(sourcePath, "w");
+#else
+    char sourcePath[] = "/tmp/pppXXXXXX.c";
+    if (backend == BACKEND_ASM) sourcePath[sizeof(sourcePath) - 2] = 's';
+    int fd = mkstemps(sourcePath, 2);
+    FILE* out = fd >= 0 ? fdopen(fd, "w") : NULL;
+#endif
+    if (!out) {
+        printf("Cannot create temporary file for code generation\n");
+        return 1;
+    }
+    if (backend == BACKEND_ASM) emitAssembly(program, out, sourceName);
+    else emitC(program, out, sourceName);
+    fclose(out);
+
+    const char* cc = getenv("CC");
+    if (!cc || !*cc) cc = "cc";
+    char command[2048];
+    if (backend == BACKEND_ASM) {
+        snprintf(command, sizeof(command), "%s -nostdlib -static -o '%s' '%s'", cc, output, sourcePath);
+    } else {
+        snprintf(command, sizeof(command), "%s -O2 -o '%s' '%s'", cc, output, sourcePath);
+    }
+    int status = system(command);
+    remove(sourcePath);
+    if (status != 0) {
+        printf("Native build failed: %s\n", command);
+        return 1;
+    }
+    return 0;
+}
+
+static void resetSlots() {
+    memset(slots, 0, sizeof(long long) * ((size_t)symbol_count + 1));
+}
+
+static int sameFileContents(FILE* a, FILE* b) {
+    rewind(a);
+    rewind(b);
+    int ca, cb;
+    do {
+        ca = fgetc(a);
+        cb = fgetc(b);
+    } while (ca == cb && ca != EOF);
+    return ca == cb;
+}
+
+// --bench-engine: tree walker vs bytecode VM on the same program, in ns per
+// executed VM instruction. Also checks that both produce the same output.
+static int benchEngines(TreeNode* program, int runs) {
+    Chunk chunk = compileProgram(program);
+
+    FILE* treeOut = tmpfile();
+    FILE* vmOut = tmpfile();
+    if (!treeOut || !vmOut) {
+        printf("Cannot create temporary files\n");
+        return 1;
+    }
+    sinkRedirect(&programOutput, fileno(treeOut), FLUSH_BLOCK);
+    resetSlots();
+    executeProgram(program);
+    sinkRedirect(&programOutput, fileno(vmOut), FLUSH_BLOCK);
+    resetSlots();
+    long long ops = runChunk(&chunk);
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    int same = sameFileContents(treeOut, vmOut);
+    fclose(treeOut);
+    fclose(vmOut);
+
+    FILE* devNull = fopen("/dev/null", "w");
+    sinkRedirect(&programOutput, fileno(devNull), FLUSH_BLOCK);
+    double treeBest = 0, vmBest = 0;
+    for (int r = 0; r < runs; r++) {
+        resetSlots();
+        double start = nowSeconds();
+        executeProgram(program);
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < treeBest) treeBest = elapsed;
+
+        resetSlots();
+        start = nowSeconds();
+        runChunk(&chunk);
+        elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < vmBest) vmBest = elapsed;
+    }
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    fclose(devNull);
+
+    printf("bytecode:     %d instructions, %lld executed\n", chunk.count, ops);
+    printf("tree walker:  %10.3f ms  %8.2f ns/op\n", treeBest * 1e3, treeBest * 1e9 / (double)ops);
+    printf("vm:           %10.3f ms  %8.2f ns/op\n", vmBest * 1e3, vmBest * 1e9 / (double)ops);
+    printf("speedup:      %10.2fx (best of %d runs)\n", treeBest / vmBest, runs);
+    printf("output:       %s\n", same ? "identical" : "DIFFERENT");
+    freeChunk(&chunk);
+    return same ? 0 : 1;
+}
+
+// --bench-jit: tree walker with and without the JIT. Every JIT run starts
+// from scratch, so its time includes compiling the hot loops.
+static int benchJit(TreeNode* program, int runs) {
+    int threshold = jitThreshold > 0 ? jitThreshold : JIT_DEFAULT_THRESHOLD;
+
+    FILE* treeOut = tmpfile();
+    FILE* jitOut = tmpfile();
+    if (!treeOut || !jitOut) {
+        printf("Cannot create temporary files\n");
+        return 1;
+    }
+    sinkRedirect(&programOutput, fileno(treeOut), FLUSH_BLOCK);
+    jitThreshold = 0;
+    resetSlots();
+    executeProgram(program);
+    sinkRedirect(&programOutput, fileno(jitOut), FLUSH_BLOCK);
+    jitThreshold = threshold;
+    resetSlots();
+    executeProgram(program);
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    int same = sameFileContents(treeOut, jitOut);
+    fclose(treeOut);
+    fclose(jitOut);
+
+    FILE* devNull = fopen("/dev/null", "w");
+    sinkRedirect(&programOutput, fileno(devNull), FLUSH_BLOCK);
+    double treeBest = 0, jitBest = 0, compileBest = 0;
+    int compiled = 0;
+    size_t codeBytes = 0;
+    for (int r = 0; r < runs; r++) {
+        jitThreshold = 0;
+        resetSlots();
+        double start = nowSeconds();
+        executeProgram(program);
+        double elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < treeBest) treeBest = elapsed;
+
+        jitThreshold = threshold;
+        jitReset();
+        jitRelease();
+        resetSlots();
+        start = nowSeconds();
+        executeProgram(program);
+        elapsed = nowSeconds() - start;
+        if (r == 0 || elapsed < jitBest) {
+            jitBest = elapsed;
+            compileBest = jitCompileSeconds;
+        }
+        compiled = jit_loops_compiled;
+        codeBytes = jit_code_bytes;
+    }
+    sinkRedirect(&programOutput, 1, FLUSH_BLOCK);
+    fclose(devNull);
+
+    printf("jit:          %d loops compiled, %zu bytes of code, threshold %d\n", compiled, codeBytes, threshold);
+    printf("interpreter:  %10.3f ms\n", treeBest * 1e3);
+    printf("jit total:    %10.3f ms (compile %.1f us)\n", jitBest * 1e3, compileBest * 1e6);
+    printf("speedup:      %10.2fx (best of %d runs)\n", treeBest / jitBest, runs);
+    printf("output:       %s\n", same ? "identical" : "DIFFERENT");
+    jitReset();
+    jitRelease();
+    return same ? 0 : 1;
+}
+
+// Streaming execution (--stream)
+//
+// Reads the source a window at a time and runs every top-level statement as
+// soon as all of its tokens are in, so memory follows the largest statement
+// instead of the file. Whole lines are lexed as they arrive; the statements
+// are then parsed one at a time. A statement that ran past the last token
+// read so far is undone and parsed again once more input is in, so each one
+// comes out as a parse of the whole file would make it. The statement with
+// a block still open is not tried until the block closes. The statements of
+// a window form a small program that is resolved, optimized starting from
+// the values the ones before left in the variables, run and dropped, and so
+// are the atoms only they used. An error is reported when it is reached,
+// after the output of everything before it.
+#define STREAM_WINDOW (1u << 20)
+
+typedef struct {
+    size_t slot_count;     // slots[] entries
+    uint32_t kept_atoms;   // atom_count after the last streamCompactAtoms()
+    size_t scanned;        // tokens looked at for braces
+    int depth;             // block depth after them
+    size_t open;           // token of the outermost open brace when depth > 0
+} StreamState;
+
+// Drops the atoms that only the statements already run used. Names and the
+// tokens still waiting keep theirs under new ids; literals are interned
+// again by the window that uses them. Runs once the table has doubled
+// since the last time, so the copying stays linear in the input.
+static void streamCompactAtoms(StreamState* state) {
+    if (atom_count < state->kept_atoms * 2 + 1024) return;
+    uint32_t* map = (uint32_t*)calloc(atom_count, sizeof(uint32_t));
+    for (uint32_t id = 0; id <= ATOM_CLOSE_BLOCK; id++) map[id] = 1;
+    for (uint32_t i = 0; symbols && i <= symbolMask; i++) {
+        if (symbols[i].atom) map[symbols[i].atom] = 1;
+    }
+    for (size_t i = 0; i < token_count; i++) map[tokens[i].atom] = 1;
+
+    // Kept atoms move down in id order, so the fixed ones stay where they are
+    PoolChunk* old = stringPool;
+    stringPool = NULL;
+    uint32_t count = 1;
+    for (uint32_t id = 1; id < atom_count; id++) {
+        if (!map[id]) continue;
+        atoms[count] = atoms[id];
+        atoms[count].text = poolCopy(atoms[id].text, (int)atoms[id].length);
+        map[id] = count++;
+    }
+    PoolChunk* fresh = stringPool;
+    stringPool = old;
+    poolReset();
+    stringPool = fresh;
+    atom_count = count;
+    fillAtomTable();
+
+    // Ids only go down, so they still fit Token.atom
+    for (size_t i = 0; i < token_count; i++) tokens[i].atom = map[tokens[i].atom];
+    if (symbols) {
+        Symbol* table = symbols;
+        symbols = (Symbol*)calloc((size_t)symbolMask + 1, sizeof(Symbol));
+        for (uint32_t i = 0; i <= symbolMask; i++) {
+            if (!table[i].atom) continue;
+            Symbol entry = {map[table[i].atom], table[i].slot};
+            *findSymbolEntry(entry.atom) = entry;
+        }
+        free(table);
+    }
+    free(map);
+    state->kept_atoms = count;
+}
+
+// Runs the complete statements among the tokens read so far, keeps the rest
+static void streamStatements(StreamState* state, int atEnd, int optLevel, int useVM) {
+    for (; state->scanned < token_count; state->scanned++) {
+        TokenType type = (TokenType)tokens[state->scanned].type;
+        if (type == TOKEN_OPEN_BLOCK && state->depth++ == 0) state->open = state->scanned;
+        if (type == TOKEN_CLOSE_BLOCK) state->depth--;
+    }
+    // The parser sees the tokens before the open block as all there is
+    size_t total = token_count;
+    if (state->depth > 0) token_count = state->open;
+    astReset();
+    uint32_t program = createNode(NODE_PROGRAM, ATOM_EMPTY, 1);
+    ErrorTrap trap;
+    error_trap = &trap;
+    while (current_token_index < token_count) {
+        // Where the statement starts, to undo it
+        int index = current_token_index;
+        Ast mark = ast;
+        tokens_exhausted = 0;
+        if (setjmp(trap.jump) == 0) {
+            uint32_t statement = parseStatement();
+            if (!tokens_exhausted || atEnd) {
+                if (statement != NO_NODE) addChild(statement);
+                continue;
+            }
+        } else if (!tokens_exhausted || atEnd) {
+            error_trap = NULL;
+            sinkFlush(&programOutput);
+            fatal("%s", trap.message);
+        }
+        current_token_index = index;
+        parse_depth = 0;
+        ast.node_count = mark.node_count;
+        ast.child_count = mark.child_count;
+        ast.pending_count = mark.pending_count;
+        ast.loop_count = mark.loop_count;
+        break;
+    }
+    error_trap = NULL;
+    token_count = total;
+    TreeNode* tree = &ast.nodes[endNode(program)];
+
+    if (tree->child_count > 0) {
+        resolveSymbols(tree);
+        if ((size_t)symbol_count + 1 > state->slot_count) {
+            size_t grown = (size_t)symbol_count + 1 + state->slot_count;
+            slots = (long long*)realloc(slots, sizeof(long long) * grown);
+            memset(slots + state->slot_count, 0, sizeof(long long) * (grown - state->slot_count));
+            state->slot_count = grown;
+        }
+        opt_entry_values = slots;
+        optimizeProgram(tree, optLevel, 0);
+        opt_entry_values = NULL;
+        if (useVM) {
+            Chunk chunk = compileProgram(tree);
+            runChunk(&chunk);
+            freeChunk(&chunk);
+        } else {
+            executeProgram(tree);
+        }
+        jitReset();
+        jitRelease();
+        if (programOutput.policy != FLUSH_EXIT) sinkFlush(&programOutput);
+    }
+
+    token_count -= current_token_index;
+    memmove(tokens, tokens + current_token_index, sizeof(Token) * (size_t)token_count);
+    state->scanned -= current_token_index;
+    state->open -= state->depth > 0 ? current_token_index : 0;
+    current_token_index = 0;
+    if (blockCount == 0) {
+        // Only --parse-threads reads the brace index
+        brace_count = 0;
+        brace_open = NO_BRACE;
+    }
+    streamCompactAtoms(state);
+}
+
+// lexRange() on a window, with the output so far written out before an error
+static void streamLex(const char* src, const char* end, const char* limit, int line) {
+    ErrorTrap trap;
+    error_trap = &trap;
+    if (setjmp(trap.jump) != 0) {
+        error_trap = NULL;
+        sinkFlush(&programOutput);
+        fatal("%s", trap.message);
+    }
+    lexRange(src, src, end, limit, line);
+    error_trap = NULL;
+}
+
+static int runStream(const char* filename, int optLevel, int useVM) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("File cannot be opened: %s\n", filename);
+        return 1;
+    }
+    size_t capacity = STREAM_WINDOW, filled = 0, start = 0;
+    char* buffer = (char*)malloc(capacity);
+    StreamState state;
+    memset(&state, 0, sizeof(state));
+    int line = 1;
+    int atEnd = 0;
+    int threads = parseThreads;
+    parseThreads = 1;
+
+    while (!atEnd) {
+        if (start > 0) {
+            memmove(buffer, buffer + start, filled - start);
+            filled -= start;
+            start = 0;
+        }
+        if (filled == capacity) {
+            capacity *= 2;
+            buffer = (char*)realloc(buffer, capacity);
+        }
+        size_t n = fread(buffer + filled, 1, capacity - filled, file);
+        filled += n;
+        if (n == 0) atEnd = 1;
+
+        // Whole lines only, and never the last one until the file ends: the
+        // lexer treats a newline at the very end differently
+        const char* end = buffer + filled;
+        if (!atEnd) {
+            while (end > buffer && end[-1] != '\n') end--;
+            if (end == buffer + filled && end > buffer) {
+                end--;
+                while (end > buffer && end[-1] != '\n') end--;
+            }
+            if (end == buffer) continue;
+        }
+        streamLex(buffer, end, buffer + filled, line);
+        for (const char* p = buffer; (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++) line++;
+        start = (size_t)(end - buffer);
+        if (atEnd && blockCount > 0) {
+            // As without --stream, the unclosed statement does not run
+            sinkFlush(&programOutput);
+            printf("Error: Unclosed block opened on line %d\n", blockLine);
+            exit(1);
+        }
+        streamStatements(&state, atEnd, optLevel, useVM);
+    }
+    fclose(file);
+    free(buffer);
+    parseThreads = threads;
+    sinkFlush(&programOutput);
+    return 0;
+}
+
+// Watch mode (--watch)
+//
+// Runs the program, then again after every save of the file, keeping what
+// the front end made of it in between. The source is split into units:
+// runs of whole lines whose top-level statements end on the unit's last
+// line at brace depth 0. A unit keeps its tokens, the names it declares and
+// its statements, parsed and resolved into the arena (ast), which otherwise
+// only grows. A save is compared with the text the units came from; the
+// lines between the common prefix and suffix are the change, and only the
+// units it touches are lexed and parsed again. When the new statements do
+// not end on a unit boundary (a brace left open, a statement without its
+// ';') the tokens of the following units are appended until they do, so
+// boundaries come from the brace structure and the parser, as for
+// --parse-threads. The units after the change keep their tokens and trees,
+// moved by the line and byte difference.
+//
+// Slots are handed out per name and never renumbered, so a resolved tree
+// stays valid. The lexer's declaration checks run against a table of the
+// names declared before the change; the units after it are checked again
+// only when the change declares other names. A save that does not compile
+// prints its error and leaves the last good program in place, and a run
+// stopped by a --max-* limit prints its error after its output. Each run is
+// followed by a line on stderr with what was parsed again and the time from
+// the save to the first output.
+#ifndef _WIN32
+#define WATCH_POLL_NS 100000000L   // between stat() calls where there is no inotify
+#define WATCH_COMPACT_MIN 65536     // dead arena nodes worth compacting
+
+typedef struct {
+    size_t begin;            // byte offset in the watched text
+    int line;                // line of begin
+    uint32_t token_begin;    // range of Watch.tokens
+    uint32_t token_count;
+    uint32_t decl_begin;     // names it declares, range of Watch.decls
+    uint32_t decl_count;
+    uint32_t root;           // NODE_PROGRAM holding its statements
+    // Its ranges of the arena, moved together when the arena is compacted
+    uint32_t node_begin;
+    uint32_t node_count;
+    uint32_t child_begin;
+    uint32_t child_count;
+    uint32_t loop_begin;
+    uint32_t loop_count;
+} WatchUnit;
+
+typedef struct {
+    Symbol* symbols;
+    uint32_t mask;
+    int count;
+} SymbolTable;
+
+typedef struct {
+    char* text;              // the source the units were made from
+    size_t size;
+    WatchUnit* units;
+    uint32_t unit_count;
+    uint32_t unit_capacity;
+    Token* tokens;
+    uint32_t token_count;
+    uint32_t token_capacity;
+    uint32_t* decls;
+    uint32_t decl_count;
+    uint32_t decl_capacity;
+    uint32_t live_nodes;     // arena nodes that belong to a unit
+    // Units of the region being parsed again, their tokens in tokens[]
+    WatchUnit* fresh;
+    uint32_t fresh_count;
+    uint32_t fresh_capacity;
+    uint32_t* fresh_decls;
+    uint32_t fresh_decl_count;
+    uint32_t fresh_decl_capacity;
+    SymbolTable declared;    // for the lexer's checks
+    int checking;            // declared is the symbol table right now
+    Ast run;                 // the copy an optimized run rewrites (-O1, -O2)
+    Chunk chunk;             // VM
+} Watch;
+
+// The units a save touches: [first, stop), whose text is now [begin, end)
+typedef struct {
+    uint32_t first;
+    uint32_t stop;
+    size_t begin;
+    size_t end;
+    int line;
+    long long byte_shift;
+    int line_shift;
+} WatchRegion;
+
+// What the last save took to bring the units up to date
+typedef struct {
+    int first_line;          // lines lexed again
+    int last_line;
+    uint32_t statements;     // top-level statements parsed again
+} WatchChange;
+
+// Puts table in place of the symbol table and the symbol table in table
+static void swapSymbols(SymbolTable* table) {
+    Symbol* entries = symbols;
+    uint32_t mask = symbolMask;
+    int count = symbol_count;
+    symbols = table->symbols;
+    symbolMask = table->mask;
+    symbol_count = table->count;
+    table->symbols = entries;
+    table->mask = mask;
+    table->count = count;
+}
+
+static void* spliceArray(void* array, uint32_t* count, uint32_t* capacity, size_t itemSize,
+                         uint32_t from, uint32_t to, const void* items, uint32_t itemCount) {
+    uint32_t total = *count - (to - from) + itemCount;
+    array = growArray(array, capacity, total ? total : 1, itemSize);
+    char* bytes = (char*)array;
+    memmove(bytes + (from + itemCount) * itemSize, bytes + to * itemSize, (*count - to) * itemSize);
+    if (itemCount) memcpy(bytes + from * itemSize, items, itemCount * itemSize);
+    *count = total;
+    return array;
+}
+
+static int lineStart(const char* text, size_t offset) {
+    return offset == 0 || text[offset - 1] == '\n';
+}
+
+static int countLines(const char* text, size_t size) {
+    int lines = 0;
+    const char* end = text + size;
+    for (const char* p = text; (p = (const char*)memchr(p, '\n', (size_t)(end - p))) != NULL; p++) lines++;
+    return lines;
+}
+
+// Number of units that begin before offset
+static uint32_t unitsBefore(const Watch* w, size_t offset) {
+    uint32_t low = 0, high = w->unit_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (w->units[middle].begin < offset) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Tokens lexed before, moved to where their text is now
+static void appendTokens(const Token* from, uint32_t count, long long byteShift, int lineShift) {
+    while (token_count + count > token_capacity) {
+        token_capacity = token_capacity ? token_capacity * 2 : 4096;
+        tokens = (Token*)realloc(tokens, sizeof(Token) * token_capacity);
+        if (!tokens) fatal("Error: Out of memory\n");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        Token token = from[i];
+        token.offset = (uint32_t)((long long)token.offset + byteShift);
+        token.line_number += lineShift;
+        tokens[token_count++] = token;
+    }
+}
+
+// The lexer's declaration checks, again, over tokens lexed before
+static void checkDeclarations(const Token* list, uint32_t count, int lineShift) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (list[i].type != TOKEN_IDENTIFIER) continue;
+        if (i > 0 && list[i - 1].type == TOKEN_KEYWORD && list[i - 1].atom == ATOM_NUMBER) {
+            declareSymbol(list[i].atom);
+        } else if (lookupSymbol(list[i].atom) < 0) {
+            fatal("Error on line %d: Undefine variable '%s'\n", list[i].line_number + lineShift, atomText(list[i].atom));
+        }
+    }
+}
+
+static int compareAtoms(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Whether two lists hold the same names, in any order
+static int sameNames(const uint32_t* a, const uint32_t* b, uint32_t count) {
+    uint32_t* sorted = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (count ? count : 1));
+    if (!sorted) fatal("Error: Out of memory\n");
+    memcpy(sorted, a, sizeof(uint32_t) * count);
+    memcpy(sorted + count, b, sizeof(uint32_t) * count);
+    qsort(sorted, count, sizeof(uint32_t), compareAtoms);
+    qsort(sorted + count, count, sizeof(uint32_t), compareAtoms);
+    int same = memcmp(sorted, sorted + count, sizeof(uint32_t) * count) == 0;
+    free(sorted);
+    return same;
+}
+
+// Names declared in tokens[begin, end), onto fresh_decls
+static void collectDecls(Watch* w, uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin + 1; i < end; i++) {
+        if (tokens[i].type != TOKEN_IDENTIFIER || tokens[i - 1].type != TOKEN_KEYWORD || tokens[i - 1].atom != ATOM_NUMBER) continue;
+        w->fresh_decls = (uint32_t*)growArray(w->fresh_decls, &w->fresh_decl_capacity, w->fresh_decl_count + 1, sizeof(uint32_t));
+        w->fresh_decls[w->fresh_decl_count++] = tokens[i].atom;
+    }
+}
+
+// Opens a unit of the region at tokens[token]
+static void freshUnit(Watch* w, size_t begin, int line, uint32_t token) {
+    w->fresh = (WatchUnit*)growArray(w->fresh, &w->fresh_capacity, w->fresh_count + 1, sizeof(WatchUnit));
+    WatchUnit* unit = &w->fresh[w->fresh_count++];
+    memset(unit, 0, sizeof(*unit));
+    unit->begin = begin;
+    unit->line = line;
+    unit->token_begin = token;
+    unit->node_begin = ast.node_count;
+    unit->child_begin = ast.child_count;
+    unit->loop_begin = ast.loop_count;
+    unit->root = createNode(NODE_PROGRAM, ATOM_EMPTY, line);
+}
+
+static void freshClose(Watch* w, uint32_t tokenEnd) {
+    WatchUnit* unit = &w->fresh[w->fresh_count - 1];
+    endNode(unit->root);
+    unit->token_count = tokenEnd - unit->token_begin;
+    unit->node_count = ast.node_count - unit->node_begin;
+    unit->child_count = ast.child_count - unit->child_begin;
+    unit->loop_count = ast.loop_count - unit->loop_begin;
+}
+
+// Parses all of tokens[] into units starting at begin. Returns 0 when the
+// last statements need tokens from past the region, which only atEnd rules out
+static int parseRegion(Watch* w, const char* text, size_t begin, int line, int atEnd) {
+    ErrorTrap* outer = error_trap;
+    ErrorTrap trap;
+    error_trap = &trap;
+    current_token_index = 0;
+    parse_depth = 0;
+    tokens_exhausted = 0;
+    w->fresh_count = 0;
+    if (setjmp(trap.jump)) {
+        error_trap = outer;
+        if (tokens_exhausted && !atEnd) return 0;
+        fatal("%s", trap.message);
+    }
+    freshUnit(w, begin, line, 0);
+    size_t scanned = 0;
+    int depth = 0, clean = 1;
+    while (current_token_index < token_count) {
+        uint32_t statement = parseStatement();
+        if (tokens_exhausted && !atEnd) {
+            error_trap = outer;
+            return 0;
+        }
+        if (statement != NO_NODE) addChild(statement);
+        for (; scanned < current_token_index; scanned++) {
+            if (tokens[scanned].type == TOKEN_OPEN_BLOCK) depth++;
+            else if (tokens[scanned].type == TOKEN_CLOSE_BLOCK) depth--;
+        }
+        // A skipped token may have been looked past, so it ends no unit
+        clean = statement != NO_NODE && depth == 0;
+        size_t next = current_token_index;
+        if (clean && next < token_count && tokens[next].line_number > tokens[next - 1].line_number) {
+            freshClose(w, (uint32_t)next);
+            size_t at = tokens[next].offset;
+            while (at > begin && text[at - 1] != '\n') at--;
+            freshUnit(w, at, tokens[next].line_number, (uint32_t)next);
+        }
+    }
+    error_trap = outer;
+    if (!clean && !atEnd) return 0;
+    freshClose(w, (uint32_t)token_count);
+    return 1;
+}
+
+// Moves the units' ranges of the arena together, dropping the rest
+static void compactTree(Watch* w) {
+    Ast packed;
+    memset(&packed, 0, sizeof(packed));
+    uint32_t nodes = 0, children = 0, loops = 0;
+    for (uint32_t u = 0; u < w->unit_count; u++) {
+        nodes += w->units[u].node_count;
+        children += w->units[u].child_count;
+        loops += w->units[u].loop_count;
+    }
+    packed.nodes = (TreeNode*)growArray(NULL, &packed.node_capacity, nodes + 1, sizeof(TreeNode));
+    packed.children = (uint32_t*)growArray(NULL, &packed.child_capacity, children + 1, sizeof(uint32_t));
+    packed.loops = (LoopInfo*)growArray(NULL, &packed.loop_capacity, loops + 1, sizeof(LoopInfo));
+    for (uint32_t u = 0; u < w->unit_count; u++) {
+        WatchUnit* unit = &w->units[u];
+        for (uint32_t i = 0; i < unit->node_count; i++) {
+            TreeNode node = ast.nodes[unit->node_begin + i];
+            node.first_child = node.first_child - unit->child_begin + packed.child_count;
+            if (node.type == NODE_LOOP) node.loop = node.loop - unit->loop_begin + packed.loop_count;
+            packed.nodes[packed.node_count + i] = node;
+        }
+        for (uint32_t i = 0; i < unit->child_count; i++) {
+            packed.children[packed.child_count + i] = ast.children[unit->child_begin + i] - unit->node_begin + packed.node_count;
+        }
+        if (unit->loop_count) memcpy(packed.loops + packed.loop_count, ast.loops + unit->loop_begin, sizeof(LoopInfo) * unit->loop_count);
+        unit->root = unit->root - unit->node_begin + packed.node_count;
+        unit->node_begin = packed.node_count;
+        unit->child_begin = packed.child_count;
+        unit->loop_begin = packed.loop_count;
+        packed.node_count += unit->node_count;
+        packed.child_count += unit->child_count;
+        packed.loop_count += unit->loop_count;
+    }
+    free(ast.nodes);
+    free(ast.children);
+    free(ast.loops);
+    packed.pending = ast.pending;
+    packed.pending_capacity = ast.pending_capacity;
+    ast = packed;
+}
+
+// Replaces units [first, stop) by the fresh ones and moves the rest
+static void commitRegion(Watch* w, uint32_t first, uint32_t stop, long long byteShift, int lineShift) {
+    uint32_t tokenFrom = first < w->unit_count ? w->units[first].token_begin : w->token_count;
+    uint32_t tokenTo = stop < w->unit_count ? w->units[stop].token_begin : w->token_count;
+    uint32_t declFrom = first < w->unit_count ? w->units[first].decl_begin : w->decl_count;
+    uint32_t declTo = stop < w->unit_count ? w->units[stop].decl_begin : w->decl_count;
+
+    w->fresh_decl_count = 0;
+    for (uint32_t u = 0; u < w->fresh_count; u++) {
+        WatchUnit* unit = &w->fresh[u];
+        unit->decl_begin = declFrom + w->fresh_decl_count;
+        collectDecls(w, unit->token_begin, unit->token_begin + unit->token_count);
+        unit->decl_count = declFrom + w->fresh_decl_count - unit->decl_begin;
+        unit->token_begin += tokenFrom;
+        w->live_nodes += unit->node_count;
+    }
+    for (uint32_t u = first; u < stop; u++) w->live_nodes -= w->units[u].node_count;
+
+    long long tokenShift = (long long)token_count - (long long)(tokenTo - tokenFrom);
+    long long declShift = (long long)w->fresh_decl_count - (long long)(declTo - declFrom);
+    for (uint32_t u = stop; u < w->unit_count; u++) {
+        WatchUnit* unit = &w->units[u];
+        unit->begin = (size_t)((long long)unit->begin + byteShift);
+        unit->line += lineShift;
+        if (byteShift != 0 || lineShift != 0) {
+            for (uint32_t i = 0; i < unit->token_count; i++) {
+                Token* token = &w->tokens[unit->token_begin + i];
+                token->offset = (uint32_t)((long long)token->offset + byteShift);
+                token->line_number += lineShift;
+            }
+        }
+        if (lineShift != 0) {
+            for (uint32_t i = 0; i < unit->node_count; i++) ast.nodes[unit->node_begin + i].line_number += lineShift;
+        }
+        unit->token_begin = (uint32_t)((long long)unit->token_begin + tokenShift);
+        unit->decl_begin = (uint32_t)((long long)unit->decl_begin + declShift);
+    }
+    w->tokens = (Token*)spliceArray(w->tokens, &w->token_count, &w->token_capacity, sizeof(Token),
+                                    tokenFrom, tokenTo, tokens, (uint32_t)token_count);
+    w->decls = (uint32_t*)spliceArray(w->decls, &w->decl_count, &w->decl_capacity, sizeof(uint32_t),
+                                      declFrom, declTo, w->fresh_decls, w->fresh_decl_count);
+    w->units = (WatchUnit*)spliceArray(w->units, &w->unit_count, &w->unit_capacity, sizeof(WatchUnit),
+                                       first, stop, w->fresh, w->fresh_count);
+    if (ast.node_count - w->live_nodes > w->live_nodes + WATCH_COMPACT_MIN) compactTree(w);
+}
+
+// The lines between the common prefix and suffix of the old and new text,
+// widened to the units they touch
+static void findChange(const Watch* w, const char* text, size_t size, WatchRegion* region) {
+    size_t limit = size < w->size ? size : w->size;
+    size_t prefix = 0;
+    while (prefix < limit && text[prefix] == w->text[prefix]) prefix++;
+    while (prefix > 0 && text[prefix - 1] != '\n') prefix--;
+    size_t suffix = 0;
+    while (suffix < limit - prefix && text[size - 1 - suffix] == w->text[w->size - 1 - suffix]) suffix++;
+    size_t oldEnd = w->size - suffix, newEnd = size - suffix;
+    while (oldEnd < w->size && !(lineStart(w->text, oldEnd) && lineStart(text, newEnd))) {
+        oldEnd++;
+        newEnd++;
+    }
+    region->byte_shift = (long long)size - (long long)w->size;
+    region->line_shift = countLines(text + prefix, newEnd - prefix) - countLines(w->text + prefix, oldEnd - prefix);
+
+    uint32_t first = unitsBefore(w, prefix + 1);
+    region->first = first ? first - 1 : 0;
+    region->stop = unitsBefore(w, oldEnd);
+    if (region->stop <= region->first && region->first < w->unit_count) region->stop = region->first + 1;
+    region->begin = region->first < w->unit_count ? w->units[region->first].begin : 0;
+    region->line = region->first < w->unit_count ? w->units[region->first].line : 1;
+    region->end = region->stop < w->unit_count ? (size_t)((long long)w->units[region->stop].begin + region->byte_shift) : size;
+}
+
+// Lexes and parses the units the change touches again, fatal() on an error
+static void rebuildRegion(Watch* w, const char* text, size_t size, WatchChange* change) {
+    WatchRegion region;
+    findChange(w, text, size, &region);
+    uint32_t first = region.first, stop = region.stop;
+    Ast mark = ast;
+
+    // Lexed against the names declared before the change
+    swapSymbols(&w->declared);
+    w->checking = 1;
+    resetSymbols();
+    for (uint32_t u = 0; u < first; u++) {
+        for (uint32_t i = 0; i < w->units[u].decl_count; i++) declareSymbol(w->decls[w->units[u].decl_begin + i]);
+    }
+    token_count = 0;
+    blockCount = 0;
+    brace_count = 0;
+    brace_open = NO_BRACE;
+    lexRange(text, text + region.begin, text + region.end, text + size, region.line);
+    w->fresh_decl_count = 0;
+    collectDecls(w, 0, (uint32_t)token_count);
+    uint32_t declFrom = first < w->unit_count ? w->units[first].decl_begin : w->decl_count;
+    uint32_t declTo = stop < w->unit_count ? w->units[stop].decl_begin : w->decl_count;
+    if (w->fresh_decl_count != declTo - declFrom || !sameNames(w->fresh_decls, w->decls + declFrom, declTo - declFrom)) {
+        uint32_t rest = stop < w->unit_count ? w->units[stop].token_begin : w->token_count;
+        checkDeclarations(w->tokens + rest, w->token_count - rest, region.line_shift);
+    }
+    swapSymbols(&w->declared);
+    w->checking = 0;
+    // The units after the change are balanced, so a brace still open stays open
+    if (blockCount > 0) fatal("Error: Unclosed block opened on line %d\n", blockLine);
+    change->first_line = region.line;
+    change->last_line = region.line + countLines(text + region.begin, region.end - region.begin);
+
+    // Parsed with as many of the following units as the statements need,
+    // twice as many every time
+    uint32_t more = stop;
+    while (!parseRegion(w, text, region.begin, region.line, more == w->unit_count)) {
+        ast.node_count = mark.node_count;
+        ast.child_count = mark.child_count;
+        ast.loop_count = mark.loop_count;
+        ast.pending_count = 0;
+        uint32_t next = more + (more > first ? more - first : 1);
+        if (next > w->unit_count) next = w->unit_count;
+        uint32_t from = w->units[more].token_begin;
+        uint32_t to = next < w->unit_count ? w->units[next].token_begin : w->token_count;
+        appendTokens(w->tokens + from, to - from, region.byte_shift, region.line_shift);
+        more = next;
+    }
+    change->statements = 0;
+    for (uint32_t u = 0; u < w->fresh_count; u++) {
+        TreeNode* root = &ast.nodes[w->fresh[u].root];
+        resolveSymbols(root);
+        change->statements += (uint32_t)root->child_count;
+    }
+    commitRegion(w, first, more, region.byte_shift, region.line_shift);
+}
+
+// Brings the units up to text, which the watch then owns. On an error the
+// message is printed, the units stay as they were and 0 is returned.
+static int watchUpdate(Watch* w, char* text, size_t size, WatchChange* change) {
+    Ast mark = ast;
+    ErrorTrap trap;
+    error_trap = &trap;
+    if (setjmp(trap.jump)) {
+        error_trap = NULL;
+        if (w->checking) swapSymbols(&w->declared);
+        w->checking = 0;
+        ast.node_count = mark.node_count;
+        ast.child_count = mark.child_count;
+        ast.loop_count = mark.loop_count;
+        ast.pending_count = 0;
+        parse_depth = 0;
+        printf("%s", trap.message);
+        fflush(stdout);
+        return 0;
+    }
+    rebuildRegion(w, text, size, change);
+    error_trap = NULL;
+    free(w->text);
+    w->text = text;
+    w->size = size;
+    return 1;
+}
+
+// Runs the units' statements as one program. Returns the number of them
+static uint32_t watchRun(Watch* w, int optLevel, int useVM, const PppOptions* limits) {
+    uint32_t nodeMark = ast.node_count, childMark = ast.child_count;
+    uint32_t program = createNode(NODE_PROGRAM, ATOM_EMPTY, 1);
+    for (uint32_t u = 0; u < w->unit_count; u++) {
+        const TreeNode* root = &ast.nodes[w->units[u].root];
+        for (int i = 0; i < root->child_count; i++) addChild(ast.children[root->first_child + (uint32_t)i]);
+    }
+    endNode(program);
+    uint32_t statements = (uint32_t)ast.nodes[program].child_count;
+    if (optLevel > 0) {
+        // The passes rewrite the tree, so they get a copy
+        Ast* copy = &w->run;
+        copy->nodes = (TreeNode*)growArray(copy->nodes, &copy->node_capacity, ast.node_count, sizeof(TreeNode));
+        copy->children = (uint32_t*)growArray(copy->children, &copy->child_capacity, ast.child_count + 1, sizeof(uint32_t));
+        copy->loops = (LoopInfo*)growArray(copy->loops, &copy->loop_capacity, ast.loop_count + 1, sizeof(LoopInfo));
+        memcpy(copy->nodes, ast.nodes, sizeof(TreeNode) * ast.node_count);
+        memcpy(copy->children, ast.children, sizeof(uint32_t) * ast.child_count);
+        memcpy(copy->loops, ast.loops, sizeof(LoopInfo) * ast.loop_count);
+        copy->node_count = ast.node_count;
+        copy->child_count = ast.child_count;
+        copy->loop_count = ast.loop_count;
+        Ast swapped = ast;
+        ast = *copy;
+        *copy = swapped;
+        optimizeProgram(&ast.nodes[program], optLevel, 0);
+    }
+    slots = (long long*)realloc(slots, sizeof(long long) * ((size_t)symbol_count + 1));
+    resetSlots();
+    governorStart(limits, 0);
+    programOutput.sent = 0;
+    programOutput.first_sent = 0;
+
+    ErrorTrap trap;
+    error_trap = &trap;
+    if (setjmp(trap.jump) == 0) {
+        TreeNode* tree = &ast.nodes[program];
+        if (useVM) {
+            w->chunk = compileProgram(tree);
+            runChunk(&w->chunk);
+        } else {
+            executeProgram(tree);
+        }
+        error_trap = NULL;
+        sinkFlush(&programOutput);
+    } else {
+        error_trap = NULL;
+        exec_depth = 0;
+        sinkFlush(&programOutput);
+        printf("%s", trap.message);
+        fflush(stdout);
+    }
+    freeChunk(&w->chunk);
+    jitReset();
+    jitRelease();
+    if (optLevel > 0) {
+        astReset();
+        Ast swapped = ast;
+        ast = w->run;
+        w->run = swapped;
+    }
+    ast.node_count = nodeMark;
+    ast.child_count = childMark;
+    return statements;
+}
+
+// The whole file in a buffer of its own, NULL if it cannot be read
+static char* readWhole(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return NULL;
+    size_t capacity = 65536, used = 0;
+    char* data = (char*)malloc(capacity);
+    size_t n;
+    while (data && (n = fread(data + used, 1, capacity - used, file)) > 0) {
+        used += n;
+        if (used == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
+        }
+    }
+    fclose(file);
+    *size = used;
+    return data;
+}
+
+static int runWatch(const char* filename, int optLevel, int useVM, const PppOptions* limits) {
+    Watch w;
+    memset(&w, 0, sizeof(w));
+    parseThreads = 1;
+    // Saves show up as events on the directory: editors often write a new
+    // file and rename it over the old one
+    char directory[4096];
+    const char* slash = strrchr(filename, '/');
+    const char* base = slash ? slash + 1 : filename;
+    snprintf(directory, sizeof(directory), "%.*s", slash ? (int)(slash - filename) + 1 : 1, slash ? filename : ".");
+#ifdef __linux__
+    int notify = inotify_init1(IN_CLOEXEC);
+    if (notify < 0 || inotify_add_watch(notify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Cannot watch %s\n", directory);
+        return 1;
+    }
+#else
+    struct stat last;
+    memset(&last, 0, sizeof(last));
+    stat(filename, &last);
+#endif
+    int current = 0;   // the last save compiled; the same text again is not run again
+    for (;;) {
+        double savedAt = nowSeconds();
+        size_t size;
+        char* text = readWhole(filename, &size);
+        if (!text) {
+            printf("File cannot be opened: %s\n", filename);
+            fflush(stdout);
+        } else if (current && size == w.size && memcmp(text, w.text, size) == 0) {
+            // Saved without a change, or a second event for the same save
+            free(text);
+        } else {
+            WatchChange change;
+            current = watchUpdate(&w, text, size, &change);
+            if (current) {
+                double compiled = nowSeconds();
+                uint32_t statements = watchRun(&w, optLevel, useVM, limits);
+                double finished = nowSeconds();
+                char output[64];
+                if (programOutput.sent > 0) snprintf(output, sizeof(output), "first output after %.3f ms", (programOutput.first_sent - savedAt) * 1e3);
+                else snprintf(output, sizeof(output), "no output");
+                fprintf(stderr, "[watch] %s: lines %d-%d lexed, %u of %u statements parsed, front end %.3f ms, %s, run %.3f ms\n",
+                        filename, change.first_line, change.last_line, change.statements, statements,
+                        (compiled - savedAt) * 1e3, output, (finished - compiled) * 1e3);
+            } else {
+                free(text);
+                fprintf(stderr, "[watch] %s: not run, the last good version stays loaded\n", filename);
+            }
+        }
+
+        // Waits for the next save
+#ifdef __linux__
+        union {
+            struct inotify_event event;
+            char bytes[4096];
+        } events;
+        int saved = 0;
+        while (!saved) {
+            ssize_t n = read(notify, events.bytes, sizeof(events.bytes));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return 1;
+            for (ssize_t at = 0; at < n;) {
+                const struct inotify_event* event = (const struct inotify_event*)(events.bytes + at);
+                if (event->len > 0 && strcmp(event->name, base) == 0) saved = 1;
+                at += (ssize_t)(sizeof(struct inotify_event) + event->len);
+            }
+        }
+#else
+        (void)base;
+        for (;;) {
+            struct timespec pause = {0, WATCH_POLL_NS};
+            nanosleep(&pause, NULL);
+            struct stat now;
+            if (stat(filename, &now) != 0) continue;
+            if (now.st_mtime != last.st_mtime || now.st_size != last.st_size || now.st_ino != last.st_ino) {
+                last = now;
+                break;
+            }
+        }
+#endif
+    }
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    int useLegacyLexer = 0;
+    int benchRuns = 0;
+    int depthMax = 0;
+    int parseRuns = 0;
+    int engineRuns = 0;
+    int useVM = 0;
+    int jitRuns = 0;
+    int optLevel = 0;
+    FlushPolicy flushPolicy = isatty(1) ? FLUSH_LINE : FLUSH_BLOCK;
+    int dumpPasses = 0;
+    int printTree = 0;
+    int streaming = 0;
+    int watching = 0;
+    int emitSource = 0;
+    Backend backend = DEFAULT_BACKEND;
+    const char* outputPath = NULL;
+    const char* genSpec = NULL;
+    int stats = 0;
+    int profiling = 0;
+    const char* cacheDir = NULL;
+    char cacheDirBuffer[4096];
+    int cacheOutput = 0;
+    int cacheRuns = 0;
+    const char* servePath = NULL;
+    const char* clientPath = NULL;
+    const char* batchDir = NULL;
+    int lexThreadCount = 0;
+    int parseThreadCount = 0;
+    int execThreadCount = 0;
+    int workers = 0;
+    long serveCacheMb = 256;
+    int clientInline = 0;
+    int clientRequests = 1;
+    int clientConcurrency = 1;
+    const char* foldedPath = NULL;
+    int pgoGenerate = 0;
+    int pgoUse = 0;
+    const char* pgoPath = NULL;
+    const char* statsPath = NULL;
+    unsigned long long maxSteps = 0;
+    double maxSeconds = 0;
+    unsigned long long maxOutput = 0;
+    unsigned long long sliceSteps = 0;
+    BenchSuite suite = {0, 0, 0, FORMAT_JSON, 0};
+    const char* name = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lexer=legacy") == 0) {
+            useLegacyLexer = 1;
+        } else if (strcmp(argv[i], "--lexer=mmap") == 0) {
+            useLegacyLexer = 0;
+        } else if (strcmp(argv[i], "--bench-depth") == 0) {
+            depthMax = 1000000;
+        } else if (strncmp(argv[i], "--bench-depth=", 14) == 0) {
+            depthMax = atoi(argv[i] + 14);
+            if (depthMax < 1000) depthMax = 1000;
+        } else if (strcmp(argv[i], "--bench-lex") == 0) {
+            benchRuns = 5;
+        } else if (strncmp(argv[i], "--bench-lex=", 12) == 0) {
+            benchRuns = atoi(argv[i] + 12);
+            if (benchRuns < 1) benchRuns = 1;
+        } else if (strcmp(argv[i], "--engine=vm") == 0) {
+            useVM = 1;
+        } else if (strcmp(argv[i], "--engine=tree") == 0) {
+            useVM = 0;
+        } else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0) {
+            optLevel = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--flush=line") == 0) {
+            flushPolicy = FLUSH_LINE;
+        } else if (strcmp(argv[i], "--flush=block") == 0) {
+            flushPolicy = FLUSH_BLOCK;
+        } else if (strcmp(argv[i], "--flush=exit") == 0) {
+            flushPolicy = FLUSH_EXIT;
+        } else if (strcmp(argv[i], "--dump-passes") == 0) {
+            dumpPasses = 1;
+        } else if (strcmp(argv[i], "--print-tree") == 0) {
+            printTree = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streaming = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watching = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jitThreshold = JIT_DEFAULT_THRESHOLD;
+        } else if (strncmp(argv[i], "--jit=", 6) == 0) {
+            jitThreshold = atoi(argv[i] + 6);
+            if (jitThreshold < 1) jitThreshold = 1;
+        } else if (strcmp(argv[i], "--bench-jit") == 0) {
+            jitRuns = 5;
+        } else if (strncmp(argv[i], "--bench-jit=", 12) == 0) {
+            jitRuns = atoi(argv[i] + 12);
+            if (jitRuns < 1) jitRuns = 1;
+        } else if (strcmp(argv[i], "--emit=asm") == 0 || strcmp(argv[i], "--emit=c") == 0) {
+            emitSource = 1;
+            backend = argv[i][7] == 'a' ? BACKEND_ASM : BACKEND_C;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--bench-engine") == 0) {
+            engineRuns = 5;
+        } else if (strncmp(argv[i], "--bench-engine=", 15) == 0) {
+            engineRuns = atoi(argv[i] + 15);
+            if (engineRuns < 1) engineRuns = 1;
+        } else if (strcmp(argv[i], "--bench-parse") == 0) {
+            parseRuns = 1;
+        } else if (strncmp(argv[i], "--bench-parse=", 14) == 0) {
+            parseRuns = atoi(argv[i] + 14);
+            if (parseRuns < 1) parseRuns = 1;
+        } else if (strncmp(argv[i], "--gen=", 6) == 0) {
+            genSpec = argv[i] + 6;
+        } else if (strcmp(argv[i], "--bench-suite") == 0) {
+            suite.runs = 10;
+        } else if (strncmp(argv[i], "--bench-suite=", 14) == 0) {
+            suite.runs = atoi(argv[i] + 14);
+            if (suite.runs < 1) suite.runs = 1;
+        } else if (strcmp(argv[i], "--format=json") == 0) {
+            suite.format = FORMAT_JSON;
+        } else if (strcmp(argv[i], "--format=csv") == 0) {
+            suite.format = FORMAT_CSV;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            defaultCacheDir(cacheDirBuffer, sizeof(cacheDirBuffer));
+            cacheDir = cacheDirBuffer;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cacheDir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--cache-output") == 0) {
+            cacheOutput = 1;
+        } else if (strcmp(argv[i], "--bench-cache") == 0) {
+            cacheRuns = 10;
+        } else if (strncmp(argv[i], "--bench-cache=", 14) == 0) {
+            cacheRuns = atoi(argv[i] + 14);
+            if (cacheRuns < 1) cacheRuns = 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchDir = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && isdigit((unsigned char)argv[i][2])) {
+            workers = atoi(argv[i] + 2);
+        } else if (strncmp(argv[i], "--lex-threads=", 14) == 0) {
+            lexThreadCount = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--parse-threads=", 16) == 0) {
+            parseThreadCount = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--exec-threads=", 15) == 0) {
+            execThreadCount = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            workers = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--serve-cache=", 14) == 0) {
+            serveCacheMb = atol(argv[i] + 14);
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            clientPath = argv[++i];
+        } else if (strcmp(argv[i], "--inline") == 0) {
+            clientInline = 1;
+        } else if (strncmp(argv[i], "--requests=", 11) == 0) {
+            clientRequests = atoi(argv[i] + 11);
+        } else if (strncmp(argv[i], "--concurrency=", 14) == 0) {
+            clientConcurrency = atoi(argv[i] + 14);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profiling = 1;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profiling = 1;
+            foldedPath = argv[i] + 10;
+        } else if (strcmp(argv[i], "--profile-generate") == 0) {
+            pgoGenerate = 1;
+        } else if (strncmp(argv[i], "--profile-generate=", 19) == 0) {
+            pgoGenerate = 1;
+            pgoPath = argv[i] + 19;
+        } else if (strcmp(argv[i], "--profile-use") == 0) {
+            pgoUse = 1;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0) {
+            pgoUse = 1;
+            pgoPath = argv[i] + 14;
+        } else if (strncmp(argv[i], "--max-steps=", 12) == 0) {
+            maxSteps = strtoull(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "--max-time=", 11) == 0) {
+            maxSeconds = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--max-output=", 13) == 0) {
+            maxOutput = strtoull(argv[i] + 13, NULL, 10);
+        } else if (strncmp(argv[i], "--slice=", 8) == 0) {
+            sliceSteps = strtoull(argv[i] + 8, NULL, 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            statsPath = NULL;
+            stats = 1;
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            statsPath = argv[i] + 8;
+            stats = 1;
+        } else {
+            name = argv[i];
+        }
+    }
+
+#ifndef _WIN32
+    if (servePath || batchDir) {
+        if (workers < 1) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers < 1) workers = 1;
+        if (serveCacheMb < 0) serveCacheMb = 0;
+        PppOptions options = {optLevel, useVM ? PPP_ENGINE_VM : PPP_ENGINE_TREE, jitThreshold,
+                              maxSteps, maxSeconds, maxOutput, sliceSteps};
+        if (batchDir) return runBatch(batchDir, workers, &options);
+        return serve(servePath, workers, (size_t)serveCacheMb << 20, &options);
+    }
+#endif
+
+    // Scripts run in parallel above; one script's lexing and parsing may use all cores
+#ifndef _WIN32
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    lexThreads = lexThreadCount > 0 ? lexThreadCount : cores > 0 ? cores : 1;
+    parseThreads = parseThreadCount > 0 ? parseThreadCount : cores > 0 ? cores : 1;
+    // Off unless asked for: output is held back until the statements before it are done
+    execThreads = execThreadCount > 0 ? execThreadCount : 1;
+#endif
+
+    if (cacheOutput && !cacheDir) {
+        defaultCacheDir(cacheDirBuffer, sizeof(cacheDirBuffer));
+        cacheDir = cacheDirBuffer;
+    }
+
+    initAtoms();
+    if (depthMax > 0) {
+        return benchDepth(depthMax);
+    }
+    if (suite.runs > 0 && !name) {
+        suite.optLevel = optLevel;
+        suite.useVM = useVM;
+        return benchSuite(&suite, NULL);
+    }
+
+    if (!name) {
+        printf("Usage: %s [--lexer=mmap|legacy] [--engine=tree|vm] [--jit[=threshold]] [-O0|-O1|-O2] [--dump-passes] [--print-tree]\n"
+               "       [--flush=line|block|exit] [--emit=asm|c] [-o executable]\n"
+               "       [--lex-threads=N] [--parse-threads=N] [--exec-threads=N] [--stream | --watch]\n"
+               "       [--bench-lex[=runs]] [--bench-parse[=runs]] [--bench-engine[=runs]] [--bench-jit[=runs]]\n"
+               "       [--bench-depth[=max]]\n"
+               "       [--gen=lines=N,depth=N,vars=N,writes=%%,strlen=N,comments=%%,trips=N,seed=N]\n"
+               "       [--bench-suite[=runs] [--format=json|csv]] [--stats[=file.json]]\n"
+               "       [--profile[=file.folded]] [--profile-generate[=file.pgo] | --profile-use[=file.pgo]]\n"
+               "       [--cache[=dir] [--cache-output]] [--bench-cache[=runs]]\n"
+               "       [--client socket [--inline] [--requests=N] [--concurrency=N]]\n"
+               "       [--max-steps=N] [--max-time=seconds] [--max-output=bytes] [--slice=steps] <filename>\n"
+               "       %s --serve socket [--workers=N] [--serve-cache=MB] [-O0|-O1|-O2] [--engine=tree|vm] [--jit[=threshold]]\n"
+               "       %s --batch directory [-j N] [-O0|-O1|-O2] [--engine=tree|vm] [--jit[=threshold]]\n"
+               "       (--serve and --batch take the --max-* options too, --batch also --slice)\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    // Dosya açma ve hata kontrolü
+    char inputFilename[256];
+    snprintf(inputFilename, sizeof(inputFilename), "%s.ppp", name);
+
+    if (genSpec) {
+        GenParams params;
+        if (!parseGenSpec(genSpec, &params)) {
+            printf("Invalid generator spec: %s\n", genSpec);
+            return 1;
+        }
+        if (!writeGenerated(inputFilename, &params)) return 1;
+        if (suite.runs == 0) return 0;
+    }
+    if (suite.runs > 0) {
+        suite.optLevel = optLevel;
+        suite.useVM = useVM;
+        return benchSuite(&suite, inputFilename);
+    }
+#ifndef _WIN32
+    if (cacheRuns > 0) {
+        return benchCache("/proc/self/exe", name, inputFilename, cacheRuns, optLevel, useVM);
+    }
+    if (clientPath) {
+        return runClient(clientPath, inputFilename, clientInline, clientRequests, clientConcurrency);
+    }
+#endif
+    if (benchRuns > 0) {
+        return benchLexer(inputFilename, benchRuns);
+    }
+    if (parseRuns > 0) {
+        return benchParser(inputFilename, parseRuns);
+    }
+    PppOptions limits = {optLevel, useVM ? PPP_ENGINE_VM : PPP_ENGINE_TREE, jitThreshold,
+                         maxSteps, maxSeconds, maxOutput, sliceSteps};
+#ifndef _WIN32
+    if (watching) {
+        // Runs until interrupted, one program at a time
+        if (streaming || printTree || dumpPasses || cacheDir || profiling || pgoGenerate || pgoUse || stats ||
+            outputPath || emitSource || engineRuns > 0 || jitRuns > 0 || useLegacyLexer) {
+            printf("Error: --watch only runs the program; drop the other mode options\n");
+            return 1;
+        }
+        programOutput.policy = flushPolicy;
+        governorStart(&limits, 0);
+        if (governorActive()) jitThreshold = 0;
+        return runWatch(inputFilename, optLevel, useVM, &limits);
+    }
+#endif
+    if (streaming) {
+        // There is never a whole tree to print, cache, profile or compile
+        if (printTree || dumpPasses || cacheDir || profiling || pgoGenerate || pgoUse || stats || outputPath || emitSource ||
+            engineRuns > 0 || jitRuns > 0 || useLegacyLexer) {
+            printf("Error: --stream only runs the program; drop the other mode options\n");
+            return 1;
+        }
+        programOutput.policy = flushPolicy;
+        governorStart(&limits, 0);
+        if (governorActive()) jitThreshold = 0;
+        return runStream(inputFilename, optLevel, useVM);
+    }
+
+    if (stats) statsOpen(statsPath);
+    SourceFile source = {NULL, 0, 0};
+    int sourceLoaded = 0;
+    ProgramCache cache;
+    TreeNode* parseTree = NULL;
+    if (cacheDir) {
+        statsBegin();
+        if (!loadSource(inputFilename, &source)) {
+            printf("File cannot be opened: %s\n", inputFilename);
+            return 1;
+        }
+        sourceLoaded = 1;
+        statsEnd(STATS_READ);
+        statsBegin();
+        makeDirectories(cacheDir);
+        cacheOpen(&cache, cacheDir, &source, optLevel);
+        parseTree = cacheLoad(&cache);
+        statsEnd(STATS_CACHE);
+    }
+    if (parseTree) {
+        // Cache hit: checked, resolved and optimized already
+    } else if (useLegacyLexer) {
+        // Reads line by line while lexing, so it all counts as lexing
+        statsBegin();
+        FILE *dosya = fopen(inputFilename, "r");
+        if (!dosya) {
+            printf("File cannot be opened: %s\n", inputFilename);
+            return 1;
+        }
+        lexFileLegacy(dosya);
+        fclose(dosya);
+        statsEnd(STATS_LEX);
+    } else {
+        if (!sourceLoaded) {
+            statsBegin();
+            if (!loadSource(inputFilename, &source)) {
+                printf("File cannot be opened: %s\n", inputFilename);
+                return 1;
+            }
+            statsEnd(STATS_READ);
+        }
+        statsBegin();
+        lexBuffer(source.data, source.size);
+        statsEnd(STATS_LEX);
+    }
+
+    if (!parseTree) {
+        if(blockCount > 0){
+            printf("Error: Unclosed block opened on line %d\n", blockLine);
+            exit(1);
+        }
+
+        // PARSER PHASE
+        statsBegin();
+        parseTree = parseProgram();
+        resolveSymbols(parseTree);
+        statsEnd(STATS_PARSE);
+        statsBegin();
+        optimizeProgram(parseTree, optLevel, dumpPasses);
+        statsEnd(STATS_OPTIMIZE);
+        if (cacheDir) {
+            statsBegin();
+            cacheStore(&cache, parseTree);
+            statsEnd(STATS_CACHE);
+        }
+    }
+    char defaultPgo[256];
+    snprintf(defaultPgo, sizeof(defaultPgo), "%s.pgo", name);
+    if (pgoGenerate && pgoUse) {
+        printf("Error: --profile-generate and --profile-use are separate runs\n");
+        return 1;
+    }
+    if (pgoUse) {
+        // The tree is optimized by now, cached or not; the profile only steers the engines
+        PgoProfile pgo;
+        if (pgoRead(&pgo, pgoPath ? pgoPath : defaultPgo)) {
+            pgoApply(&pgo, !useVM);
+            if (dumpPasses) {
+                printf("=== PROFILE %s: %d/%d loops matched, %d hot, %d unrolled, %d closed forms dropped ===\n",
+                       pgoPath ? pgoPath : defaultPgo, pgo.matched, pgo.loops, pgo.hot, pgo.unrolled, pgo.opened);
+            }
+            free(pgo.entries);
+        }
+    }
+    slots = (long long*)calloc((size_t)symbol_count + 1, sizeof(long long));
+    if (engineRuns > 0) {
+        return benchEngines(parseTree, engineRuns);
+    }
+    if (jitRuns > 0) {
+        return benchJit(parseTree, jitRuns);
+    }
+    if (outputPath || emitSource) {
+        int line = nativeBigLiteral(parseTree);
+        if (line >= 0) fatal("Error on line %d: Number does not fit in 64 bits for native code\n", line);
+    }
+    if (outputPath) {
+        return buildExecutable(parseTree, backend, inputFilename, outputPath);
+    }
+    if (emitSource) {
+        if (backend == BACKEND_ASM) emitAssembly(parseTree, stdout, inputFilename);
+        else emitC(parseTree, stdout, inputFilename);
+        return 0;
+    }
+
+    if (printTree) {
+        statsBegin();
+        printf("=== PARSE TREE ===\n");
+        printParseTree(parseTree, 0);
+        statsEnd(STATS_PRINT);
+        printf("\n=== PROGRAM OUTPUT ===\n");
+        fflush(stdout);
+    }
+    
+    // INTERPRETER PHASE
+    programOutput.policy = flushPolicy;
+    governorStart(&limits, 0);
+    if (governorActive()) {
+        // Compiled loops have no limit checks, and a run cut short has no output worth keeping
+        jitThreshold = 0;
+        cacheOutput = 0;
+    }
+    statsBegin();
+    int captureFd = -1;
+    char captureTemp[4200];
+    if (cacheOutput && !profiling && !pgoGenerate && cacheReplayOutput(&cache)) {
+        // Same source, same output
+    } else if (profiling || pgoGenerate) {
+        // Always the tree walker: the profile is per parse tree node
+        jitThreshold = 0;
+        profileStart(profiling);
+        executeProfiled(parseTree);
+    } else {
+        if (cacheOutput) captureFd = cacheCaptureOutput(&cache, captureTemp, sizeof(captureTemp));
+        if (useVM) {
+            Chunk chunk = compileProgram(parseTree);
+            runChunk(&chunk);
+            freeChunk(&chunk);
+        } else {
+            executeProgram(parseTree);
+        }
+    }
+    sinkFlush(&programOutput);
+    if (captureFd >= 0) cacheFinishOutput(&cache, captureFd, captureTemp);
+    statsEnd(STATS_EXECUTE);
+    statsReport(inputFilename, parseTree, useVM ? "vm" : (jitThreshold > 0 ? "jit" : "tree"));
+    if (profiling) {
+        char defaultFolded[256];
+        snprintf(defaultFolded, sizeof(defaultFolded), "%s.folded", name);
+        if (!profileReport(parseTree, inputFilename, foldedPath ? foldedPath : defaultFolded)) return 1;
+    }
+    if (pgoGenerate && !pgoWrite(pgoPath ? pgoPath : defaultPgo)) return 1;
+    
+    return 0;
+}
+#endif
@@ -0,0 +1,75 @@
+// Embedding API of the ppp compiler and interpreter.
+//
+// Build main.c with -DPPP_LIBRARY to leave out the command line tool; the
+// object then exports only the ppp_* functions below.
+// A compiled program is immutable and can be run by several threads at
+// once. A context holds options, the last error and captured output; use
+// each one from a single thread at a time.
+#ifndef PPP_H
+#define PPP_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct PppProgram PppProgram;
+typedef struct PppContext PppContext;
+typedef struct PppRun PppRun;
+
+enum {
+    PPP_ENGINE_TREE,
+    PPP_ENGINE_VM
+};
+
+typedef struct {
+    int opt_level;       // 0-2, as -O0..-O2
+    int engine;          // PPP_ENGINE_TREE or PPP_ENGINE_VM
+    int jit_threshold;   // tree walker only, 0 = no JIT
+    // Limits of each run, 0 = none. Steps are loop iterations plus the
+    // statements run in them on the tree walker, instructions on the VM.
+    // Limits are checked once every slice_steps steps (0 = 65536), and
+    // runs with limits do not use the JIT.
+    unsigned long long max_steps;
+    double max_seconds;               // wall time
+    unsigned long long max_output;    // bytes written
+    unsigned long long slice_steps;
+} PppOptions;
+
+// options may be NULL for -O0 on the tree walker
+PppContext* ppp_context_new(const PppOptions* options);
+void ppp_context_free(PppContext* context);
+
+// NULL if the source does not compile, ppp_error() says why
+PppProgram* ppp_compile(PppContext* context, const char* source, size_t length);
+
+// Runs program with its output written to fd, or, when fd is negative,
+// collected in the context for ppp_output(). Returns 0, or -1 when a limit
+// stopped it (ppp_error() says which; the output so far is kept).
+int ppp_run(PppContext* context, const PppProgram* program, int fd);
+
+// Time slicing: each ppp_resume() runs the program for about slice_steps
+// steps and returns at a loop back edge. A run holds all of its state, so
+// a fixed pool of threads can take turns on many runs; any thread may
+// resume it, one at a time. program has to outlive the run. Returns 1
+// while there is more to do, else as ppp_run() after freeing the run. The
+// error and output go to the context passed to ppp_resume().
+PppRun* ppp_start(PppContext* context, const PppProgram* program, int fd);
+int ppp_resume(PppContext* context, PppRun* run);
+
+// Frees a run that is not finished
+void ppp_cancel(PppRun* run);
+
+void ppp_free(PppProgram* program);
+
+const char* ppp_error(const PppContext* context);
+
+// Output of the last ppp_run() with fd < 0, valid until the next run
+const char* ppp_output(const PppContext* context, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+#!/bin/sh
+# Runs every tests/*.ppp in each of the modes below and compares its output
+# with the .out file next to it, then checks the features that take more
+# than a single run.
+# Usage: tests/run.sh path/to/ppp
+LC_ALL=C
+export LC_ALL
+ppp=$1
+tests=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+failed=0
+count=0
+
+# check <label> <expected file> <actual file>
+check() {
+    count=$((count + 1))
+    if ! cmp -s "$2" "$3"; then
+        echo "FAIL $1"
+        diff "$2" "$3" | head -10
+        failed=$((failed + 1))
+    fi
+}
+
+# expect <label> <command...>: the command has to succeed
+expect() {
+    label=$1
+    shift
+    count=$((count + 1))
+    if ! "$@"; then
+        echo "FAIL $label"
+        failed=$((failed + 1))
+    fi
+}
+
+# Corpus: every mode has to print the same
+modes='-O0
+--lexer=legacy
+--engine=vm
+--jit=1
+-O1
+-O2
+--engine=vm -O2
+--exec-threads=4
+--stream
+--stream -O2'
+
+for source in "$tests"/*.ppp; do
+    program=${source%.ppp}
+    while read -r mode; do
+        # shellcheck disable=SC2086
+        "$ppp" "$program" $mode > "$work/actual" 2>&1 < /dev/null
+        check "$(basename "$program") $mode" "$program.out" "$work/actual"
+    done <<MODES
+$modes
+MODES
+done
+
+# Native executables (-o) from assembly and from C. A program that does
+# not build or run the same natively has its expected output in a .native
+# file; a failed build or run adds its exit status.
+for source in "$tests"/*.ppp; do
+    program=${source%.ppp}
+    name=$(basename "$program")
+    expected=$program.out
+    [ -f "$program.native" ] && expected=$program.native
+    for emit in asm c; do
+        if "$ppp" "$program" --emit=$emit -o "$work/$name" > "$work/actual" 2>&1; then
+            "$work/$name" > "$work/actual" 2>&1
+            status=$?
+        else
+            status=$?
+        fi
+        [ "$status" -ne 0 ] && echo "[exit $status]" >> "$work/actual"
+        check "$name -o ($emit)" "$expected" "$work/actual"
+    done
+done
+
+# Compiled-program cache: the first run stores the program and the second
+# loads it; with --cache-output the second run replays the stored output
+for flags in "" --cache-output; do
+    rm -rf "$work/cache"
+    for pass in 1 2; do
+        # shellcheck disable=SC2086
+        "$ppp" "$tests/loops" --cache="$work/cache" $flags > "$work/actual" 2>&1
+        check "loops --cache $flags (run $pass)" "$tests/loops.out" "$work/actual"
+    done
+    expect "loops --cache $flags stored an image" test -n "$(ls "$work/cache"/*.ppc 2>/dev/null)"
+    # shellcheck disable=SC2086
+    "$ppp" "$tests/loops" --cache="$work/cache" $flags --stats 2>&1 > /dev/null | grep '^parse' > "$work/actual"
+    check "loops --cache $flags hit skips the parser" /dev/null "$work/actual"
+done
+expect "loops --cache-output stored the output" test -n "$(ls "$work/cache"/*.out 2>/dev/null)"
+
+# Profile feedback: a profile from one run has to leave the output of the
+# optimized runs that use it unchanged, and match every loop it saw
+for source in "$tests"/*.ppp; do
+    program=${source%.ppp}
+    name=$(basename "$program")
+    "$ppp" "$program" --profile-generate="$work/$name.pgo" > "$work/actual" 2>&1 < /dev/null
+    check "$name --profile-generate" "$program.out" "$work/actual"
+    for level in -O1 -O2; do
+        "$ppp" "$program" --profile-use="$work/$name.pgo" $level > "$work/actual" 2>&1 < /dev/null
+        check "$name --profile-use $level" "$program.out" "$work/actual"
+    done
+done
+"$ppp" "$tests/closed_form" --profile-use="$work/closed_form.pgo" -O1 --dump-passes 2> /dev/null > "$work/actual"
+expect "closed_form --profile-use matches its loops" grep -q "PROFILE .*: 3/3 loops matched" "$work/actual"
+
+# --max-steps, --max-time and --max-output stop a run with an error, in the
+# tree walker and on the VM; only the output limit stops at an exact byte
+printf 'repeat 1000000000 times write "x";\n' > "$work/endless_output.ppp"
+for engine in tree vm; do
+    for limit in output steps time; do
+        case $limit in
+            output) flag=--max-output=10; message="xxxxxxxxxxError: Output limit of 10 bytes exceeded" ;;
+            steps) flag=--max-steps=1000; message="Error: Step limit of 1000 exceeded" ;;
+            time) flag=--max-time=0.2; message="Error: Time limit of 0.2 s exceeded" ;;
+        esac
+        printf '%s\n[exit 1]\n' "$message" > "$work/expected"
+        "$ppp" "$work/endless_output" --engine=$engine $flag > "$work/run" 2>&1
+        echo "[exit $?]" >> "$work/run"
+        # how many x get out before the step and time limits varies
+        if [ $limit = output ]; then cp "$work/run" "$work/actual"; else sed 's/^x*//' "$work/run" > "$work/actual"; fi
+        check "endless_output --engine=$engine $flag" "$work/expected" "$work/actual"
+    done
+done
+
+# --serve and --client, by path and inline. A script that does not compile
+# and one stopped by a limit both make the client fail, and the load
+# generator count them as failed.
+printf 'number a;\nrepeat 1000000000 times a += 1;\n' > "$work/endless.ppp"
+printf 'write b;\n' > "$work/broken.ppp"
+"$ppp" --serve "$work/socket" --max-steps=10000000 > "$work/server" 2>&1 &
+server=$!
+tries=0
+while [ ! -S "$work/socket" ] && [ "$tries" -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+for flags in "" --inline; do
+    # shellcheck disable=SC2086
+    "$ppp" --client "$work/socket" "$tests/loops" $flags > "$work/actual" 2>&1
+    check "loops --client $flags" "$tests/loops.out" "$work/actual"
+done
+"$ppp" --client "$work/socket" "$work/endless" > "$work/actual" 2>&1
+echo "[exit $?]" >> "$work/actual"
+printf 'Error: Step limit of 10000000 exceeded\n[exit 1]\n' > "$work/expected"
+check "endless --client" "$work/expected" "$work/actual"
+"$ppp" --client "$work/socket" "$work/broken" > "$work/actual" 2>&1
+echo "[exit $?]" >> "$work/actual"
+printf "ERR Error on line 1: Undefine variable 'b'\n[exit 1]\n" > "$work/expected"
+check "broken --client" "$work/expected" "$work/actual"
+for program in "$tests/loops" "$work/endless"; do
+    failures=0
+    [ "$program" = "$work/endless" ] && failures=4
+    "$ppp" --client "$work/socket" "$program" --requests=4 --concurrency=2 > "$work/actual" 2>&1
+    expect "$(basename "$program") --requests=4" grep -q "^requests: *4 ($failures failed)" "$work/actual"
+done
+kill "$server"
+wait "$server" 2> /dev/null
+
+# --batch over the corpus, whole runs and time-sliced ones taking turns
+: > "$work/expected"
+for source in "$tests"/*.ppp; do
+    echo "==> $(basename "$source") <==" >> "$work/expected"
+    cat "${source%.ppp}.out" >> "$work/expected"
+done
+for flags in "" --slice=1000; do
+    # shellcheck disable=SC2086
+    "$ppp" --batch "$tests" -j 3 $flags > "$work/actual" 2> /dev/null
+    check "--batch $flags" "$work/expected" "$work/actual"
+done
+
+# Parallel lexing: a generated source above LEX_CHUNK_MIN (4 MB) lexed on
+# several threads has to run like the one lexed on a single thread
+"$ppp" "$work/big" --gen=lines=300000,seed=7 > /dev/null 2>&1
+"$ppp" "$work/big" --lex-threads=1 --parse-threads=1 > "$work/big.out" 2>&1
+for threads in 2 4; do
+    "$ppp" "$work/big" --lex-threads=$threads --parse-threads=1 > "$work/actual" 2>&1
+    check "big --lex-threads=$threads" "$work/big.out" "$work/actual"
+done
+
+# Parallel parsing: the same source has far more than PARSE_SPLIT_MIN
+# (65536) tokens in its top-level list. The defaults use every core.
+for flags in --parse-threads=2 --parse-threads=4 "--lex-threads=4 --parse-threads=4" ""; do
+    # shellcheck disable=SC2086
+    "$ppp" "$work/big" $flags > "$work/actual" 2>&1
+    check "big $flags" "$work/big.out" "$work/actual"
+done
+
+# Nesting 100000 levels deep, as blocks and as bare loop headers, in every
+# mode but the legacy lexer (it reads lines of up to 1023 bytes) and as
+# assembly (a C compiler gives up on blocks nested that deep)
+awk 'BEGIN {
+    depth = 100000
+    print "number a;"
+    print "number b;"
+    for (i = 0; i < depth; i++) print "repeat 1 times {"
+    print "a += 1;"
+    for (i = 0; i < depth; i++) print "}"
+    for (i = 0; i < 20; i++) printf "repeat 2 times "
+    print "b += 1;"
+    for (i = 0; i < depth; i++) printf "repeat 1 times "
+    print "b += 1;"
+    print "write a and newline and b and newline;"
+}' > "$work/deep.ppp"
+printf '1\n1048577\n' > "$work/deep.out"
+while read -r mode; do
+    [ "$mode" = --lexer=legacy ] && continue
+    # shellcheck disable=SC2086
+    "$ppp" "$work/deep" $mode > "$work/actual" 2>&1 < /dev/null
+    check "deep $mode" "$work/deep.out" "$work/actual"
+done <<MODES
+$modes
+MODES
+if "$ppp" "$work/deep" --emit=asm -o "$work/deep" > "$work/actual" 2>&1; then
+    "$work/deep" > "$work/actual" 2>&1
+fi
+check "deep -o (asm)" "$work/deep.out" "$work/actual"
+
+# --watch reruns a file on every save, also when the save renames a new
+# file over it; a change to one statement parses only that statement, and
+# a version that does not compile leaves the last good one loaded
+mkdir "$work/watch"
+cp "$tests/basic.ppp" "$work/watch/w.ppp"
+"$ppp" --watch "$work/watch/w" > "$work/watch.out" 2> "$work/watch.err" &
+watcher=$!
+# watched <n>: waits until --watch has reported <n> runs
+watched() {
+    tries=0
+    while [ "$(grep -c '^\[watch\]' "$work/watch.err")" -lt "$1" ] && [ "$tries" -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+}
+# save <file>: renames a copy of <file> over w.ppp and waits for its run
+runs=1
+save() {
+    cp "$1" "$work/watch/new.ppp"
+    mv "$work/watch/new.ppp" "$work/watch/w.ppp"
+    runs=$((runs + 1))
+    watched "$runs"
+}
+watched 1
+save "$tests/loops.ppp"
+sed 's/100000/110000/' "$tests/loops.ppp" > "$work/edited.ppp"
+save "$work/edited.ppp"
+printf 'write b;\n' > "$work/broken_watch.ppp"
+save "$work/broken_watch.ppp"
+kill "$watcher"
+wait "$watcher" 2> /dev/null
+"$ppp" "$work/edited" > "$work/edited.out" 2>&1
+cat "$tests/basic.out" "$tests/loops.out" "$work/edited.out" > "$work/expected"
+echo "Error on line 1: Undefine variable 'b'" >> "$work/expected"
+check "--watch output" "$work/expected" "$work/watch.out"
+expect "--watch parses one changed statement" grep -q ": lines 16-20 lexed, 1 of 11 statements parsed" "$work/watch.err"
+expect "--watch keeps the last good version" grep -q "w.ppp: not run, the last good version stays loaded" "$work/watch.err"
+
+# --exec-threads on a program whose regions each write more than
+# EXEC_OUTPUT_LIMIT (1 MB): workers buffering ahead must not hold up the
+# region the committer waits on
+"$ppp" "$tests/exec/backlog" > "$work/backlog.out" 2>&1
+for threads in 2 4; do
+    timeout 60 "$ppp" "$tests/exec/backlog" --exec-threads=$threads > "$work/actual" 2>&1
+    check "exec/backlog --exec-threads=$threads" "$work/backlog.out" "$work/actual"
+done
+
+echo "$((count - failed))/$count passed"
+[ "$failed" -eq 0 ]